@@ -1,10 +1,3 @@
 #!/bin/bash
-
-for file in Gdataset/*.txt; do
-    title=$(basename "$file" .txt)
-    authors="Desconhecido"
-    year="2000"
-    path=$(basename "$file")
-
-    ./bin/dclient -a "$title" "$authors" "$year" "$path"
-done
+# Indexa todos os ficheiros da pasta do servidor (Gdataset) num único pedido
+./bin/dclient -b . 2000
@@ -0,0 +1,32 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+// Eviction policies for the metadata cache. A policy only tracks which ids are
+// resident; the caller keeps the cached data. Ids must be positive.
+typedef struct {
+    const char *name;
+    void *(*create)(int capacity);
+    void (*destroy)(void *state);
+    int (*lookup)(void *state, int id);    // 1 on a hit; every access goes through here
+    int (*insert)(void *state, int id);    // after a miss; returns the evicted id or -1
+    void (*remove)(void *state, int id);
+    int (*keys)(void *state, int *out, int max);   // resident ids, most valuable first
+} CachePolicy;
+
+const CachePolicy *cache_policy_find(const char *name);
+const char *cache_policy_names();
+
+// Open-addressing id -> int map (no tombstones), shared by the policies
+typedef struct {
+    int *keys;     // 0 = empty
+    int *values;
+    unsigned int mask;
+} KeyMap;
+
+int keymap_init(KeyMap *map, int capacity);
+void keymap_free(KeyMap *map);
+int keymap_get(const KeyMap *map, int key);   // -1 if absent
+void keymap_put(KeyMap *map, int key, int value);
+void keymap_delete(KeyMap *map, int key);
+
+#endif
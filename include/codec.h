@@ -0,0 +1,26 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+
+// Blocks of CODEC_BLOCK unsigned ints bit-packed at one width (PForDelta): the width is
+// the one that makes the block smallest, and the few values that need more bits have
+// their high bits patched in afterwards from a short exception list. Values are laid out
+// four lanes wide, so a 128-bit vector unpacks four consecutive values at once.
+#define CODEC_BLOCK 128
+#define CODEC_MAX_BYTES (2 + 4 * CODEC_BLOCK)   // largest encoded block
+
+typedef enum {
+    CODEC_SCALAR,
+    CODEC_SSE2
+} CodecImpl;
+
+CodecImpl codec_best_impl();
+const char *codec_impl_name(CodecImpl impl);
+size_t codec_encode(const unsigned int *values, unsigned char *out);
+size_t codec_decode_with(CodecImpl impl, const unsigned char *in, unsigned int *out);
+size_t codec_decode(const unsigned char *in, unsigned int *out);
+void codec_prefix_sum_with(CodecImpl impl, unsigned int *values, int count, unsigned int base);
+void codec_prefix_sum(unsigned int *values, int count, unsigned int base);
+
+#endif
@@ -14,7 +14,6 @@
 #include <dirent.h>
 
 #define FIFO_SERVER "/tmp/docindex_server_fifo"
-#define MAX_DOCUMENTS 2500
 #define MAX_TITLE 200
 #define MAX_AUTHORS 200
 #define MAX_YEAR 4
@@ -29,26 +28,55 @@ typedef enum {
     CMD_REMOVE,
     CMD_LINE_COUNT,
     CMD_SEARCH,
-    CMD_SHUTDOWN
+    CMD_SHUTDOWN,
+    CMD_BULK_ADD,
+    CMD_SESSION_END,
+    CMD_STATS
 } CommandType;
 
+#define MSG_SESSION 1   // reply FIFO stays open across requests (dclient --batch)
+#define MSG_SHM 2       // payload goes through the client's shared-memory ring (see ring.h)
+
+// Reference to a string in the document store's arena (see index_str)
+typedef struct {
+    unsigned int offset;
+    unsigned int length;
+} StrRef;
+
 typedef struct {
     int id;
-    char title[MAX_TITLE+1];
-    char authors[MAX_AUTHORS+1];
+    StrRef title;
+    StrRef authors;
+    StrRef path;
     char year[MAX_YEAR+1];
-    char path[MAX_PATH+1];
 } DocumentMeta;
 
 typedef struct {
     CommandType command;
+    unsigned int request_id;   // echoed in every response frame
+    int flags;
     char client_fifo[256];
     char args[512];
 } Message;
 
 typedef struct {
-    int id;
+    int id;     // 0 = free slot
     DocumentMeta meta;
 } CacheEntry;
 
+unsigned int crc32_update(unsigned int crc, const void *data, size_t len);
+
+// Streaming XXH64 content hash
+typedef struct {
+    unsigned long long v[4];
+    unsigned long long seed;
+    unsigned long long total;
+    unsigned char buffer[32];
+    size_t buffered;
+} Xxh64;
+
+void xxh64_init(Xxh64 *s, unsigned long long seed);
+void xxh64_update(Xxh64 *s, const void *data, size_t len);
+unsigned long long xxh64_digest(const Xxh64 *s);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#define MAX_EXECUTOR_THREADS 64
+
+// Processes items [begin, end) of a job
+typedef void (*TaskFn)(void *ctx, int begin, int end);
+
+int executor_start(int threads);
+int executor_threads();
+void executor_run(TaskFn fn, void *ctx, int count, int concurrency);
+long executor_steals();
+void executor_stop();
+
+#endif
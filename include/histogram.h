@@ -0,0 +1,31 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+// Log-linear latency histogram (HDR-style): values below HIST_SUB are exact, and every
+// power of two above is split into HIST_SUB linear buckets, so a percentile is off by
+// at most 1/HIST_SUB (about 3%). Values are clamped to 2^HIST_MAX_BITS - 1.
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} Histogram;
+
+void histogram_init(Histogram *h);
+void histogram_record(Histogram *h, uint64_t value);
+void histogram_merge(Histogram *dst, const Histogram *src);
+void histogram_record_owned(Histogram *h, uint64_t value);
+void histogram_merge_live(Histogram *dst, const Histogram *src);
+uint64_t histogram_percentile(const Histogram *h, double percent);
+double histogram_mean(const Histogram *h);
+uint64_t histogram_bucket_upper(int bucket);
+
+#endif
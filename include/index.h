@@ -1,18 +1,33 @@
 #ifndef INDEX_H
 #define INDEX_H
 
+#include "postings.h"
+
 extern char document_folder[256];
 
 int index_add(const char *title, const char *authors, const char *year, const char *path);
-DocumentMeta* index_query(int id);
+int index_insert(int id, const char *title, const char *authors, const char *year, const char *path);
+int index_add_prepared(const char *title, const char *authors, const char *year, const char *path,
+                       const DocumentTerms *terms);
+int index_replace(int id, const char *title, const char *authors, const DocumentTerms *terms);
+DocumentMeta* index_query(int id, DocumentMeta *out);
+DocumentMeta* index_lookup(int id);
 int index_remove(int id);
 int index_load(const char *filename);
 int index_save(const char *filename);
+int index_verify(const char *filename);
+int index_import_text(const char *filename);
+int index_export_text(const char *filename);
+unsigned int index_fingerprint();
+void index_rebuild_postings();
 int index_total();
 DocumentMeta* index_get(int i);
-int index_save(const char *filename);
-int index_load(const char *filename);
 int index_get_count();
+int index_next(int i);
+const char *index_str(StrRef ref);
+size_t index_memory_bytes();
+int index_needs_compaction();
+int index_compact_step(int max_moves);
 int extract_metadata(const char *filepath, char *title, size_t max_title, char *author, size_t max_author);
 
 #endif
\ No newline at end of file
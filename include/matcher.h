@@ -0,0 +1,33 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <stddef.h>
+#include <regex.h>
+
+typedef enum {
+    MATCHER_SCALAR,
+    MATCHER_SSE2,
+    MATCHER_AVX2
+} MatcherImpl;
+
+// A "grep -q" pattern: fixed strings use the SIMD finder, anything else a POSIX basic regex
+typedef struct {
+    int fixed;
+    const char *text;
+    size_t length;
+    regex_t regex;
+} Pattern;
+
+int matcher_is_fixed(const char *pattern);
+MatcherImpl matcher_best_impl();
+const char *matcher_impl_name(MatcherImpl impl);
+long matcher_count_lines_with(MatcherImpl impl, const char *buf, size_t len, const char *pattern, size_t plen);
+long matcher_count_lines(const char *buf, size_t len, const char *pattern, size_t plen);
+int matcher_count_file(const char *filepath, const char *pattern, long *count);
+int matcher_compile(Pattern *p, const char *pattern);
+int matcher_compile_counting(Pattern *p, const char *pattern);
+int matcher_file_matches(const Pattern *p, const char *filepath);
+int matcher_file_counts(const Pattern *p, const char *filepath, long *occurrences, long *lines);
+void matcher_free(Pattern *p);
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef POSTINGS_H
+#define POSTINGS_H
+
+#include <stddef.h>
+
+#define MAX_TERM 64
+
+// The version of a file its terms were read from; mtime_ns = 0 means unknown
+typedef struct {
+    long long size;
+    long long mtime_ns;
+    unsigned long long hash;    // XXH64 of the contents
+} FileState;
+
+// Distinct terms of one document and the term at every position, gathered before it
+// is merged into the index
+typedef struct {
+    char *text;         // NUL-separated terms
+    size_t length;
+    size_t capacity;
+    int count;
+    int *offsets;       // term index -> offset into text
+    int *table;         // term index + 1, 0 = empty slot
+    int table_size;
+    int *tokens;        // term index at each position, -1 if it could not be stored
+    int token_count;
+    int token_capacity;
+    int *breaks;        // positions whose word is the first of a new line
+    int break_count;
+    int break_capacity;
+    FileState state;    // of the file as it was read
+} DocumentTerms;
+
+// Walks the positions of a term in one document, decoding them as it goes
+typedef struct {
+    const unsigned char *p;
+    int left;
+    int last;
+} PositionCursor;
+
+#define POSTING_BLOCK 128   // postings per block of a list (one codec block)
+
+// Skip entry of one block of a posting list: the ids it spans, and where its encoded ids
+// and its first posting's positions start
+typedef struct {
+    int first;
+    int last;
+    unsigned int data;
+    unsigned int positions;
+    unsigned short count;
+    unsigned char packed;       // bit-packed, else variable-byte
+} PostingBlock;
+
+// Cursor over one term's posting list, ids ascending. Skip entries are searched without
+// decoding anything; only the block the cursor stops in is decoded, with where each of
+// its postings' positions start. Reads the index in place, like a position cursor.
+typedef struct {
+    const PostingBlock *blocks;
+    const unsigned char *data;
+    const unsigned char *positions;
+    int block_count;
+    int count;
+    int max_frequency;
+    int block;                  // decoded block
+    int index;                  // current posting within it
+    int id;                     // current posting, -1 past the end
+    int ids[POSTING_BLOCK];
+    unsigned int offsets[POSTING_BLOCK];
+} PostingList;
+
+int postings_add_document(int id, const char *filepath);
+int postings_tokenize(const char *filepath, DocumentTerms *out);
+int postings_add_terms(int id, const DocumentTerms *terms);
+void postings_free_terms(DocumentTerms *terms);
+void postings_remove_document(int id);
+int postings_count(const char *term);
+int *postings_ids(const char *term, int *count);
+int *postings_candidates(const char *keyword, int *count);
+int postings_list(const char *term, PostingList *list);
+int postings_next(PostingList *list);
+int postings_advance(PostingList *list, int target);
+int postings_frequency(const PostingList *list);
+int postings_document_length(int id);
+int postings_count_lines(int id, const int *positions, int count);
+int postings_same_content(int id, const int **ids);
+int postings_content_of(int id);
+int postings_alias_count();
+int postings_file_state(int id, FileState *state);
+void postings_set_file_state(int id, const FileState *state);
+void postings_length_stats(double *average, int *minimum);
+int postings_positions(const char *term, int id, PositionCursor *cursor);
+int postings_list_positions(const PostingList *list, PositionCursor *cursor);
+int postings_next_position(PositionCursor *cursor);
+int postings_split(const char *text, char *terms, size_t max_terms);
+int postings_normalize(const char *keyword, char *term, size_t max_term);
+int postings_save(const char *filename, int doc_count, unsigned int fingerprint);
+int postings_load(const char *filename, int doc_count, unsigned int fingerprint);
+int postings_term_count();
+size_t postings_memory_bytes();
+void postings_clear();
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include "ring.h"
+
+// A response is a stream of frames on the client FIFO: one HEADER (status and total
+// length, if known), any number of DATA frames, then END carrying the number of
+// payload bytes sent, so the client can tell a complete response from a cut one.
+// Every frame carries the request id and fits in PIPE_BUF, so each is written
+// atomically and the responses of pipelined requests may interleave frame by frame.
+// With a shared-memory ring (MSG_SHM) payload goes through the ring instead and RING
+// frames on the FIFO announce how many bytes of it belong to the request.
+#define FRAME_PAYLOAD_MAX (PIPE_BUF - sizeof(FrameHeader))
+#define LENGTH_UNKNOWN UINT64_MAX
+
+typedef enum {
+    FRAME_HEADER = 1,
+    FRAME_DATA,
+    FRAME_END,
+    FRAME_RING      // payload: uint32_t byte count, next in the ring
+} FrameType;
+
+typedef enum {
+    STATUS_OK,
+    STATUS_ERROR
+} ResponseStatus;
+
+typedef struct {
+    uint32_t type;
+    uint32_t request_id; // Message.request_id of the request answered
+    uint32_t length;     // payload bytes that follow
+} FrameHeader;
+
+typedef struct {
+    uint32_t status;
+    uint32_t reserved;
+    uint64_t total_length;
+} ResponseHeader;
+
+// Server side: buffers up to one frame of payload at a time
+typedef struct {
+    int fd;
+    int failed;
+    uint32_t request_id;
+    uint64_t sent;
+    size_t used;
+    RingWriter *ring;    // set by stream_use_ring
+    char *chunk;         // RING_CHUNK staging buffer for the ring
+    char frame[PIPE_BUF];
+} ResponseStream;
+
+int stream_begin(ResponseStream *s, int fd, uint32_t request_id, ResponseStatus status, uint64_t total_length);
+int stream_use_ring(ResponseStream *s, RingWriter *ring);
+int stream_write(ResponseStream *s, const void *data, size_t len);
+int stream_printf(ResponseStream *s, const char *fmt, ...);
+int stream_end(ResponseStream *s);
+
+int read_full(int fd, void *buf, size_t len);
+int write_full(int fd, const void *buf, size_t len);
+int frame_read(int fd, FrameHeader *header, void *payload, size_t max);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "postings.h"
+
+// Boolean queries over the inverted index: terms combined with AND, OR, NOT and
+// parentheses, e.g. "romeo AND (juliet OR tybalt) AND NOT nurse". Operators are
+// uppercase; adjacent terms are ANDed. Terms are looked up in the index, so they match
+// whole words and ignore case, unlike a plain keyword (a grep-style, case-sensitive
+// substring); a lone word in parentheses is read as a plain keyword (query_unwrap).
+// Words in double quotes match only as an exact phrase (consecutive positions).
+#define MAX_QUERY_NODES 64
+#define MAX_QUERY_TEXT 4096
+#define MAX_PHRASE_TERMS 32
+
+typedef enum { QUERY_TERM, QUERY_PHRASE, QUERY_AND, QUERY_OR, QUERY_NOT } QueryNodeType;
+
+typedef struct {
+    QueryNodeType type;
+    int left;                   // child nodes (NOT uses left only), -1 = none
+    int right;
+    int text;                   // TERM/PHRASE: offset of its NUL-separated terms in Query.text
+    int length;                 // and how many there are
+} QueryNode;
+
+typedef struct {
+    QueryNode nodes[MAX_QUERY_NODES];
+    int count;
+    int root;
+    char text[MAX_QUERY_TEXT];
+    int text_length;
+} Query;
+
+// Every live document id, sorted; needed only when a NOT has nothing to subtract from
+typedef int *(*QueryUniverse)(int *count);
+
+char *query_unwrap(char *text);
+int query_parse(const char *text, Query *query, const char **error);
+int query_parse_words(const char *text, Query *query);
+int *query_run(const Query *query, QueryUniverse universe, int doc_count, int *count);
+int *query_rank(const Query *query, QueryUniverse universe, int doc_count, int k, int *count);
+int query_counts(const Query *query, int id, long *occurrences, long *lines);
+int query_matches(const Query *query, int id);
+int query_format(const Query *query, char *out, size_t size);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+// Results of recent searches, keyed by the normalized query. Every add and remove bumps
+// the corpus generation and goes into a short change log, so an entry computed at an
+// older generation can be brought up to date by testing only the documents that changed
+// since, instead of running the search again.
+#define RESULT_LOG_SIZE 4096          // changes an entry can be brought forward across
+#define RESULT_MAX_IDS (1 << 20)      // larger results are not kept
+
+typedef struct {
+    int *ids;            // ascending, or best first for a ranked search
+    long *counts;        // two per id (occurrences, matching lines), or NULL
+    int count;
+} SearchResult;
+
+// Tests one changed document for an entry: 1 = it matches (and fills its two counts
+// when the entry has them), 0 = it does not, -1 = out of memory
+typedef int (*ResultTest)(void *ctx, int id, long *counts);
+
+int resultcache_init(int capacity);
+int resultcache_get(const char *key, unsigned long generation, ResultTest test, void *ctx, SearchResult *out);
+void resultcache_put(const char *key, unsigned long generation, const SearchResult *result);
+void resultcache_record(int id, int added);
+unsigned long resultcache_generation();
+void resultcache_stats(long *hits, long *patched, long *misses, int *entries, int *capacity);
+void resultcache_free(SearchResult *result);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Shared-memory byte ring for large response payloads. The client creates it and
+// consumes from it in place; the server copies payload chunks in and announces each
+// one with a small control frame on the FIFO, so the bytes are copied once.
+#define RING_SIZE (4u << 20)      // data bytes, power of two
+#define RING_CHUNK (64u << 10)    // payload buffered per announcement
+#define RING_MAGIC 0x474e4952u    // "RING"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;
+    pid_t owner;                  // consumer, so producers stop waiting for a dead one
+    uint64_t head;                // bytes produced
+    uint64_t tail;                // bytes consumed
+    char data[];
+} ShmRing;
+
+// Producer side: payloads of concurrent responses are put and announced under lock,
+// so the control frames on the FIFO come in ring order
+typedef struct {
+    ShmRing *shm;
+    size_t mapped;
+    pthread_mutex_t lock;
+} RingWriter;
+
+void ring_name(const char *client_fifo, char *name, size_t size);
+
+ShmRing *ring_create(const char *name, uint32_t size);
+void ring_destroy(ShmRing *ring, const char *name);
+size_t ring_span(ShmRing *ring, size_t len, const char **data);
+void ring_consume(ShmRing *ring, size_t len);
+
+RingWriter *ring_writer_open(const char *name);
+int ring_put(ShmRing *ring, const void *data, size_t len);
+void ring_writer_close(RingWriter *writer);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+#include "histogram.h"
+
+// Live request statistics. Every worker records into its own slot (single writer,
+// relaxed stores), so the request path takes no lock; CMD_STATS sums the slots.
+#define STATS_COMMANDS (CMD_STATS + 1)
+#define MAX_STATS_THREADS 128
+
+typedef struct {
+    Histogram latency[STATS_COMMANDS];   // microseconds, from receipt to reply
+    uint64_t scans;                      // scan-mode searches
+    uint64_t docs_scanned;
+    uint64_t indexed_searches;
+} ThreadStats;
+
+int stats_register_thread();
+void stats_record(int command, uint64_t latency_us);
+void stats_count_search(int indexed, long docs);
+void stats_collect(ThreadStats *total);
+const char *stats_command_name(int command);
+double stats_now_us();
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef WAL_H
+#define WAL_H
+
+typedef enum {
+    WAL_NONE,      // write() only: survives a server crash, not a power loss
+    WAL_BATCH,     // group commit: concurrent writers share one fsync
+    WAL_ALWAYS     // one fsync per mutation
+} WalDurability;
+
+typedef struct {
+    void (*add)(int id, const char *title, const char *authors, const char *year, const char *path);
+    void (*remove)(int id);
+} WalHandlers;
+
+int wal_open(const char *filename, WalDurability durability);
+long wal_log_add(int id, const char *title, const char *authors, const char *year, const char *path);
+long wal_log_remove(int id);
+int wal_sync(long lsn);
+int wal_commit();
+long wal_size();
+int wal_rotate(const char *old_filename);
+int wal_reset();
+int wal_replay(const char *filename, const WalHandlers *handlers);
+void wal_close();
+
+#endif
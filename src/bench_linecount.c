@@ -0,0 +1,101 @@
+#include "common.h"
+#include "matcher.h"
+#include <sys/mman.h>
+
+// Microbenchmark: in-process line counting (each matcher implementation)
+// against the fork + exec("grep -c") path that handle_line_count used.
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static long grep_count(const char *pattern, const char *path) {
+    int pipefd[2];
+    if (pipe(pipefd) == -1) return -1;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(pipefd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[1]);
+        execlp("grep", "grep", "-c", pattern, path, (char *)NULL);
+        _exit(1);
+    }
+
+    close(pipefd[1]);
+    char buf[64] = {0};
+    ssize_t n = read(pipefd[0], buf, sizeof(buf) - 1);
+    close(pipefd[0]);
+    waitpid(pid, NULL, 0);
+    return n > 0 ? atol(buf) : 0;
+}
+
+static long mmap_count(MatcherImpl impl, const char *pattern, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+    struct stat st;
+    fstat(fd, &st);
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    long count = matcher_count_lines_with(impl, data, st.st_size, pattern, strlen(pattern));
+    munmap(data, st.st_size);
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = 200;
+    int argi = 1;
+
+    if (argi + 1 < argc && strcmp(argv[argi], "-n") == 0) {
+        iterations = atoi(argv[argi + 1]);
+        argi += 2;
+    }
+    if (argc - argi < 2 || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [-n iterations] \"keyword\" file...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *pattern = argv[argi++];
+    MatcherImpl best = matcher_best_impl();
+    MatcherImpl impls[] = { MATCHER_SCALAR, MATCHER_SSE2, MATCHER_AVX2 };
+    int nimpls = (int)(best - MATCHER_SCALAR) + 1;
+
+    printf("pattern \"%s\", %d iterations, best matcher: %s\n", pattern, iterations, matcher_impl_name(best));
+    printf("%-24s %-10s %10s %12s %10s\n", "file", "path", "count", "us/call", "speedup");
+
+    int mismatches = 0;
+    for (; argi < argc; argi++) {
+        const char *path = argv[argi];
+        long expected = grep_count(pattern, path);
+
+        double start = now_us();
+        for (int i = 0; i < iterations; i++) grep_count(pattern, path);
+        double grep_us = (now_us() - start) / iterations;
+        printf("%-24s %-10s %10ld %12.2f %10s\n", path, "fork+grep", expected, grep_us, "1.00x");
+
+        for (int k = 0; k < nimpls; k++) {
+            long count = mmap_count(impls[k], pattern, path);
+            if (count != expected) mismatches++;
+
+            start = now_us();
+            for (int i = 0; i < iterations; i++) mmap_count(impls[k], pattern, path);
+            double us = (now_us() - start) / iterations;
+            printf("%-24s %-10s %10ld %12.2f %9.1fx%s\n", path, matcher_impl_name(impls[k]),
+                   count, us, grep_us / us, count != expected ? "  MISMATCH" : "");
+        }
+    }
+
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
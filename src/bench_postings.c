@@ -0,0 +1,142 @@
+#include "common.h"
+#include "codec.h"
+
+// Microbenchmark: bytes per posting and decode speed of document id lists stored as
+// plain ints, as variable-byte gaps, and as bit-packed blocks (each codec implementation),
+// over synthetic lists of a few densities.
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int varint_put(unsigned char *out, unsigned int value) {
+    int n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+// Ascending ids where each one is present with the given probability; every 64th gap
+// is a long jump, as between the files of unrelated directories
+static int make_list(unsigned int *ids, int count, double density, unsigned int seed) {
+    unsigned int id = 0;
+    srand(seed);
+    for (int i = 0; i < count; i++) {
+        unsigned int gap = 1;
+        while ((double)rand() / RAND_MAX > density) gap++;
+        if (i % 64 == 63) gap += (unsigned int)(rand() % 100000);
+        ids[i] = id += gap;
+    }
+    return count;
+}
+
+static size_t encode_varint(const unsigned int *ids, int count, unsigned char *out) {
+    size_t length = 0;
+    for (int i = 0; i < count; i++) length += varint_put(out + length, ids[i] - (i ? ids[i - 1] : 0));
+    return length;
+}
+
+static void decode_varint(const unsigned char *in, int count, unsigned int *out) {
+    unsigned int id = 0;
+    for (int i = 0; i < count; i++) {
+        unsigned int value = 0;
+        int shift = 0;
+        while (*in & 0x80) {
+            value |= (unsigned int)(*in++ & 0x7f) << shift;
+            shift += 7;
+        }
+        value |= (unsigned int)*in++ << shift;
+        out[i] = id += value;
+    }
+}
+
+// Whole blocks only, gaps from the block's first id, as the postings store them
+static size_t encode_blocks(const unsigned int *ids, int count, unsigned char *out) {
+    unsigned int gaps[CODEC_BLOCK];
+    size_t length = 0;
+    for (int b = 0; b < count; b += CODEC_BLOCK) {
+        for (int i = 0; i < CODEC_BLOCK; i++) gaps[i] = i ? ids[b + i] - ids[b + i - 1] : 0;
+        length += codec_encode(gaps, out + length);
+    }
+    return length;
+}
+
+static void decode_blocks(CodecImpl impl, const unsigned char *in, const unsigned int *firsts, int count, unsigned int *out) {
+    for (int b = 0; b < count; b += CODEC_BLOCK) {
+        in += codec_decode_with(impl, in, out + b);
+        codec_prefix_sum_with(impl, out + b, CODEC_BLOCK, firsts[b / CODEC_BLOCK]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int count = 1 << 20;
+    int iterations = 50;
+    if (argc > 1) count = atoi(argv[1]);
+    if (argc > 2) iterations = atoi(argv[2]);
+    if (count <= 0 || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [postings [iterations]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    count = (count + CODEC_BLOCK - 1) / CODEC_BLOCK * CODEC_BLOCK;
+
+    unsigned int *ids = malloc(count * sizeof(unsigned int));
+    unsigned int *out = malloc(count * sizeof(unsigned int));
+    unsigned int *firsts = malloc(count / CODEC_BLOCK * sizeof(unsigned int));
+    unsigned char *varints = malloc((size_t)count * 5);
+    unsigned char *blocks = malloc((size_t)count / CODEC_BLOCK * CODEC_MAX_BYTES);
+    if (!ids || !out || !firsts || !varints || !blocks) return EXIT_FAILURE;
+
+    CodecImpl best = codec_best_impl();
+    CodecImpl impls[] = { CODEC_SCALAR, CODEC_SSE2 };
+    int nimpls = (int)(best - CODEC_SCALAR) + 1;
+    double densities[] = { 0.9, 0.3, 0.05, 0.005 };
+
+    printf("%d postings, %d iterations, best codec: %s\n", count, iterations, codec_impl_name(best));
+    printf("%-8s %-10s %12s %12s %10s\n", "density", "format", "bytes/post", "Mpost/s", "speedup");
+
+    int mismatches = 0;
+    for (size_t d = 0; d < sizeof(densities) / sizeof(densities[0]); d++) {
+        make_list(ids, count, densities[d], 42 + (unsigned int)d);
+        for (int b = 0; b < count / CODEC_BLOCK; b++) firsts[b] = ids[b * CODEC_BLOCK];
+        size_t varint_bytes = encode_varint(ids, count, varints);
+        size_t block_bytes = encode_blocks(ids, count, blocks);
+
+        double start = now_us();
+        for (int i = 0; i < iterations; i++) memcpy(out, ids, count * sizeof(unsigned int));
+        double raw_us = (now_us() - start) / iterations;
+        printf("%-8.3f %-10s %12.2f %12.1f %10s\n", densities[d], "raw", 4.0, count / raw_us, "1.00x");
+
+        decode_varint(varints, count, out);
+        if (memcmp(out, ids, count * sizeof(unsigned int)) != 0) mismatches++;
+        start = now_us();
+        for (int i = 0; i < iterations; i++) decode_varint(varints, count, out);
+        double us = (now_us() - start) / iterations;
+        printf("%-8.3f %-10s %12.2f %12.1f %9.2fx\n", densities[d], "varint",
+               (double)varint_bytes / count, count / us, raw_us / us);
+
+        for (int k = 0; k < nimpls; k++) {
+            decode_blocks(impls[k], blocks, firsts, count, out);
+            int same = memcmp(out, ids, count * sizeof(unsigned int)) == 0;
+            if (!same) mismatches++;
+            start = now_us();
+            for (int i = 0; i < iterations; i++) decode_blocks(impls[k], blocks, firsts, count, out);
+            us = (now_us() - start) / iterations;
+            // The skip entry's first id is counted against the blocks
+            printf("%-8.3f %-10s %12.2f %12.1f %9.2fx%s\n", densities[d], codec_impl_name(impls[k]),
+                   (double)(block_bytes + 4 * (count / CODEC_BLOCK)) / count, count / us, raw_us / us,
+                   same ? "" : "  MISMATCH");
+        }
+    }
+
+    free(ids);
+    free(out);
+    free(firsts);
+    free(varints);
+    free(blocks);
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
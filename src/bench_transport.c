@@ -0,0 +1,158 @@
+#include "common.h"
+#include "protocol.h"
+#include "ring.h"
+
+// Benchmark: streaming a large response (a formatted id list) from a producer process
+// to a consumer over the framed FIFO path and over the shared-memory ring, in MB/s.
+
+#define BENCH_FIFO "/tmp/docindex_bench_fifo"
+#define PIECE 1024   // bytes per stream_write, like a burst of formatted ids
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void produce(const char *payload, size_t payload_size, size_t total, const char *ring_name) {
+    int fd = open(BENCH_FIFO, O_WRONLY);
+    RingWriter *writer = ring_name ? ring_writer_open(ring_name) : NULL;
+    if (fd == -1 || (ring_name && !writer)) _exit(1);
+
+    ResponseStream stream;
+    stream_begin(&stream, fd, 1, STATUS_OK, total);
+    if (writer && stream_use_ring(&stream, writer) == -1) _exit(1);
+    for (size_t sent = 0; sent < total && !stream.failed; ) {
+        size_t offset = sent % payload_size;
+        size_t n = PIECE;
+        if (n > payload_size - offset) n = payload_size - offset;
+        if (n > total - sent) n = total - sent;
+        stream_write(&stream, payload + offset, n);
+        sent += n;
+    }
+    int failed = stream_end(&stream);
+    close(fd);
+    ring_writer_close(writer);
+    _exit(failed ? 1 : 0);
+}
+
+// Reads every byte, as printing the response would
+static unsigned long checksum(unsigned long sum, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) sum += (unsigned char)data[i];
+    return sum;
+}
+
+// Receives one response; returns the bytes received, -1 on a protocol error
+static long consume(ShmRing *ring, unsigned long *sum) {
+    int fd = open(BENCH_FIFO, O_RDONLY);
+    if (fd == -1) return -1;
+
+    char payload[FRAME_PAYLOAD_MAX];
+    FrameHeader frame;
+    uint64_t received = 0;
+    int ended = 0;
+    while (!ended && frame_read(fd, &frame, payload, sizeof(payload)) == 0) {
+        if (frame.type == FRAME_DATA) {
+            *sum = checksum(*sum, payload, frame.length);
+            received += frame.length;
+        } else if (frame.type == FRAME_RING && ring) {
+            uint32_t len;
+            memcpy(&len, payload, sizeof(len));
+            received += len;
+            while (len > 0) {
+                const char *data;
+                size_t n = ring_span(ring, len, &data);
+                if (n == 0) {
+                    close(fd);
+                    return -1;
+                }
+                *sum = checksum(*sum, data, n);
+                ring_consume(ring, n);
+                len -= n;
+            }
+        } else if (frame.type == FRAME_END) {
+            ended = memcmp(payload, &received, sizeof(received)) == 0 ? 1 : -1;
+        }
+    }
+    close(fd);
+    return ended == 1 ? (long)received : -1;
+}
+
+// One transfer (through the ring if there is one); returns MB/s, or -1
+static double run(const char *payload, size_t payload_size, size_t total, ShmRing *ring, const char *name,
+                  unsigned long *sum) {
+    double start = now_us();
+    pid_t pid = fork();
+    if (pid == 0) produce(payload, payload_size, total, ring ? name : NULL);
+
+    *sum = 0;
+    long received = pid == -1 ? -1 : consume(ring, sum);
+    int status = 1;
+    if (pid != -1) waitpid(pid, &status, 0);
+    double us = now_us() - start;
+
+    if (received != (long)total || status != 0) return -1;
+    return (total / 1048576.0) / (us / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = 3;
+    int argi = 1;
+    if (argi + 1 < argc && strcmp(argv[argi], "-n") == 0) {
+        rounds = atoi(argv[argi + 1]);
+        argi += 2;
+    }
+    if (rounds <= 0) {
+        fprintf(stderr, "Usage: %s [-n rounds] [megabytes...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The payload a search produces: "1, 2, 3, ..." repeated as needed
+    size_t payload_size = 1 << 20;
+    char *payload = malloc(payload_size + 16);
+    size_t len = 0;
+    for (int id = 1; len < payload_size; id++) len += snprintf(payload + len, 16, "%d, ", id);
+
+    // Like a session, the ring is created once and reused by every transfer
+    char name[300];
+    ring_name(BENCH_FIFO, name, sizeof(name));
+    ShmRing *ring = ring_create(name, RING_SIZE);
+
+    unlink(BENCH_FIFO);
+    if (!payload || !ring || mkfifo(BENCH_FIFO, 0600) == -1) {
+        perror("bench_transport");
+        if (ring) ring_destroy(ring, name);
+        return EXIT_FAILURE;
+    }
+
+    static const char *defaults[] = { "1", "16", "128" };
+    int nsizes = argc - argi;
+    const char **sizes = nsizes ? (const char **)argv + argi : defaults;
+    if (!nsizes) nsizes = 3;
+
+    printf("%d rounds, best of each; ring %u KiB, chunk %u KiB, frame payload %zu bytes\n",
+           rounds, RING_SIZE >> 10, RING_CHUNK >> 10, (size_t)FRAME_PAYLOAD_MAX);
+    printf("%10s %14s %14s %10s\n", "MB", "fifo MB/s", "shm MB/s", "speedup");
+
+    int failures = 0;
+    for (int s = 0; s < nsizes; s++) {
+        size_t total = (size_t)(atof(sizes[s]) * (1 << 20));
+        double best[2] = { 0, 0 };
+        unsigned long sums[2] = { 0, 0 };
+        for (int r = 0; r < rounds; r++) {
+            for (int k = 0; k < 2; k++) {
+                double mbs = run(payload, payload_size, total, k ? ring : NULL, name, &sums[k]);
+                if (mbs < 0) failures++;
+                if (mbs > best[k]) best[k] = mbs;
+            }
+        }
+        if (sums[0] != sums[1]) failures++;
+        printf("%10s %14.1f %14.1f %9.1fx%s\n", sizes[s], best[0], best[1],
+               best[0] > 0 ? best[1] / best[0] : 0, sums[0] != sums[1] ? "  MISMATCH" : "");
+    }
+
+    unlink(BENCH_FIFO);
+    ring_destroy(ring, name);
+    free(payload);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,644 @@
+#include "cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+// ---- id -> int map ----
+
+int keymap_init(KeyMap *map, int capacity) {
+    unsigned int size = 16;
+    while (size < (unsigned int)capacity * 2) size *= 2;
+    map->keys = calloc(size, sizeof(int));
+    map->values = malloc(size * sizeof(int));
+    map->mask = size - 1;
+    if (!map->keys || !map->values) {
+        keymap_free(map);
+        return -1;
+    }
+    return 0;
+}
+
+void keymap_free(KeyMap *map) {
+    free(map->keys);
+    free(map->values);
+    map->keys = map->values = NULL;
+}
+
+static unsigned int keymap_home(const KeyMap *map, int key) {
+    return ((unsigned int)key * 2654435761u) & map->mask;
+}
+
+int keymap_get(const KeyMap *map, int key) {
+    for (unsigned int pos = keymap_home(map, key); map->keys[pos]; pos = (pos + 1) & map->mask) {
+        if (map->keys[pos] == key) return map->values[pos];
+    }
+    return -1;
+}
+
+void keymap_put(KeyMap *map, int key, int value) {
+    unsigned int pos = keymap_home(map, key);
+    while (map->keys[pos] && map->keys[pos] != key) pos = (pos + 1) & map->mask;
+    map->keys[pos] = key;
+    map->values[pos] = value;
+}
+
+// Linear probing delete with backward shift, so no tombstones are needed
+void keymap_delete(KeyMap *map, int key) {
+    unsigned int pos = keymap_home(map, key);
+    while (map->keys[pos] && map->keys[pos] != key) pos = (pos + 1) & map->mask;
+    if (!map->keys[pos]) return;
+
+    unsigned int hole = pos;
+    for (;;) {
+        pos = (pos + 1) & map->mask;
+        if (!map->keys[pos]) break;
+        unsigned int home = keymap_home(map, map->keys[pos]);
+        if (((pos - home) & map->mask) >= ((pos - hole) & map->mask)) {
+            map->keys[hole] = map->keys[pos];
+            map->values[hole] = map->values[pos];
+            hole = pos;
+        }
+    }
+    map->keys[hole] = 0;
+}
+
+// ---- Recency lists over a preallocated node pool ----
+
+#define MAX_LISTS 4
+
+typedef struct {
+    int id;
+    int prev;   // towards the head (MRU), -1 = none
+    int next;
+    int list;
+} Node;
+
+typedef struct {
+    int head, tail, size;
+} List;
+
+typedef struct {
+    Node *nodes;
+    int free;          // chain through next
+    KeyMap map;        // id -> node
+    List lists[MAX_LISTS];
+} Lists;
+
+static int lists_init(Lists *l, int nodes) {
+    memset(l, 0, sizeof(*l));
+    l->nodes = malloc((size_t)nodes * sizeof(Node));
+    if (!l->nodes || keymap_init(&l->map, nodes) == -1) {
+        free(l->nodes);
+        return -1;
+    }
+    for (int i = 0; i < nodes; i++) l->nodes[i].next = i + 1 < nodes ? i + 1 : -1;
+    l->free = 0;
+    for (int i = 0; i < MAX_LISTS; i++) l->lists[i].head = l->lists[i].tail = -1;
+    return 0;
+}
+
+static void lists_free(Lists *l) {
+    free(l->nodes);
+    keymap_free(&l->map);
+}
+
+static int lists_find(Lists *l, int id) {
+    return keymap_get(&l->map, id);
+}
+
+static void lists_unlink(Lists *l, int n) {
+    Node *node = &l->nodes[n];
+    List *list = &l->lists[node->list];
+    if (node->prev != -1) l->nodes[node->prev].next = node->next;
+    else list->head = node->next;
+    if (node->next != -1) l->nodes[node->next].prev = node->prev;
+    else list->tail = node->prev;
+    list->size--;
+}
+
+static void lists_push(Lists *l, int n, int to) {
+    Node *node = &l->nodes[n];
+    List *list = &l->lists[to];
+    node->list = to;
+    node->prev = -1;
+    node->next = list->head;
+    if (list->head != -1) l->nodes[list->head].prev = n;
+    list->head = n;
+    if (list->tail == -1) list->tail = n;
+    list->size++;
+}
+
+// Moves a node to the head of a list (possibly the one it is on)
+static void lists_move(Lists *l, int n, int to) {
+    lists_unlink(l, n);
+    lists_push(l, n, to);
+}
+
+static int lists_add(Lists *l, int id, int to) {
+    int n = l->free;
+    if (n == -1) return -1;
+    l->free = l->nodes[n].next;
+    l->nodes[n].id = id;
+    keymap_put(&l->map, id, n);
+    lists_push(l, n, to);
+    return n;
+}
+
+// Unlinks and frees a node; returns its id
+static int lists_drop(Lists *l, int n) {
+    int id = l->nodes[n].id;
+    lists_unlink(l, n);
+    keymap_delete(&l->map, id);
+    l->nodes[n].next = l->free;
+    l->free = n;
+    return id;
+}
+
+static int lists_size(Lists *l, int list) {
+    return l->lists[list].size;
+}
+
+static int lists_tail(Lists *l, int list) {
+    return l->lists[list].tail;
+}
+
+static int lists_copy(Lists *l, int list, int *out, int count, int max) {
+    for (int n = l->lists[list].head; n != -1 && count < max; n = l->nodes[n].next) out[count++] = l->nodes[n].id;
+    return count;
+}
+
+static void lists_remove(Lists *l, int id) {
+    int n = lists_find(l, id);
+    if (n != -1) lists_drop(l, n);
+}
+
+// ---- LRU ----
+
+typedef struct {
+    Lists l;
+    int capacity;
+} Lru;
+
+static void *lru_create(int capacity) {
+    Lru *c = calloc(1, sizeof(Lru));
+    if (!c) return NULL;
+    c->capacity = capacity < 1 ? 1 : capacity;
+    if (lists_init(&c->l, c->capacity) == -1) {
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void lru_destroy(void *state) {
+    Lru *c = state;
+    lists_free(&c->l);
+    free(c);
+}
+
+static int lru_lookup(void *state, int id) {
+    Lru *c = state;
+    int n = lists_find(&c->l, id);
+    if (n == -1) return 0;
+    lists_move(&c->l, n, 0);
+    return 1;
+}
+
+static int lru_insert(void *state, int id) {
+    Lru *c = state;
+    if (lists_find(&c->l, id) != -1) return -1;
+    int evicted = -1;
+    if (lists_size(&c->l, 0) >= c->capacity) evicted = lists_drop(&c->l, lists_tail(&c->l, 0));
+    lists_add(&c->l, id, 0);
+    return evicted;
+}
+
+static void lru_remove(void *state, int id) {
+    lists_remove(&((Lru *)state)->l, id);
+}
+
+static int lru_keys(void *state, int *out, int max) {
+    return lists_copy(&((Lru *)state)->l, 0, out, 0, max);
+}
+
+// ---- CLOCK: a ring of slots with reference bits; new entries start unreferenced ----
+
+typedef struct {
+    int capacity;
+    int hand;
+    int *ids;              // 0 = empty slot
+    unsigned char *ref;
+    int *free_slots;
+    int free_count;
+    KeyMap map;            // id -> slot
+} Clock;
+
+static void clock_destroy(void *state) {
+    Clock *c = state;
+    free(c->ids);
+    free(c->ref);
+    free(c->free_slots);
+    keymap_free(&c->map);
+    free(c);
+}
+
+static void *clock_create(int capacity) {
+    Clock *c = calloc(1, sizeof(Clock));
+    if (!c) return NULL;
+    c->capacity = capacity < 1 ? 1 : capacity;
+    c->ids = calloc(c->capacity, sizeof(int));
+    c->ref = calloc(c->capacity, 1);
+    c->free_slots = malloc(c->capacity * sizeof(int));
+    if (!c->ids || !c->ref || !c->free_slots || keymap_init(&c->map, c->capacity) == -1) {
+        clock_destroy(c);
+        return NULL;
+    }
+    for (int i = c->capacity - 1; i >= 0; i--) c->free_slots[c->free_count++] = i;
+    return c;
+}
+
+static int clock_lookup(void *state, int id) {
+    Clock *c = state;
+    int slot = keymap_get(&c->map, id);
+    if (slot == -1) return 0;
+    c->ref[slot] = 1;
+    return 1;
+}
+
+static int clock_insert(void *state, int id) {
+    Clock *c = state;
+    if (keymap_get(&c->map, id) != -1) return -1;
+
+    int slot, evicted = -1;
+    if (c->free_count > 0) {
+        slot = c->free_slots[--c->free_count];
+    } else {
+        // Full: every slot is occupied, so the sweep ends within two turns
+        while (c->ref[c->hand]) {
+            c->ref[c->hand] = 0;
+            c->hand = (c->hand + 1) % c->capacity;
+        }
+        slot = c->hand;
+        evicted = c->ids[slot];
+        keymap_delete(&c->map, evicted);
+        c->hand = (c->hand + 1) % c->capacity;
+    }
+    c->ids[slot] = id;
+    c->ref[slot] = 0;
+    keymap_put(&c->map, id, slot);
+    return evicted;
+}
+
+static void clock_remove(void *state, int id) {
+    Clock *c = state;
+    int slot = keymap_get(&c->map, id);
+    if (slot == -1) return;
+    keymap_delete(&c->map, id);
+    c->ids[slot] = 0;
+    c->ref[slot] = 0;
+    c->free_slots[c->free_count++] = slot;
+}
+
+// Referenced entries first, each group in the order the hand will reach them
+static int clock_keys(void *state, int *out, int max) {
+    Clock *c = state;
+    int count = 0;
+    for (int pass = 1; pass >= 0; pass--) {
+        for (int i = 0; i < c->capacity && count < max; i++) {
+            int slot = (c->hand + c->capacity - 1 - i) % c->capacity;
+            if (c->ids[slot] && c->ref[slot] == pass) out[count++] = c->ids[slot];
+        }
+    }
+    return count;
+}
+
+// ---- 2Q (Johnson & Shasha): new ids go through a FIFO (A1in); ids seen again after
+// leaving it (remembered in the ghost list A1out) are promoted to the LRU main list (Am) ----
+
+enum { A1IN, A1OUT, AM };
+
+typedef struct {
+    Lists l;
+    int capacity;
+    int kin;    // A1in target size (25%)
+    int kout;   // ghost ids remembered (50%)
+} TwoQ;
+
+static void *twoq_create(int capacity) {
+    TwoQ *c = calloc(1, sizeof(TwoQ));
+    if (!c) return NULL;
+    c->capacity = capacity < 1 ? 1 : capacity;
+    c->kin = c->capacity / 4 > 0 ? c->capacity / 4 : 1;
+    c->kout = c->capacity / 2 > 0 ? c->capacity / 2 : 1;
+    if (lists_init(&c->l, c->capacity + c->kout + 1) == -1) {
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void twoq_destroy(void *state) {
+    TwoQ *c = state;
+    lists_free(&c->l);
+    free(c);
+}
+
+static int twoq_lookup(void *state, int id) {
+    TwoQ *c = state;
+    int n = lists_find(&c->l, id);
+    if (n == -1 || c->l.nodes[n].list == A1OUT) return 0;
+    if (c->l.nodes[n].list == AM) lists_move(&c->l, n, AM);
+    return 1;
+}
+
+static int twoq_reclaim(TwoQ *c) {
+    Lists *l = &c->l;
+    if (lists_size(l, A1IN) > c->kin || lists_size(l, AM) == 0) {
+        int n = lists_tail(l, A1IN);
+        int id = l->nodes[n].id;
+        lists_move(l, n, A1OUT);
+        if (lists_size(l, A1OUT) > c->kout) lists_drop(l, lists_tail(l, A1OUT));
+        return id;
+    }
+    return lists_drop(l, lists_tail(l, AM));
+}
+
+static int twoq_insert(void *state, int id) {
+    TwoQ *c = state;
+    Lists *l = &c->l;
+    int n = lists_find(l, id);
+    if (n != -1 && l->nodes[n].list != A1OUT) return -1;
+
+    int seen = n != -1;
+    if (seen) lists_drop(l, n);
+
+    int evicted = -1;
+    if (lists_size(l, A1IN) + lists_size(l, AM) >= c->capacity) evicted = twoq_reclaim(c);
+    lists_add(l, id, seen ? AM : A1IN);
+    return evicted;
+}
+
+static void twoq_remove(void *state, int id) {
+    lists_remove(&((TwoQ *)state)->l, id);
+}
+
+static int twoq_keys(void *state, int *out, int max) {
+    TwoQ *c = state;
+    int count = lists_copy(&c->l, AM, out, 0, max);
+    return lists_copy(&c->l, A1IN, out, count, max);
+}
+
+// ---- ARC (Megiddo & Modha): T1 holds ids seen once, T2 ids seen twice or more, B1/B2
+// remember what each evicted; hits on the ghosts move the T1 target size p ----
+
+enum { T1, T2, B1, B2 };
+
+typedef struct {
+    Lists l;
+    int capacity;
+    int p;
+} Arc;
+
+static void *arc_create(int capacity) {
+    Arc *c = calloc(1, sizeof(Arc));
+    if (!c) return NULL;
+    c->capacity = capacity < 1 ? 1 : capacity;
+    if (lists_init(&c->l, 2 * c->capacity + 1) == -1) {
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void arc_destroy(void *state) {
+    Arc *c = state;
+    lists_free(&c->l);
+    free(c);
+}
+
+static int arc_lookup(void *state, int id) {
+    Arc *c = state;
+    int n = lists_find(&c->l, id);
+    if (n == -1 || c->l.nodes[n].list >= B1) return 0;
+    lists_move(&c->l, n, T2);
+    return 1;
+}
+
+// Evicts from T1 or T2 into its ghost list, following p
+static int arc_replace(Arc *c, int in_b2) {
+    Lists *l = &c->l;
+    int t1 = lists_size(l, T1);
+    int n;
+    if (t1 > 0 && (t1 > c->p || (in_b2 && t1 == c->p) || lists_size(l, T2) == 0)) {
+        n = lists_tail(l, T1);
+        lists_move(l, n, B1);
+    } else {
+        n = lists_tail(l, T2);
+        lists_move(l, n, B2);
+    }
+    return l->nodes[n].id;
+}
+
+static int arc_insert(void *state, int id) {
+    Arc *c = state;
+    Lists *l = &c->l;
+    int n = lists_find(l, id);
+    int resident = lists_size(l, T1) + lists_size(l, T2);
+    int b1 = lists_size(l, B1), b2 = lists_size(l, B2);
+    int evicted = -1;
+
+    if (n != -1 && l->nodes[n].list == B1) {
+        int delta = b2 / b1 > 1 ? b2 / b1 : 1;
+        c->p = c->p + delta < c->capacity ? c->p + delta : c->capacity;
+        if (resident >= c->capacity) evicted = arc_replace(c, 0);
+        lists_move(l, n, T2);
+        return evicted;
+    }
+    if (n != -1 && l->nodes[n].list == B2) {
+        int delta = b1 / b2 > 1 ? b1 / b2 : 1;
+        c->p = c->p - delta > 0 ? c->p - delta : 0;
+        if (resident >= c->capacity) evicted = arc_replace(c, 1);
+        lists_move(l, n, T2);
+        return evicted;
+    }
+    if (n != -1) return -1;
+
+    if (lists_size(l, T1) + b1 >= c->capacity) {
+        if (lists_size(l, T1) < c->capacity) {
+            lists_drop(l, lists_tail(l, B1));
+            if (resident >= c->capacity) evicted = arc_replace(c, 0);
+        } else {
+            evicted = lists_drop(l, lists_tail(l, T1));
+        }
+    } else if (resident + b1 + b2 >= c->capacity) {
+        if (resident + b1 + b2 >= 2 * c->capacity) lists_drop(l, lists_tail(l, B2));
+        if (resident >= c->capacity) evicted = arc_replace(c, 0);
+    }
+    lists_add(l, id, T1);
+    return evicted;
+}
+
+static void arc_remove(void *state, int id) {
+    lists_remove(&((Arc *)state)->l, id);
+}
+
+static int arc_keys(void *state, int *out, int max) {
+    Arc *c = state;
+    int count = lists_copy(&c->l, T2, out, 0, max);
+    return lists_copy(&c->l, T1, out, count, max);
+}
+
+// ---- W-TinyLFU (Einziger, Friedman & Manes): a 1% LRU window in front of a segmented
+// LRU (probation 20%, protected 80%). An id leaving the window only replaces the
+// probation victim if a count-min sketch says it was requested more often. The sketch
+// is halved every 10 * capacity accesses so old popularity fades. ----
+
+enum { WINDOW, PROBATION, PROTECTED };
+
+#define SKETCH_ROWS 4
+#define SKETCH_MAX 15
+
+typedef struct {
+    Lists l;
+    int capacity;
+    int window_max;
+    int main_max;
+    int protected_max;
+    unsigned char *sketch;
+    unsigned int width_mask;
+    int additions;
+    int sample;
+} TinyLfu;
+
+static const unsigned int sketch_seeds[SKETCH_ROWS] = { 0x97cb3127u, 0xa5d1c6b3u, 0x85ebca6bu, 0xc2b2ae35u };
+
+static unsigned int sketch_index(const TinyLfu *c, int row, int id) {
+    unsigned int h = ((unsigned int)id * 0x9e3779b1u) ^ ((unsigned int)id >> 16);
+    h *= sketch_seeds[row];
+    h ^= h >> 15;
+    return row * (c->width_mask + 1) + (h & c->width_mask);
+}
+
+static int sketch_frequency(const TinyLfu *c, int id) {
+    int freq = SKETCH_MAX;
+    for (int r = 0; r < SKETCH_ROWS; r++) {
+        int v = c->sketch[sketch_index(c, r, id)];
+        if (v < freq) freq = v;
+    }
+    return freq;
+}
+
+static void sketch_increment(TinyLfu *c, int id) {
+    int added = 0;
+    for (int r = 0; r < SKETCH_ROWS; r++) {
+        unsigned char *v = &c->sketch[sketch_index(c, r, id)];
+        if (*v < SKETCH_MAX) {
+            (*v)++;
+            added = 1;
+        }
+    }
+    if (added && ++c->additions >= c->sample) {
+        size_t size = (size_t)SKETCH_ROWS * (c->width_mask + 1);
+        for (size_t i = 0; i < size; i++) c->sketch[i] >>= 1;
+        c->additions /= 2;
+    }
+}
+
+static void *tinylfu_create(int capacity) {
+    TinyLfu *c = calloc(1, sizeof(TinyLfu));
+    if (!c) return NULL;
+    c->capacity = capacity < 1 ? 1 : capacity;
+    c->window_max = c->capacity / 100 > 0 ? c->capacity / 100 : 1;
+    c->main_max = c->capacity - c->window_max;
+    c->protected_max = c->main_max * 4 / 5;
+    c->sample = 10 * c->capacity;
+
+    unsigned int width = 16;
+    while (width < (unsigned int)c->capacity) width *= 2;
+    c->width_mask = width - 1;
+    c->sketch = calloc((size_t)SKETCH_ROWS * width, 1);
+    if (!c->sketch || lists_init(&c->l, c->capacity + 1) == -1) {
+        free(c->sketch);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void tinylfu_destroy(void *state) {
+    TinyLfu *c = state;
+    lists_free(&c->l);
+    free(c->sketch);
+    free(c);
+}
+
+static int tinylfu_lookup(void *state, int id) {
+    TinyLfu *c = state;
+    Lists *l = &c->l;
+    sketch_increment(c, id);
+    int n = lists_find(l, id);
+    if (n == -1) return 0;
+
+    if (l->nodes[n].list == PROBATION) {
+        lists_move(l, n, PROTECTED);
+        if (lists_size(l, PROTECTED) > c->protected_max) lists_move(l, lists_tail(l, PROTECTED), PROBATION);
+    } else {
+        lists_move(l, n, l->nodes[n].list);
+    }
+    return 1;
+}
+
+static int tinylfu_insert(void *state, int id) {
+    TinyLfu *c = state;
+    Lists *l = &c->l;
+    if (lists_find(l, id) != -1) return -1;
+
+    lists_add(l, id, WINDOW);
+    if (lists_size(l, WINDOW) <= c->window_max) return -1;
+
+    int candidate = lists_tail(l, WINDOW);
+    if (lists_size(l, PROBATION) + lists_size(l, PROTECTED) < c->main_max) {
+        lists_move(l, candidate, PROBATION);
+        return -1;
+    }
+
+    int victim = lists_tail(l, PROBATION);
+    if (victim == -1) victim = lists_tail(l, PROTECTED);
+    if (victim != -1 && sketch_frequency(c, l->nodes[candidate].id) > sketch_frequency(c, l->nodes[victim].id)) {
+        int evicted = lists_drop(l, victim);
+        lists_move(l, candidate, PROBATION);
+        return evicted;
+    }
+    return lists_drop(l, candidate);
+}
+
+static void tinylfu_remove(void *state, int id) {
+    lists_remove(&((TinyLfu *)state)->l, id);
+}
+
+static int tinylfu_keys(void *state, int *out, int max) {
+    TinyLfu *c = state;
+    int count = lists_copy(&c->l, PROTECTED, out, 0, max);
+    count = lists_copy(&c->l, PROBATION, out, count, max);
+    return lists_copy(&c->l, WINDOW, out, count, max);
+}
+
+// ---- Registry ----
+
+static const CachePolicy policies[] = {
+    { "lru", lru_create, lru_destroy, lru_lookup, lru_insert, lru_remove, lru_keys },
+    { "clock", clock_create, clock_destroy, clock_lookup, clock_insert, clock_remove, clock_keys },
+    { "2q", twoq_create, twoq_destroy, twoq_lookup, twoq_insert, twoq_remove, twoq_keys },
+    { "arc", arc_create, arc_destroy, arc_lookup, arc_insert, arc_remove, arc_keys },
+    { "tinylfu", tinylfu_create, tinylfu_destroy, tinylfu_lookup, tinylfu_insert, tinylfu_remove, tinylfu_keys },
+};
+
+const CachePolicy *cache_policy_find(const char *name) {
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(policies[i].name, name) == 0) return &policies[i];
+    }
+    return NULL;
+}
+
+const char *cache_policy_names() {
+    return "lru, clock, 2q, arc, tinylfu";
+}
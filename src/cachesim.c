@@ -0,0 +1,266 @@
+#include "cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Replays an id-access trace (for example one recorded with dserver --cache-trace)
+// against every cache policy and size, and prints the hit ratio of each. With -r it
+// restarts the cache partway through instead, and reports how fast the hit ratio
+// recovers from a cold cache and from one warmed with the snapshot taken at the restart.
+
+#define MAX_SIZES 32
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-p policies] [-s sizes] <trace>...\n", prog);
+    fprintf(stderr, "  -p  comma-separated policies (default: all of %s)\n", cache_policy_names());
+    fprintf(stderr, "  -s  comma-separated cache sizes (default: 10,50,100,250,500)\n");
+    fprintf(stderr, "  -r  restart after this fraction of the trace (for example 0.5)\n");
+    fprintf(stderr, "  -W  accesses per window when measuring recovery (default: 1000)\n");
+    fprintf(stderr, "  A trace holds one positive id per line; \"-\" reads standard input.\n");
+    exit(EXIT_FAILURE);
+}
+
+static int *trace = NULL;
+static long trace_len = 0;
+static long trace_capacity = 0;
+
+static int trace_push(int id) {
+    if (trace_len == trace_capacity) {
+        long capacity = trace_capacity ? trace_capacity * 2 : 65536;
+        int *p = realloc(trace, capacity * sizeof(int));
+        if (!p) return -1;
+        trace = p;
+        trace_capacity = capacity;
+    }
+    trace[trace_len++] = id;
+    return 0;
+}
+
+// Reads every positive integer in the file; anything else is skipped
+static int trace_load(const char *filename) {
+    FILE *fp = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+    if (!fp) return -1;
+
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        char *p = line;
+        while (*p && !isdigit((unsigned char)*p)) p++;
+        long id = strtol(p, NULL, 10);
+        if (id > 0 && id <= 0x7fffffff && trace_push((int)id) == -1) {
+            if (fp != stdin) fclose(fp);
+            return -1;
+        }
+    }
+    if (fp != stdin) fclose(fp);
+    return 0;
+}
+
+static long count_distinct() {
+    KeyMap seen;
+    if (keymap_init(&seen, trace_len) == -1) return -1;
+    long distinct = 0;
+    for (long i = 0; i < trace_len; i++) {
+        if (keymap_get(&seen, trace[i]) == -1) {
+            keymap_put(&seen, trace[i], 1);
+            distinct++;
+        }
+    }
+    keymap_free(&seen);
+    return distinct;
+}
+
+// Hit ratio of one policy at one size, or -1 if the cache could not be created
+static double replay(const CachePolicy *policy, int size) {
+    void *state = policy->create(size);
+    if (!state) return -1;
+
+    long hits = 0;
+    for (long i = 0; i < trace_len; i++) {
+        if (policy->lookup(state, trace[i])) hits++;
+        else policy->insert(state, trace[i]);
+    }
+    policy->destroy(state);
+    return trace_len ? (double)hits / trace_len : 0;
+}
+
+typedef struct {
+    double steady;        // hit ratio after the restart point without a restart
+    double cold_first;    // hit ratio of the first window after a cold restart
+    double warm_first;
+    long cold_recovery;   // accesses before a window reaches 95% of steady, -1 = never
+    long warm_recovery;
+} Recovery;
+
+// Replays [from, to) in windows; returns the accesses before the first window whose
+// hit ratio reaches target, or -1
+static long replay_windows(const CachePolicy *policy, void *state, long from, long to, long window,
+                           double target, double *first) {
+    long recovered = -1;
+    *first = -1;
+    for (long start = from; start < to; start += window) {
+        long end = start + window < to ? start + window : to;
+        long hits = 0;
+        for (long i = start; i < end; i++) {
+            if (policy->lookup(state, trace[i])) hits++;
+            else policy->insert(state, trace[i]);
+        }
+        double ratio = (double)hits / (end - start);
+        if (*first < 0) *first = ratio;
+        if (recovered == -1 && ratio >= target) recovered = start - from;
+    }
+    return recovered;
+}
+
+static int replay_restart(const CachePolicy *policy, int size, long split, long window, Recovery *r) {
+    int *snapshot = malloc(size * sizeof(int));
+    void *state = policy->create(size);
+    if (!snapshot || !state) {
+        free(snapshot);
+        if (state) policy->destroy(state);
+        return -1;
+    }
+
+    // The server's life before the restart, and what it would have done without one
+    for (long i = 0; i < split; i++) {
+        if (!policy->lookup(state, trace[i])) policy->insert(state, trace[i]);
+    }
+    int count = policy->keys(state, snapshot, size);
+    long hits = 0;
+    for (long i = split; i < trace_len; i++) {
+        if (policy->lookup(state, trace[i])) hits++;
+        else policy->insert(state, trace[i]);
+    }
+    policy->destroy(state);
+    r->steady = (double)hits / (trace_len - split);
+    double target = r->steady * 0.95;
+
+    state = policy->create(size);
+    if (!state) {
+        free(snapshot);
+        return -1;
+    }
+    r->cold_recovery = replay_windows(policy, state, split, trace_len, window, target, &r->cold_first);
+    policy->destroy(state);
+
+    // Warmed the way dserver does it: least valuable first
+    state = policy->create(size);
+    if (!state) {
+        free(snapshot);
+        return -1;
+    }
+    for (int i = count - 1; i >= 0; i--) policy->insert(state, snapshot[i]);
+    r->warm_recovery = replay_windows(policy, state, split, trace_len, window, target, &r->warm_first);
+    policy->destroy(state);
+    free(snapshot);
+    return 0;
+}
+
+static void print_recovery(long accesses) {
+    if (accesses < 0) printf(" %9s", "never");
+    else printf(" %9ld", accesses);
+}
+
+int main(int argc, char *argv[]) {
+    char policy_list[256] = "lru,clock,2q,arc,tinylfu";
+    char size_list[256] = "10,50,100,250,500";
+    double restart = 0;
+    long window = 1000;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            snprintf(policy_list, sizeof(policy_list), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            snprintf(size_list, sizeof(size_list), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            restart = atof(argv[++i]);
+            if (restart <= 0 || restart >= 1) usage(argv[0]);
+        } else if (strcmp(argv[i], "-W") == 0 && i + 1 < argc) {
+            window = atol(argv[++i]);
+            if (window < 1) usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (i == argc) usage(argv[0]);
+
+    const CachePolicy *selected[16];
+    int policy_count = 0;
+    for (char *name = strtok(policy_list, ","); name; name = strtok(NULL, ",")) {
+        const CachePolicy *policy = cache_policy_find(name);
+        if (!policy) {
+            fprintf(stderr, "Error: Unknown cache policy %s (%s)\n", name, cache_policy_names());
+            return EXIT_FAILURE;
+        }
+        if (policy_count < 16) selected[policy_count++] = policy;
+    }
+
+    int sizes[MAX_SIZES];
+    int size_count = 0;
+    for (char *token = strtok(size_list, ","); token && size_count < MAX_SIZES; token = strtok(NULL, ",")) {
+        int size = atoi(token);
+        if (size < 1) {
+            fprintf(stderr, "Error: Invalid cache size %s\n", token);
+            return EXIT_FAILURE;
+        }
+        sizes[size_count++] = size;
+    }
+
+    for (; i < argc; i++) {
+        if (trace_load(argv[i]) == -1) {
+            perror(argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (trace_len == 0) {
+        fprintf(stderr, "Error: The trace is empty\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("Trace: %ld accesses, %ld distinct ids\n\n", trace_len, count_distinct());
+
+    if (restart > 0) {
+        long split = (long)(trace_len * restart);
+        printf("Restart after %ld accesses. Recovery: accesses before a %ld-access window reaches\n"
+               "95%% of the hit ratio the cache had without the restart.\n\n", split, window);
+        printf("%-10s %6s %9s %9s %9s %9s %9s\n", "policy", "size", "steady", "cold_1st", "warm_1st",
+               "cold_rec", "warm_rec");
+        for (int p = 0; p < policy_count; p++) {
+            for (int s = 0; s < size_count; s++) {
+                Recovery r;
+                if (split == 0 || split == trace_len || replay_restart(selected[p], sizes[s], split, window, &r) == -1) {
+                    fprintf(stderr, "Error: Cannot replay %s at size %d\n", selected[p]->name, sizes[s]);
+                    return EXIT_FAILURE;
+                }
+                printf("%-10s %6d %8.2f%% %8.2f%% %8.2f%%", selected[p]->name, sizes[s], r.steady * 100,
+                       r.cold_first * 100, r.warm_first * 100);
+                print_recovery(r.cold_recovery);
+                print_recovery(r.warm_recovery);
+                printf("\n");
+            }
+        }
+        free(trace);
+        return EXIT_SUCCESS;
+    }
+    printf("%-10s", "hit ratio");
+    for (int s = 0; s < size_count; s++) {
+        char header[32];
+        snprintf(header, sizeof(header), "size=%d", sizes[s]);
+        printf(" %10s", header);
+    }
+    printf("\n");
+
+    for (int p = 0; p < policy_count; p++) {
+        printf("%-10s", selected[p]->name);
+        for (int s = 0; s < size_count; s++) {
+            double ratio = replay(selected[p], sizes[s]);
+            if (ratio < 0) printf(" %10s", "-");
+            else printf(" %9.2f%%", ratio * 100);
+        }
+        printf("\n");
+    }
+
+    free(trace);
+    return EXIT_SUCCESS;
+}
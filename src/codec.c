@@ -0,0 +1,228 @@
+#include "common.h"
+#include "codec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CODEC_X86 1
+#endif
+
+// Encoded block: width, exception count, 16 * width bytes of packed words, then one
+// (index, varint of the bits above the width) pair per exception. Lane l holds values
+// l, l + 4, l + 8, ... packed one after the other; word w of lane l is 32-bit word
+// 4 * w + l, so the words of the four lanes form one vector.
+
+#define ROWS (CODEC_BLOCK / 4)
+
+static int bits_of(unsigned int value) {
+    return value ? 32 - __builtin_clz(value) : 0;
+}
+
+static int varint_put(unsigned char *out, unsigned int value) {
+    int n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+static unsigned int varint_get(const unsigned char **p) {
+    unsigned int value = 0;
+    int shift = 0;
+    while (**p & 0x80) {
+        value |= (unsigned int)(*(*p)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    return value | (unsigned int)*(*p)++ << shift;
+}
+
+static unsigned int width_mask(int width) {
+    return width == 32 ? 0xffffffffu : (1u << width) - 1;
+}
+
+// The mirror image of unpack_sse2, one row of four lanes at a time
+static void pack(const unsigned int *values, int width, unsigned char *out) {
+    unsigned int words[4 * 32] = { 0 };
+    unsigned int mask = width_mask(width);
+    unsigned int *word = words;
+    int used = 0;
+    for (int row = 0; row < ROWS && width > 0; row++) {
+        for (int lane = 0; lane < 4; lane++) {
+            unsigned int value = values[4 * row + lane] & mask;
+            word[lane] |= value << used;
+            if (used + width > 32) word[4 + lane] |= value >> (32 - used);
+        }
+        used += width;
+        if (used >= 32) {
+            word += 4;
+            used -= 32;
+        }
+    }
+    memcpy(out, words, (size_t)16 * width);
+}
+
+// Encodes CODEC_BLOCK values at the width that makes the block smallest; returns its
+// length. The size at every width follows from how many values need each number of bits:
+// a value of w bits costs an index byte and ceil((w - width) / 7) varint bytes above width.
+size_t codec_encode(const unsigned int *values, unsigned char *out) {
+    int needing[33] = { 0 };
+    int widest = 0;
+    for (int i = 0; i < CODEC_BLOCK; i++) {
+        int bits = bits_of(values[i]);
+        needing[bits]++;
+        if (bits > widest) widest = bits;
+    }
+
+    int best = widest;
+    size_t best_size = (size_t)16 * widest;
+    for (int width = 0; width < widest; width++) {
+        size_t size = (size_t)16 * width;
+        for (int w = width + 1; w <= widest; w++) size += (size_t)needing[w] * (1 + (w - width + 6) / 7);
+        if (size < best_size) {
+            best = width;
+            best_size = size;
+        }
+    }
+
+    int exceptions = 0;
+    size_t length = 2 + (size_t)16 * best;
+    pack(values, best, out + 2);
+    for (int i = 0; i < CODEC_BLOCK && best < widest; i++) {
+        if (bits_of(values[i]) <= best) continue;
+        out[length++] = (unsigned char)i;
+        length += varint_put(out + length, values[i] >> best);
+        exceptions++;
+    }
+    out[0] = (unsigned char)best;
+    out[1] = (unsigned char)exceptions;
+    return length;
+}
+
+static void unpack_scalar(const unsigned char *in, int width, unsigned int *out) {
+    unsigned int mask = width_mask(width);
+    if (width == 0) {
+        memset(out, 0, CODEC_BLOCK * sizeof(unsigned int));
+        return;
+    }
+    unsigned int words[4 * 32];
+    memcpy(words, in, (size_t)16 * width);
+    const unsigned int *word = words;
+    int used = 0;
+    for (int row = 0; row < ROWS; row++) {
+        for (int lane = 0; lane < 4; lane++) {
+            unsigned int value = word[lane] >> used;
+            if (used + width > 32) value |= word[4 + lane] << (32 - used);
+            out[4 * row + lane] = value & mask;
+        }
+        used += width;
+        if (used >= 32) {
+            word += 4;
+            used -= 32;
+        }
+    }
+}
+
+#ifdef CODEC_X86
+// One vector holds the next word of every lane; each row shifts four values out of it
+static void unpack_sse2(const unsigned char *in, int width, unsigned int *out) {
+    if (width == 0) {
+        memset(out, 0, CODEC_BLOCK * sizeof(unsigned int));
+        return;
+    }
+    const __m128i mask = _mm_set1_epi32((int)width_mask(width));
+    const __m128i *src = (const __m128i *)in;
+    __m128i word = _mm_loadu_si128(src++);
+    int used = 0;
+    for (int row = 0; row < ROWS; row++) {
+        __m128i value = _mm_srl_epi32(word, _mm_cvtsi32_si128(used));
+        used += width;
+        if (used > 32) {
+            word = _mm_loadu_si128(src++);
+            used -= 32;
+            value = _mm_or_si128(value, _mm_sll_epi32(word, _mm_cvtsi32_si128(width - used)));
+        } else if (used == 32 && row + 1 < ROWS) {
+            word = _mm_loadu_si128(src++);
+            used = 0;
+        }
+        _mm_storeu_si128((__m128i *)(out + 4 * row), _mm_and_si128(value, mask));
+    }
+}
+
+static void prefix_sum_sse2(unsigned int *values, int count, unsigned int base) {
+    __m128i carry = _mm_set1_epi32((int)base);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, carry);
+        _mm_storeu_si128((__m128i *)(values + i), v);
+        carry = _mm_shuffle_epi32(v, 0xff);
+    }
+    base = (unsigned int)_mm_cvtsi128_si32(carry);
+    for (; i < count; i++) values[i] = base += values[i];
+}
+#endif
+
+CodecImpl codec_best_impl() {
+#ifdef CODEC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) return CODEC_SSE2;
+#endif
+    return CODEC_SCALAR;
+}
+
+const char *codec_impl_name(CodecImpl impl) {
+    return impl == CODEC_SSE2 ? "sse2" : "scalar";
+}
+
+// Decodes one block into CODEC_BLOCK values; returns the bytes it took
+size_t codec_decode_with(CodecImpl impl, const unsigned char *in, unsigned int *out) {
+    int width = in[0], exceptions = in[1];
+    const unsigned char *p = in + 2;
+#ifdef CODEC_X86
+    if (impl == CODEC_SSE2) unpack_sse2(p, width, out);
+    else unpack_scalar(p, width, out);
+#else
+    (void)impl;
+    unpack_scalar(p, width, out);
+#endif
+    p += (size_t)16 * width;
+    for (int i = 0; i < exceptions; i++) {
+        int index = *p++;
+        out[index] |= varint_get(&p) << width;
+    }
+    return (size_t)(p - in);
+}
+
+// Turns gaps into running totals starting from base
+void codec_prefix_sum_with(CodecImpl impl, unsigned int *values, int count, unsigned int base) {
+#ifdef CODEC_X86
+    if (impl == CODEC_SSE2) {
+        prefix_sum_sse2(values, count, base);
+        return;
+    }
+#endif
+    (void)impl;
+    for (int i = 0; i < count; i++) values[i] = base += values[i];
+}
+
+// Resolved on first use; threads racing here all store the same value
+static CodecImpl best_impl() {
+    static int best = -1;
+    int impl = __atomic_load_n(&best, __ATOMIC_RELAXED);
+    if (impl == -1) {
+        impl = codec_best_impl();
+        __atomic_store_n(&best, impl, __ATOMIC_RELAXED);
+    }
+    return (CodecImpl)impl;
+}
+
+size_t codec_decode(const unsigned char *in, unsigned int *out) {
+    return codec_decode_with(best_impl(), in, out);
+}
+
+void codec_prefix_sum(unsigned int *values, int count, unsigned int base) {
+    codec_prefix_sum_with(best_impl(), values, count, base);
+}
@@ -1,3 +1,102 @@
 #include "common.h"
 
-// Empty implementation since we only need the header
\ No newline at end of file
+// CRC-32 (IEEE, reflected); chaining calls checksums the concatenated data
+unsigned int crc32_update(unsigned int crc, const void *data, size_t len) {
+    static unsigned int table[256];
+    static int table_ready = 0;
+
+    if (!table_ready) {
+        for (unsigned int i = 0; i < 256; i++) {
+            unsigned int c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        table_ready = 1;
+    }
+
+    const unsigned char *p = data;
+    crc = ~crc;
+    while (len--) crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// XXH64, streamed: four lanes of 8-byte words per 32-byte stripe, then the tail
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+static unsigned long long rotl64(unsigned long long x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static unsigned long long read64(const unsigned char *p) {
+    unsigned long long v;
+    memcpy(&v, p, 8);
+    return v;   // little-endian hosts only, like the index file format
+}
+
+static unsigned long long xxh64_round(unsigned long long acc, unsigned long long input) {
+    return rotl64(acc + input * XXH_P2, 31) * XXH_P1;
+}
+
+void xxh64_init(Xxh64 *s, unsigned long long seed) {
+    memset(s, 0, sizeof(*s));
+    s->seed = seed;
+    s->v[0] = seed + XXH_P1 + XXH_P2;
+    s->v[1] = seed + XXH_P2;
+    s->v[2] = seed;
+    s->v[3] = seed - XXH_P1;
+}
+
+void xxh64_update(Xxh64 *s, const void *data, size_t len) {
+    const unsigned char *p = data;
+    s->total += len;
+    if (s->buffered + len < 32) {
+        memcpy(s->buffer + s->buffered, p, len);
+        s->buffered += len;
+        return;
+    }
+    if (s->buffered) {
+        size_t fill = 32 - s->buffered;
+        memcpy(s->buffer + s->buffered, p, fill);
+        for (int i = 0; i < 4; i++) s->v[i] = xxh64_round(s->v[i], read64(s->buffer + 8 * i));
+        p += fill;
+        len -= fill;
+        s->buffered = 0;
+    }
+    for (; len >= 32; p += 32, len -= 32) {
+        for (int i = 0; i < 4; i++) s->v[i] = xxh64_round(s->v[i], read64(p + 8 * i));
+    }
+    memcpy(s->buffer, p, len);
+    s->buffered = len;
+}
+
+unsigned long long xxh64_digest(const Xxh64 *s) {
+    unsigned long long h;
+    if (s->total >= 32) {
+        h = rotl64(s->v[0], 1) + rotl64(s->v[1], 7) + rotl64(s->v[2], 12) + rotl64(s->v[3], 18);
+        for (int i = 0; i < 4; i++) h = (h ^ xxh64_round(0, s->v[i])) * XXH_P1 + XXH_P4;
+    } else {
+        h = s->seed + XXH_P5;
+    }
+    h += s->total;
+
+    const unsigned char *p = s->buffer, *end = s->buffer + s->buffered;
+    for (; p + 8 <= end; p += 8) h = rotl64(h ^ xxh64_round(0, read64(p)), 27) * XXH_P1 + XXH_P4;
+    if (p + 4 <= end) {
+        unsigned int w;
+        memcpy(&w, p, 4);
+        h = rotl64(h ^ (unsigned long long)w * XXH_P1, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; p++) h = rotl64(h ^ *p * XXH_P5, 11) * XXH_P1;
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
@@ -1,5 +1,14 @@
 #include "common.h"
 #include "client.h"
+#include "protocol.h"
+#include "ring.h"
+#include <poll.h>
+
+#define BATCH_WINDOW 64       // requests a session keeps in flight
+#define MAX_LINE_ARGS 8
+
+static const char INVALID_COMMAND[] = "Error: Invalid command";
+static ShmRing *ring = NULL;    // with --shm, large payloads arrive here
 
 void usage(const char *prog) {
     fprintf(stderr, "Usage:\n");
@@ -7,17 +16,380 @@ void usage(const char *prog) {
     fprintf(stderr, "  %s -c \"key\"\n", prog);
     fprintf(stderr, "  %s -d \"key\"\n", prog);
     fprintf(stderr, "  %s -l \"key\" \"keyword\"\n", prog);
-    fprintf(stderr, "  %s -s \"keyword\" [nr_processes]\n", prog);
+    fprintf(stderr, "  %s -s \"keyword\" [nr_processes] [--top K] [--counts]   (file edits are seen after the server's --watch sweep)\n", prog);
+    fprintf(stderr, "  %s -b \"directory|manifest\" [year]\n", prog);
+    fprintf(stderr, "  %s -S\n", prog);
     fprintf(stderr, "  %s -f\n", prog);
+    fprintf(stderr, "  %s --batch < commands   (one command per line, e.g. -c 1)\n", prog);
+    fprintf(stderr, "  %s --shm <command>      (large responses through shared memory)\n", prog);
     exit(EXIT_FAILURE);
 }
 
+// Fills msg from a command and its arguments (argv[0] is the option);
+// NULL on success, otherwise the error to report
+static const char *parse_command(int argc, char *argv[], Message *msg) {
+    if (strcmp(argv[0], "-a") == 0 && argc == 5) {
+        msg->command = CMD_ADD;
+        if (snprintf(msg->args, sizeof(msg->args), "%s|%s|%s|%s",
+                argv[1], argv[2], argv[3], argv[4]) >= sizeof(msg->args)) {
+            return "Error: Arguments too long";
+        }
+    } else if (strcmp(argv[0], "-c") == 0 && argc == 2) {
+        msg->command = CMD_QUERY;
+        if (snprintf(msg->args, sizeof(msg->args), "%s", argv[1]) >= sizeof(msg->args)) {
+            return "Error: Key too long";
+        }
+    } else if (strcmp(argv[0], "-d") == 0 && argc == 2) {
+        msg->command = CMD_REMOVE;
+        if (snprintf(msg->args, sizeof(msg->args), "%s", argv[1]) >= sizeof(msg->args)) {
+            return "Error: Key too long";
+        }
+    } else if (strcmp(argv[0], "-l") == 0 && argc == 3) {
+        msg->command = CMD_LINE_COUNT;
+        if (snprintf(msg->args, sizeof(msg->args), "%s|%s", argv[1], argv[2]) >= sizeof(msg->args)) {
+            return "Error: Arguments too long";
+        }
+    } else if (strcmp(argv[0], "-s") == 0 && argc >= 2 && argc <= 6) {
+        // -s keyword [nr_processes] [--top K] [--counts]
+        const char *nproc = "0";
+        int top = 0, counts = 0;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--top") == 0) {
+                top = i + 1 < argc ? atoi(argv[++i]) : 0;
+                if (top <= 0) return "Error: --top needs a positive number";
+            } else if (strcmp(argv[i], "--counts") == 0) {
+                counts = 1;
+            } else if (i == 2) {
+                nproc = argv[i];
+            } else {
+                return INVALID_COMMAND;
+            }
+        }
+        // '|' separates the fields, so inside one it would turn the rest into the others
+        if (strchr(argv[1], '|') || strchr(nproc, '|')) return "Error: Search arguments cannot contain '|'";
+        msg->command = CMD_SEARCH;
+        if (snprintf(msg->args, sizeof(msg->args), counts ? "%s|%s|%d|1" : top ? "%s|%s|%d" : "%s|%s",
+                argv[1], nproc, top) >= sizeof(msg->args)) {
+            return "Error: Arguments too long";
+        }
+    } else if (strcmp(argv[0], "-b") == 0 && (argc == 2 || argc == 3)) {
+        msg->command = CMD_BULK_ADD;
+        if (snprintf(msg->args, sizeof(msg->args), argc == 3 ? "%s|%s" : "%s",
+                argv[1], argc == 3 ? argv[2] : "") >= sizeof(msg->args)) {
+            return "Error: Arguments too long";
+        }
+    } else if (strcmp(argv[0], "-S") == 0 && argc == 1) {
+        msg->command = CMD_STATS;
+    } else if (strcmp(argv[0], "-f") == 0 && argc == 1) {
+        msg->command = CMD_SHUTDOWN;
+    } else {
+        return INVALID_COMMAND;
+    }
+    return NULL;
+}
+
+static void print_output(unsigned int id, const char *data, size_t len) {
+    (void)id;
+    fwrite(data, 1, len, stdout);
+}
+
+// Hands the payload announced by a RING frame to out, straight from shared memory;
+// -1 if the frame is malformed or the bytes are not in the ring
+static int ring_deliver(const FrameHeader *frame, const char *payload,
+                        void (*out)(unsigned int, const char *, size_t), uint64_t *received) {
+    uint32_t len;
+    if (!ring || frame->length != sizeof(len)) return -1;
+    memcpy(&len, payload, sizeof(len));
+    *received += len;
+    while (len > 0) {
+        const char *data;
+        size_t n = ring_span(ring, len, &data);
+        if (n == 0) return -1;
+        out(frame->request_id, data, n);
+        ring_consume(ring, n);
+        len -= n;
+    }
+    return 0;
+}
+
+// Reads one response: a header, data frames printed as they arrive, then the end frame
+static int read_response(int fd) {
+    char payload[FRAME_PAYLOAD_MAX];
+    FrameHeader frame;
+    ResponseHeader header;
+    uint64_t received = 0;
+
+    if (frame_read(fd, &frame, &header, sizeof(header)) == -1 || frame.type != FRAME_HEADER) {
+        fprintf(stderr, "Error: Empty response from server\n");
+        return EXIT_FAILURE;
+    }
+    while (frame_read(fd, &frame, payload, sizeof(payload)) == 0) {
+        if (frame.type == FRAME_DATA) {
+            fwrite(payload, 1, frame.length, stdout);
+            received += frame.length;
+        } else if (frame.type != FRAME_RING || ring_deliver(&frame, payload, print_output, &received) == -1) {
+            break;
+        }
+    }
+    if (frame.type == FRAME_END && frame.length == sizeof(uint64_t) &&
+        memcmp(payload, &received, sizeof(received)) == 0) {
+        printf("\n");
+        return header.status == STATUS_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    fprintf(stderr, "\nError: Truncated response from server\n");
+    return EXIT_FAILURE;
+}
+
+// ---------- BATCH SESSIONS ----------
+// Commands are read from stdin and pipelined over one server FIFO and one reply FIFO
+// that the server keeps open. Each request carries its line number as request id;
+// replies may arrive out of order and interleaved, and are printed in input order:
+// the oldest unanswered request prints as it streams, later ones are held until then.
+
+enum { SLOT_FREE, SLOT_SENT, SLOT_DONE };
+
+typedef struct {
+    int state;
+    int failed;
+    uint64_t received;
+    char *held;           // output waiting for earlier responses
+    size_t held_length;
+    size_t held_capacity;
+} Pending;
+
+static Pending window[BATCH_WINDOW];
+static unsigned int next_print = 1;   // oldest request not printed yet
+static int batch_failures = 0;
+
+static void pending_output(unsigned int id, const char *data, size_t len) {
+    Pending *p = &window[id % BATCH_WINDOW];
+    if (id == next_print) {
+        fwrite(data, 1, len, stdout);
+        return;
+    }
+    if (p->held_length + len > p->held_capacity) {
+        size_t capacity = p->held_capacity ? p->held_capacity : 256;
+        while (capacity < p->held_length + len) capacity *= 2;
+        char *held = realloc(p->held, capacity);
+        if (!held) {
+            p->failed = 1;
+            return;
+        }
+        p->held = held;
+        p->held_capacity = capacity;
+    }
+    memcpy(p->held + p->held_length, data, len);
+    p->held_length += len;
+}
+
+// Prints every finished response at the head of the window
+static void flush_ready() {
+    Pending *p = &window[next_print % BATCH_WINDOW];
+    while (p->state == SLOT_DONE) {
+        fwrite(p->held, 1, p->held_length, stdout);
+        printf("\n");
+        batch_failures += p->failed;
+        free(p->held);
+        memset(p, 0, sizeof(*p));
+
+        p = &window[++next_print % BATCH_WINDOW];
+        if (p->state == SLOT_SENT && p->held_length > 0) {
+            fwrite(p->held, 1, p->held_length, stdout);
+            p->held_length = 0;
+        }
+    }
+}
+
+static void finish_local(unsigned int id, const char *error) {
+    Pending *p = &window[id % BATCH_WINDOW];
+    p->state = SLOT_SENT;
+    pending_output(id, error, strlen(error));
+    p->state = SLOT_DONE;
+    p->failed = 1;
+    flush_ready();
+}
+
+// Reads one frame and files it under its request; -1 if the channel is broken
+static int batch_read_frame(int fd) {
+    char payload[FRAME_PAYLOAD_MAX];
+    FrameHeader frame;
+    if (frame_read(fd, &frame, payload, sizeof(payload)) == -1) return -1;
+
+    Pending *p = &window[frame.request_id % BATCH_WINDOW];
+    if (frame.request_id - next_print >= BATCH_WINDOW || p->state != SLOT_SENT) return 0;
+
+    if (frame.type == FRAME_HEADER && frame.length == sizeof(ResponseHeader)) {
+        p->failed |= ((ResponseHeader *)payload)->status != STATUS_OK;
+    } else if (frame.type == FRAME_DATA) {
+        pending_output(frame.request_id, payload, frame.length);
+        p->received += frame.length;
+    } else if (frame.type == FRAME_RING) {
+        // The ring is consumed in announcement order, so a bad frame leaves it unusable
+        if (ring_deliver(&frame, payload, pending_output, &p->received) == -1) return -1;
+    } else if (frame.type == FRAME_END) {
+        if (frame.length != sizeof(uint64_t) || memcmp(payload, &p->received, sizeof(uint64_t)) != 0) {
+            const char *error = "\nError: Truncated response from server";
+            pending_output(frame.request_id, error, strlen(error));
+            p->failed = 1;
+        }
+        p->state = SLOT_DONE;
+        flush_ready();
+    }
+    return 0;
+}
+
+// Splits a command line into arguments; double quotes group words
+static int split_line(char *line, char *args[], int max) {
+    int n = 0;
+    char *p = line;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+        if (!*p) break;
+        if (n == max) return -1;
+        if (*p == '"') {
+            args[n++] = ++p;
+            while (*p && *p != '"') p++;
+        } else {
+            args[n++] = p;
+            while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p++;
+        }
+        if (*p) *p++ = '\0';
+    }
+    return n;
+}
+
+static int run_batch(const char *client_fifo) {
+    // Opened for writing too, so reads never see end-of-file between two replies
+    int reply_fd = open(client_fifo, O_RDWR);
+    if (reply_fd == -1) {
+        perror("open client FIFO");
+        return EXIT_FAILURE;
+    }
+    int server_fd = open(FIFO_SERVER, O_WRONLY);
+    if (server_fd == -1) {
+        perror("open server FIFO");
+        close(reply_fd);
+        return EXIT_FAILURE;
+    }
+    // A Message is smaller than PIPE_BUF, so a non-blocking write is all or nothing
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+
+    Message msg;
+    memset(&msg, 0, sizeof(msg));
+    char line[1024];
+    unsigned int next_send = 1;
+    int have_msg = 0, eof = 0, broken = 0;
+
+    while (!broken && (!eof || have_msg || next_print < next_send)) {
+        // Take the next command while the window has room
+        if (!have_msg && !eof && next_send - next_print < BATCH_WINDOW) {
+            if (!fgets(line, sizeof(line), stdin)) {
+                eof = 1;
+                continue;
+            }
+            // A line longer than the buffer is still one command: it gets one error reply
+            // and the rest of it is skipped, instead of its tail running as another command
+            size_t len = strlen(line);
+            if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+                int c = getchar();
+                if (c != '\n' && c != EOF) {
+                    while (c != '\n' && c != EOF) c = getchar();
+                    finish_local(next_send++, "Error: Command line too long");
+                    continue;
+                }
+            }
+            char *args[MAX_LINE_ARGS];
+            int n = split_line(line, args, MAX_LINE_ARGS);
+            if (n == 0) continue;
+
+            memset(&msg, 0, sizeof(msg));
+            const char *error = n < 0 ? INVALID_COMMAND : parse_command(n, args, &msg);
+            if (error) {
+                finish_local(next_send++, error);
+                continue;
+            }
+            msg.request_id = next_send;
+            msg.flags = MSG_SESSION | (ring ? MSG_SHM : 0);
+            snprintf(msg.client_fifo, sizeof(msg.client_fifo), "%s", client_fifo);
+            have_msg = 1;
+        }
+
+        if (have_msg) {
+            ssize_t written = write(server_fd, &msg, sizeof(msg));
+            if (written == sizeof(msg)) {
+                window[next_send % BATCH_WINDOW].state = SLOT_SENT;
+                next_send++;
+                have_msg = 0;
+                // Nothing follows a shutdown
+                if (msg.command == CMD_SHUTDOWN) eof = 1;
+                continue;
+            }
+            if (written == -1 && errno != EAGAIN) {
+                perror("write to server FIFO");
+                break;
+            }
+        }
+
+        // The window is full, the input is done or the server FIFO is full: take replies
+        struct pollfd fds[2] = {
+            { reply_fd, POLLIN, 0 },
+            { server_fd, have_msg ? POLLOUT : 0, 0 }
+        };
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        if ((fds[0].revents & POLLIN) && batch_read_frame(reply_fd) == -1) {
+            fprintf(stderr, "Error: Broken response stream\n");
+            broken = 1;
+        } else if (!(fds[0].revents & POLLIN) && (fds[1].revents & (POLLERR | POLLHUP))) {
+            // No reader left on the server FIFO: the server is gone and no reply will come
+            fprintf(stderr, "Error: Server closed the connection\n");
+            broken = 1;
+        }
+    }
+
+    // Lets the server close its end of the session
+    if (msg.command != CMD_SHUTDOWN && !broken) {
+        Message end;
+        memset(&end, 0, sizeof(end));
+        end.command = CMD_SESSION_END;
+        snprintf(end.client_fifo, sizeof(end.client_fifo), "%s", client_fifo);
+        fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) & ~O_NONBLOCK);
+        if (write(server_fd, &end, sizeof(end)) != sizeof(end)) perror("write to server FIFO");
+    }
+
+    close(server_fd);
+    close(reply_fd);
+    return broken || batch_failures || next_print < next_send ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[]) {
-    if (argc < 2) usage(argv[0]);
+    const char *prog = argv[0];
+    if (argc < 2) usage(prog);
 
     Message msg;
     memset(&msg, 0, sizeof(msg));
 
+    int shm = strcmp(argv[1], "--shm") == 0;
+    if (shm) {
+        argv++;
+        argc--;
+        if (argc < 2) usage(prog);
+    }
+
+    int batch = strcmp(argv[1], "--batch") == 0;
+    if (batch && argc != 2) usage(prog);
+
+    // Parse command
+    const char *error = batch ? NULL : parse_command(argc - 1, argv + 1, &msg);
+    if (error == INVALID_COMMAND) usage(prog);
+    if (error) {
+        fprintf(stderr, "%s\n", error);
+        exit(EXIT_FAILURE);
+    }
+
     // Create unique FIFO for responses
     char client_fifo[256];
     if (snprintf(client_fifo, sizeof(client_fifo), "/tmp/docindex_%d_fifo", getpid()) >= sizeof(client_fifo)) {
@@ -26,54 +398,24 @@ int main(int argc, char *argv[]) {
     }
     strncpy(msg.client_fifo, client_fifo, sizeof(msg.client_fifo) - 1);
     msg.client_fifo[sizeof(msg.client_fifo) - 1] = '\0';
-    
+
     if (mkfifo(client_fifo, 0666) == -1 && errno != EEXIST) {
         perror("mkfifo");
         exit(EXIT_FAILURE);
     }
 
-    // Parse command
-    if (strcmp(argv[1], "-a") == 0 && argc == 6) {
-        msg.command = CMD_ADD;
-        if (snprintf(msg.args, sizeof(msg.args), "%s|%s|%s|%s", 
-                argv[2], argv[3], argv[4], argv[5]) >= sizeof(msg.args)) {
-            fprintf(stderr, "Error: Arguments too long\n");
-            unlink(client_fifo);
-            exit(EXIT_FAILURE);
-        }
-    } else if (strcmp(argv[1], "-c") == 0 && argc == 3) {
-        msg.command = CMD_QUERY;
-        if (snprintf(msg.args, sizeof(msg.args), "%s", argv[2]) >= sizeof(msg.args)) {
-            fprintf(stderr, "Error: Key too long\n");
-            unlink(client_fifo);
-            exit(EXIT_FAILURE);
-        }
-    } else if (strcmp(argv[1], "-d") == 0 && argc == 3) {
-        msg.command = CMD_REMOVE;
-        if (snprintf(msg.args, sizeof(msg.args), "%s", argv[2]) >= sizeof(msg.args)) {
-            fprintf(stderr, "Error: Key too long\n");
-            unlink(client_fifo);
-            exit(EXIT_FAILURE);
-        }
-    } else if (strcmp(argv[1], "-l") == 0 && argc == 4) {
-        msg.command = CMD_LINE_COUNT;
-        if (snprintf(msg.args, sizeof(msg.args), "%s|%s", argv[2], argv[3]) >= sizeof(msg.args)) {
-            fprintf(stderr, "Error: Arguments too long\n");
-            unlink(client_fifo);
-            exit(EXIT_FAILURE);
-        }
-    } else if (strcmp(argv[1], "-s") == 0 && (argc == 3 || argc == 4)) {
-        msg.command = CMD_SEARCH;
-        if (snprintf(msg.args, sizeof(msg.args), argc == 4 ? "%s|%s" : "%s", 
-                argv[2], argc == 4 ? argv[3] : "") >= sizeof(msg.args)) {
-            fprintf(stderr, "Error: Arguments too long\n");
-            unlink(client_fifo);
-            exit(EXIT_FAILURE);
-        }
-    } else if (strcmp(argv[1], "-f") == 0 && argc == 2) {
-        msg.command = CMD_SHUTDOWN;
-    } else {
-        usage(argv[0]);
+    char shm_name[300];
+    ring_name(client_fifo, shm_name, sizeof(shm_name));
+    if (shm && !(ring = ring_create(shm_name, RING_SIZE))) {
+        perror("shm ring");   // the FIFO still carries everything
+    }
+    if (ring) msg.flags |= MSG_SHM;
+
+    if (batch) {
+        int status = run_batch(client_fifo);
+        if (ring) ring_destroy(ring, shm_name);
+        unlink(client_fifo);
+        return status;
     }
 
     // Send request
@@ -83,7 +425,7 @@ int main(int argc, char *argv[]) {
         unlink(client_fifo);
         exit(EXIT_FAILURE);
     }
-    
+
     ssize_t bytes_written = write(fd, &msg, sizeof(msg));
     if (bytes_written != sizeof(msg)) {
         perror("write to server FIFO");
@@ -101,18 +443,9 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    char response[RESPONSE_SIZE];
-    ssize_t n = read(fd, response, sizeof(response) - 1);
-    if (n > 0) {
-        response[n] = '\0';
-        printf("%s\n", response);
-    } else if (n == 0) {
-        fprintf(stderr, "Error: Empty response from server\n");
-    } else {
-        perror("read from client FIFO");
-    }
-    
+    int status = read_response(fd);
     close(fd);
+    if (ring) ring_destroy(ring, shm_name);
     unlink(client_fifo);
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
@@ -0,0 +1,50 @@
+#include "common.h"
+#include "index.h"
+
+// Converts between the binary index (data/index.bin) and the pipe-delimited text format
+
+char document_folder[256] = ".";
+int cache_size = 0;
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  %s import <index.txt> <index.bin>\n", prog);
+    fprintf(stderr, "  %s export <index.bin> <index.txt>\n", prog);
+    fprintf(stderr, "  %s verify <index.bin>\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) usage(argv[0]);
+
+    if (strcmp(argv[1], "import") == 0 && argc == 4) {
+        if (!index_import_text(argv[2])) {
+            perror(argv[2]);
+            return EXIT_FAILURE;
+        }
+        if (!index_save(argv[3])) {
+            fprintf(stderr, "Error: could not write %s\n", argv[3]);
+            return EXIT_FAILURE;
+        }
+        printf("Imported %d documents into %s\n", index_get_count(), argv[3]);
+    } else if (strcmp(argv[1], "export") == 0 && argc == 4) {
+        if (index_verify(argv[2]) == -1 || !index_load(argv[2])) {
+            fprintf(stderr, "Error: %s is not a valid index\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        if (!index_export_text(argv[3])) {
+            perror(argv[3]);
+            return EXIT_FAILURE;
+        }
+        printf("Exported %d documents into %s\n", index_get_count(), argv[3]);
+    } else if (strcmp(argv[1], "verify") == 0 && argc == 3) {
+        if (index_verify(argv[2]) == -1 || !index_load(argv[2])) {
+            fprintf(stderr, "%s: corrupted or not an index\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        printf("%s: OK, %d documents, checksum %08x\n", argv[2], index_get_count(), index_fingerprint());
+    } else {
+        usage(argv[0]);
+    }
+    return EXIT_SUCCESS;
+}
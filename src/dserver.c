@@ -1,31 +1,284 @@
+#define _GNU_SOURCE   // pthread_rwlockattr_setkind_np
 #include "common.h"
 #include "server.h"
 #include "index.h"
+#include "postings.h"
+#include "matcher.h"
+#include "wal.h"
+#include "executor.h"
+#include "protocol.h"
+#include "ring.h"
+#include "stats.h"
+#include "cache.h"
+#include "query.h"
+#include "resultcache.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 
-CacheEntry cache[MAX_CACHE];
 int cache_size = 0;
 int next_id = 1;
 char document_folder[256] = {0};
 extern void cache_print_stats();
 extern void cache_export_snapshot(const char *filename);
+extern void cache_get_stats(long *hits, long *misses, int *entries);
+extern int cache_init(const char *policy);
+extern const char *cache_policy_name();
+extern int cache_trace_open(const char *filename);
+extern void cache_trace_close();
+extern int cache_snapshot_ids(const char *filename, int *ids, int max);
+extern int cache_warm(int id);
 static int debug_mode = 1;  // Debug mode flag
 
-void send_response(const char *client_fifo, const char *response) {
-    int fd = open(client_fifo, O_WRONLY);
-    if (fd == -1) {
-        if (debug_mode) perror("Error opening client FIFO");
-        return;
+#define INDEX_FILE "data/index.bin"
+#define INDEX_TEXT_FILE "data/index.txt"   // old format, imported once
+#define POSTINGS_FILE "data/postings.txt"
+#define WAL_FILE "data/index.wal"
+#define WAL_OLD_FILE "data/index.wal.old"  // log being folded in by a checkpoint
+#define CACHE_SNAPSHOT_FILE "data/cache_snapshot.txt"
+#ifndef WAL_CHECKPOINT_BYTES
+#define WAL_CHECKPOINT_BYTES (4L << 20)  // log size that triggers a checkpoint
+#endif
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 64
+#define QUEUE_SIZE 256
+#define MAX_SESSIONS 64
+
+static WalDurability durability = WAL_BATCH;
+static pid_t checkpoint_pid = -1;
+
+// Queries, line counts and searches share the index; add, remove, compaction and
+// checkpoints hold it exclusively. Writers are preferred so a stream of reads cannot starve them.
+static pthread_rwlock_t index_lock;
+
+// Requests read by the main thread and waiting for a worker
+static Message queue[QUEUE_SIZE];
+static double queue_times[QUEUE_SIZE];   // when each request was read, for its latency
+static int queue_head = 0;
+static int queue_count = 0;
+static int queue_active = 0;      // requests being handled
+static int queue_stopping = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+static pthread_t workers[MAX_WORKERS];
+static int worker_count = DEFAULT_WORKERS;
+static int search_threads = 0;    // executor threads for scans; 0 = one per CPU
+
+typedef enum { WARM_OFF, WARM_SYNC, WARM_BACKGROUND } CacheWarm;
+static CacheWarm cache_warm_mode = WARM_SYNC;
+
+static int watch_interval = 5;    // seconds between sweeps for changed files; 0 = off
+static long watch_reindexed = 0;  // documents re-indexed by the sweep (under index_lock)
+static int result_cache_size = 64;   // searches whose results are kept; 0 = off
+
+static int save_index() {
+    return index_save(INDEX_FILE) &&
+           postings_save(POSTINGS_FILE, index_get_count(), index_fingerprint());
+}
+
+// Reply FIFOs of dclient --batch sessions, kept open across requests. Frames are
+// atomic, so workers answering the same session write to the shared fd concurrently;
+// a session is closed once it is ended or broken and no reply is using it.
+typedef struct {
+    char fifo[256];
+    int fd;
+    RingWriter *ring;   // the client's shared-memory ring, if it has one
+    int users;          // replies in progress
+    int closing;        // ended by the client or a write failed
+} Session;
+
+static Session sessions[MAX_SESSIONS];
+static int session_count = 0;
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Closes a session nobody uses any more; the caller holds session_lock
+static void session_release(int i) {
+    if (!sessions[i].closing || sessions[i].users > 0) return;
+    close(sessions[i].fd);
+    ring_writer_close(sessions[i].ring);
+    sessions[i] = sessions[--session_count];
+}
+
+// Opens the reply FIFO of a session without blocking: a batch client opens its FIFO
+// before sending, so ENXIO means it is gone
+static int session_connect(const char *fifo) {
+    int fd = open(fifo, O_WRONLY | O_NONBLOCK);
+    if (fd != -1) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    return fd;
+}
+
+static RingWriter *reply_ring(const Message *msg) {
+    char name[300];
+    if (!(msg->flags & MSG_SHM)) return NULL;
+    ring_name(msg->client_fifo, name, sizeof(name));
+    return ring_writer_open(name);
+}
+
+// Opens the reply channel; *ring is set only for replies that want one (large ones).
+// A session attaches its ring once, a one-shot reply owns the ring it gets.
+static int reply_open(const Message *msg, int want_ring, RingWriter **ring) {
+    *ring = NULL;
+    if (!(msg->flags & MSG_SESSION)) {
+        int fd = open(msg->client_fifo, O_WRONLY);
+        if (fd != -1 && want_ring) *ring = reply_ring(msg);
+        return fd;
     }
-    
-    ssize_t bytes_written = write(fd, response, strlen(response));
-    if (bytes_written == -1 || (size_t)bytes_written != strlen(response)) {
-        if (debug_mode) perror("Error writing to client FIFO");
+
+    pthread_mutex_lock(&session_lock);
+    for (int i = 0; i < session_count; i++) {
+        Session *session = &sessions[i];
+        if (session->closing || strcmp(session->fifo, msg->client_fifo) != 0) continue;
+
+        // A FIFO recreated by a new client with a recycled pid is a different file
+        struct stat a, b;
+        if (stat(msg->client_fifo, &a) == 0 && fstat(session->fd, &b) == 0 &&
+            a.st_ino == b.st_ino && a.st_dev == b.st_dev) {
+            session->users++;
+            if (want_ring) *ring = session->ring;
+            pthread_mutex_unlock(&session_lock);
+            return session->fd;
+        }
+        session->closing = 1;
+        session_release(i);
+        break;
+    }
+
+    int fd = session_connect(msg->client_fifo);
+    if (fd != -1 && session_count < MAX_SESSIONS) {
+        Session *session = &sessions[session_count++];
+        snprintf(session->fifo, sizeof(session->fifo), "%s", msg->client_fifo);
+        session->fd = fd;
+        session->ring = reply_ring(msg);
+        session->users = 1;
+        session->closing = 0;
+        if (want_ring) *ring = session->ring;
+    }
+    pthread_mutex_unlock(&session_lock);
+    return fd;   // a full table just means this reply gets its own fd
+}
+
+static void reply_close(int fd, RingWriter *ring, int failed) {
+    if (fd == -1) return;
+    pthread_mutex_lock(&session_lock);
+    for (int i = 0; i < session_count; i++) {
+        if (sessions[i].fd != fd) continue;
+        sessions[i].users--;
+        if (failed) sessions[i].closing = 1;
+        session_release(i);
+        pthread_mutex_unlock(&session_lock);
+        return;
     }
+    pthread_mutex_unlock(&session_lock);
     close(fd);
+    ring_writer_close(ring);
+}
+
+// The client sends this after its last response arrived
+static void handle_session_end(Message *msg) {
+    pthread_mutex_lock(&session_lock);
+    for (int i = 0; i < session_count; i++) {
+        if (sessions[i].closing || strcmp(sessions[i].fifo, msg->client_fifo) != 0) continue;
+        sessions[i].closing = 1;
+        session_release(i);
+        break;
+    }
+    pthread_mutex_unlock(&session_lock);
+}
+
+static int reply_begin(const Message *msg, ResponseStream *stream, ResponseStatus status, uint64_t total_length) {
+    // Short replies are cheaper as a single DATA frame than through the ring
+    RingWriter *ring;
+    int fd = reply_open(msg, total_length > FRAME_PAYLOAD_MAX, &ring);
+    if (fd == -1 && debug_mode) perror("Error opening client FIFO");
+    int ok = stream_begin(stream, fd, msg->request_id, status, total_length);
+    if (ring && (ok == -1 || stream_use_ring(stream, ring) == -1) && !(msg->flags & MSG_SESSION)) {
+        ring_writer_close(ring);
+    }
+    return ok;
+}
+
+static void reply_end(ResponseStream *stream) {
+    RingWriter *ring = stream->ring;
+    if (stream_end(stream) == -1 && debug_mode) perror("Error writing to client FIFO");
+    reply_close(stream->fd, ring, stream->failed);
+}
+
+// Sends a whole response as one framed stream; "Error: ..." texts carry STATUS_ERROR
+void send_response(const Message *msg, const char *response) {
+    size_t len = strlen(response);
+    ResponseStatus status = strncmp(response, "Error", 5) == 0 ? STATUS_ERROR : STATUS_OK;
+    ResponseStream stream;
+
+    reply_begin(msg, &stream, status, len);
+    stream_write(&stream, response, len);
+    reply_end(&stream);
+}
+
+// Replies to a mutation once its log record is as durable as configured
+static void reply_when_durable(const Message *msg, long lsn, const char *response) {
+    if (lsn == -1 || wal_sync(lsn) == -1) {
+        if (debug_mode) perror("Error committing WAL");
+        send_response(msg, "Error: Change applied but not persisted");
+        return;
+    }
+    send_response(msg, response);
+}
+
+// Folds the log into the base index. The current log is moved aside and a forked
+// child writes the snapshot it inherited, while the parent keeps logging to a fresh file.
+static void start_checkpoint() {
+    if (checkpoint_pid != -1) return;
+
+    // Exclusive, so the child inherits exactly the state the rotated log leads to
+    pthread_rwlock_wrlock(&index_lock);
+    if (wal_rotate(WAL_OLD_FILE) == -1) {
+        pthread_rwlock_unlock(&index_lock);
+        if (debug_mode) perror("Error rotating WAL");
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(save_index() ? 0 : 1);
+    }
+    if (pid == -1) {
+        // No background writer: checkpoint synchronously instead
+        if (save_index()) unlink(WAL_OLD_FILE);
+    } else {
+        checkpoint_pid = pid;
+    }
+    pthread_rwlock_unlock(&index_lock);
+}
+
+static void reap_checkpoint(int wait) {
+    if (checkpoint_pid == -1) return;
+
+    int status;
+    pid_t r = waitpid(checkpoint_pid, &status, wait ? 0 : WNOHANG);
+    if (r == 0) return;
+    checkpoint_pid = -1;
+
+    // If the child failed, checkpoint synchronously so the old log can go
+    int ok = r > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (!ok) {
+        pthread_rwlock_rdlock(&index_lock);
+        ok = save_index();
+        pthread_rwlock_unlock(&index_lock);
+    }
+    if (ok) unlink(WAL_OLD_FILE);
+}
+
+static void replay_add(int id, const char *title, const char *authors, const char *year, const char *path) {
+    index_insert(id, title, authors, year, path);
+}
+
+static void replay_remove(int id) {
+    index_remove(id);
 }
 
 void handle_add(Message *msg) {
@@ -38,46 +291,59 @@ void handle_add(Message *msg) {
                            title, authors, year, path);
     
     if (fields_read != 4) {
-        send_response(msg->client_fifo, "Error: Invalid format for add command");
+        send_response(msg, "Error: Invalid format for add command");
         return;
     }
     
     char fullpath[MAX_PATH + 256] = {0};
     if (snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, path) >= sizeof(fullpath)) {
-        send_response(msg->client_fifo, "Error: Path too long");
+        send_response(msg, "Error: Path too long");
         return;
     }
 
     char response[RESPONSE_SIZE];
     if (access(fullpath, F_OK) == -1) {
         snprintf(response, sizeof(response), "Error: File %s not found", path);
-        send_response(msg->client_fifo, response);
+        send_response(msg, response);
         return;
     }
 
+    // Logged under the same lock, so the log order is the order the changes were applied
+    pthread_rwlock_wrlock(&index_lock);
     int id = index_add(title, authors, year, path);
+    long lsn = -1;
+    if (id > 0) {
+        DocumentMeta *doc = index_lookup(id);
+        lsn = wal_log_add(id, index_str(doc->title), index_str(doc->authors), doc->year, index_str(doc->path));
+        resultcache_record(id, 1);
+    }
+    pthread_rwlock_unlock(&index_lock);
+
     if (id > 0) {
         if (snprintf(response, sizeof(response), "Document %d indexed", id) >= sizeof(response)) {
             strncpy(response, "Document indexed", sizeof(response) - 1);
             response[sizeof(response) - 1] = '\0';
         }
-        index_save("data/index.txt");
+        reply_when_durable(msg, lsn, response);
+        return;
     } else {
         strncpy(response, "Error adding document", sizeof(response) - 1);
         response[sizeof(response) - 1] = '\0';
     }
-    send_response(msg->client_fifo, response);
+    send_response(msg, response);
 }
 
 void handle_query(Message *msg) {
     int id = atoi(msg->args);
-    DocumentMeta *doc = index_query(id);
     char response[RESPONSE_SIZE] = {0};
 
+    pthread_rwlock_rdlock(&index_lock);
+    DocumentMeta meta;
+    DocumentMeta *doc = index_query(id, &meta);
     if (doc) {
         int written = snprintf(response, sizeof(response),
                 "Title: %s\nAuthors: %s\nYear: %s\nPath: %s",
-                doc->title, doc->authors, doc->year, doc->path);
+                index_str(doc->title), index_str(doc->authors), doc->year, index_str(doc->path));
         
         if (written >= sizeof(response)) {
             if (debug_mode) fprintf(stderr, "Warning: Response truncated in query\n");
@@ -85,20 +351,28 @@ void handle_query(Message *msg) {
     } else {
         snprintf(response, sizeof(response), "Document %d not found", id);
     }
-    send_response(msg->client_fifo, response);
+    pthread_rwlock_unlock(&index_lock);
+    send_response(msg, response);
 }
 
 void handle_remove(Message *msg) {
     int id = atoi(msg->args);
     char response[RESPONSE_SIZE];
 
-    if (index_remove(id) == 0) {
+    pthread_rwlock_wrlock(&index_lock);
+    int removed = index_remove(id) == 0;
+    long lsn = removed ? wal_log_remove(id) : -1;
+    if (removed) resultcache_record(id, 0);
+    pthread_rwlock_unlock(&index_lock);
+
+    if (removed) {
         snprintf(response, sizeof(response), "Index entry %d deleted", id);
-        index_save("data/index.txt");
+        reply_when_durable(msg, lsn, response);
+        return;
     } else {
         snprintf(response, sizeof(response), "Document %d not found", id);
     }
-    send_response(msg->client_fifo, response);
+    send_response(msg, response);
 }
 
 void handle_line_count(Message *msg) {
@@ -108,43 +382,61 @@ void handle_line_count(Message *msg) {
     // Parse arguments
     char *args_copy = strdup(msg->args);
     if (!args_copy) {
-        send_response(msg->client_fifo, "Error: Memory allocation failed");
+        send_response(msg, "Error: Memory allocation failed");
         return;
     }
     
-    char *token = strtok(args_copy, "|");
+    char *saveptr;
+    char *token = strtok_r(args_copy, "|", &saveptr);
     if (!token) {
         free(args_copy);
-        send_response(msg->client_fifo, "Error: Invalid arguments format");
+        send_response(msg, "Error: Invalid arguments format");
         return;
     }
     
     id = atoi(token);
-    token = strtok(NULL, "|");
+    token = strtok_r(NULL, "|", &saveptr);
     if (token) {
         strncpy(keyword, token, sizeof(keyword) - 1);
     }
     free(args_copy);
 
-    DocumentMeta *doc = index_query(id);
     char response[RESPONSE_SIZE];
+    char fullpath[MAX_PATH + 256];
+
+    // Only the path is needed; the file is read without holding the index
+    pthread_rwlock_rdlock(&index_lock);
+    DocumentMeta meta;
+    DocumentMeta *doc = index_query(id, &meta);
+    int path_len = doc ? snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, index_str(doc->path)) : 0;
+    pthread_rwlock_unlock(&index_lock);
 
     if (!doc) {
         snprintf(response, sizeof(response), "Document %d not found", id);
-        send_response(msg->client_fifo, response);
+        send_response(msg, response);
+        return;
+    }
+    if (path_len >= (int)sizeof(fullpath)) {
+        send_response(msg, "Error: Path too long");
         return;
     }
 
-    char fullpath[MAX_PATH + 256];
-    if (snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, doc->path) >= sizeof(fullpath)) {
-        send_response(msg->client_fifo, "Error: Path too long");
+    // Fixed strings are counted in-process; regular expressions still go to grep
+    if (matcher_is_fixed(keyword)) {
+        long count;
+        if (matcher_count_file(fullpath, keyword, &count) == 0) {
+            snprintf(response, sizeof(response), "%ld\n", count);
+        } else {
+            snprintf(response, sizeof(response), "0");
+        }
+        send_response(msg, response);
         return;
     }
 
     int pipefd[2];
     if (pipe(pipefd) == -1) {
         snprintf(response, sizeof(response), "Error: Pipe creation failed");
-        send_response(msg->client_fifo, response);
+        send_response(msg, response);
         return;
     }
 
@@ -152,7 +444,7 @@ void handle_line_count(Message *msg) {
     if (pid == -1) {
         close(pipefd[0]);
         close(pipefd[1]);
-        send_response(msg->client_fifo, "Error: Fork failed");
+        send_response(msg, "Error: Fork failed");
         return;
     }
     
@@ -180,261 +472,809 @@ void handle_line_count(Message *msg) {
         } else {
             snprintf(response, sizeof(response), "0");
         }
-        send_response(msg->client_fifo, response);
+        send_response(msg, response);
+    }
+}
+
+static int compare_ids(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Ids of the live documents in ascending order; the caller holds index_lock
+static int *snapshot_ids(int *count) {
+    int *ids = malloc(((size_t)index_get_count() + 1) * sizeof(int));
+    int n = 0;
+    if (ids) {
+        for (int i = index_next(0); i != -1; i = index_next(i + 1)) ids[n++] = index_get(i)->id;
+        qsort(ids, n, sizeof(int), compare_ids);
     }
+    *count = n;
+    return ids;
+}
+
+// Full path of a document; 0 if it is gone or the path does not fit
+static int document_path(int id, char *fullpath, size_t size) {
+    pthread_rwlock_rdlock(&index_lock);
+    DocumentMeta *doc = index_lookup(id);
+    int ok = doc && snprintf(fullpath, size, "%s/%s", document_folder, index_str(doc->path)) < (int)size;
+    pthread_rwlock_unlock(&index_lock);
+    return ok;
+}
+
+typedef struct {
+    const Pattern *pattern;
+    const int *ids;
+    const int *source;      // entry with the same contents that is read (itself if it is the first)
+    int base;               // first entry of the window being matched
+    unsigned char *hits;    // one flag per entry of ids
+    long *counts;           // with --counts: occurrences and matching lines per entry
+} SearchJob;
+
+// Executor task: matches the documents at [base + begin, base + end) of the snapshot
+static void search_range(void *ctx, int begin, int end) {
+    SearchJob *job = ctx;
+    for (int i = job->base + begin; i < job->base + end; i++) {
+        if (job->source[i] != i) continue;
+        char fullpath[MAX_PATH + 256];
+        if (!document_path(job->ids[i], fullpath, sizeof(fullpath))) {
+            job->hits[i] = 0;
+        } else if (job->counts) {
+            // One pass gives both counts, so they cost no more than the match itself
+            job->hits[i] = matcher_file_counts(job->pattern, fullpath, &job->counts[2 * i], &job->counts[2 * i + 1]) == 1;
+        } else {
+            job->hits[i] = matcher_file_matches(job->pattern, fullpath) == 1;
+        }
+    }
+}
+
+// One hit of a search reply: "id", or with --counts "(id, occurrences, matching_lines)"
+static void stream_hit(ResponseStream *stream, int *first, int id, const long *counts) {
+    if (counts) stream_printf(stream, *first ? "(%d, %ld, %ld)" : ", (%d, %ld, %ld)", id, counts[0], counts[1]);
+    else stream_printf(stream, *first ? "%d" : ", %d", id);
+    *first = 0;
+}
+
+// For each entry of a sorted snapshot, the entry of the lowest id with the same contents
+// (an earlier one, or itself); NULL if out of memory. The caller holds the index lock.
+static int *content_sources(const int *ids, int count) {
+    int *source = malloc(((size_t)count + 1) * sizeof(int));
+    for (int i = 0; source && i < count; i++) {
+        int content = postings_content_of(ids[i]);
+        const int *found = content == ids[i] ? NULL : bsearch(&content, ids, i, sizeof(int), compare_ids);
+        source[i] = found ? (int)(found - ids) : i;
+    }
+    return source;
+}
+
+// Occurrences and matching lines of each id (two per id), as words from the index (see
+// query_counts), worked out once per distinct contents; NULL if out of memory. The
+// caller holds the index lock.
+static long *fill_counts(const Query *query, const int *ids, int count) {
+    long *counts = malloc(((size_t)count + 1) * 2 * sizeof(long));
+    KeyMap done;   // representative -> entry that already has its counts
+    if (!counts || keymap_init(&done, count) == -1) {
+        free(counts);
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        int content = postings_content_of(ids[i]);
+        int j = keymap_get(&done, content);
+        if (j != -1) {
+            counts[2 * i] = counts[2 * j];
+            counts[2 * i + 1] = counts[2 * j + 1];
+        } else if (query_counts(query, ids[i], &counts[2 * i], &counts[2 * i + 1]) == -1) {
+            free(counts);
+            keymap_free(&done);
+            return NULL;
+        } else {
+            keymap_put(&done, content, i);
+        }
+    }
+    keymap_free(&done);
+    return counts;
+}
+
+// Sends a whole result as the search reply
+static void reply_hits(Message *msg, const int *ids, const long *counts, int count) {
+    ResponseStream stream;
+    int first = 1;
+    reply_begin(msg, &stream, STATUS_OK, LENGTH_UNKNOWN);
+    stream_write(&stream, "[", 1);
+    for (int i = 0; i < count && !stream.failed; i++) stream_hit(&stream, &first, ids[i], counts ? counts + 2 * i : NULL);
+    stream_write(&stream, "]", 1);
+    reply_end(&stream);
+}
+
+// Brings a cached result up to date, one added document at a time (see resultcache.h)
+typedef struct {
+    const Query *query;
+    int with_counts;
+} QueryTest;
+
+// The caller holds the index lock
+static int test_query(void *ctx, int id, long *counts) {
+    QueryTest *t = ctx;
+    if (!index_lookup(id) || !query_matches(t->query, id)) return 0;
+    return t->with_counts && query_counts(t->query, id, &counts[0], &counts[1]) == -1 ? -1 : 1;
+}
+
+typedef struct {
+    const Pattern *pattern;
+    int with_counts;
+} ScanTest;
+
+static int test_scan(void *ctx, int id, long *counts) {
+    ScanTest *t = ctx;
+    char fullpath[MAX_PATH + 256];
+    if (!document_path(id, fullpath, sizeof(fullpath))) return 0;
+    if (t->with_counts) return matcher_file_counts(t->pattern, fullpath, &counts[0], &counts[1]) == 1;
+    return matcher_file_matches(t->pattern, fullpath) == 1;
 }
 
+#define SEARCH_WINDOW 8192   // documents matched before their hits are streamed
+#define RESULT_KEY_SIZE 1024 // longer queries are not cached
+
 void handle_search(Message *msg) {
-    // Safe allocation with proper checking
-    char *result = NULL;
     char *keyword = NULL;
     char *nproc_str = NULL;
     int nproc = 0;
-    int total = index_total();
+    int top = 0;
     
     // Make a copy of the arguments for safe parsing
     char *args_copy = strdup(msg->args);
     if (!args_copy) {
-        send_response(msg->client_fifo, "[]");
+        send_response(msg, "[]");
         return;
     }
     
-    keyword = strtok(args_copy, "|");
+    char *saveptr;
+    keyword = strtok_r(args_copy, "|", &saveptr);
     if (!keyword) {
         free(args_copy);
-        send_response(msg->client_fifo, "[]");
+        send_response(msg, "[]");
         return;
     }
     
-    nproc_str = strtok(NULL, "|");
+    nproc_str = strtok_r(NULL, "|", &saveptr);
     nproc = (nproc_str != NULL) ? atoi(nproc_str) : 0;
-    
-    // Allocate memory for result
-    result = malloc(65536);
-    if (!result) {
+    char *top_str = strtok_r(NULL, "|", &saveptr);
+    top = (top_str != NULL) ? atoi(top_str) : 0;
+    char *counts_str = strtok_r(NULL, "|", &saveptr);
+    int with_counts = counts_str != NULL && atoi(counts_str) != 0;
+
+    // Results are streamed as they are found, so the reply can be any length
+    ResponseStream stream;
+    int first = 1;
+
+    // ---------- BOOLEAN MODE ----------
+    // Terms joined by AND/OR/NOT and parentheses are evaluated over the posting lists.
+    // The result is built under the read lock and streamed once it is released (below,
+    // together with ranked results).
+    Query query;
+    const char *query_error = NULL;
+    keyword = query_unwrap(keyword);
+    int parsed = query_parse(keyword, &query, &query_error);
+    if (parsed == -1) {
+        send_response(msg, query_error);
         free(args_copy);
-        send_response(msg->client_fifo, "[]");
         return;
     }
-    result[0] = '[';
-    result[1] = '\0';
 
-    // ---------- SEQUENTIAL MODE ----------
-    if (nproc <= 0 || nproc == 1 || total <= 1) {
-        int first = 1;
+    // ---------- RANKED MODE ----------
+    // With --top K only the K best documents are sent, best first. A plain keyword is
+    // read as any of its words; a query keeps its meaning and is ordered by its terms.
+    if (top > 0 && parsed == 0 && query_parse_words(keyword, &query) == 0) {
+        send_response(msg, "[]");
+        free(args_copy);
+        return;
+    }
+    // Both are cached under the canonical form of the query, so differences in case,
+    // spacing or implicit ANDs share an entry. A boolean result is patched for the
+    // documents added and removed since; a ranked one is only reused while nothing changed.
+    if (top > 0 || parsed == 1) {
+        char key[RESULT_KEY_SIZE];
+        int prefix = top > 0 ? snprintf(key, sizeof(key), "R%d|%d|", top, with_counts)
+                             : snprintf(key, sizeof(key), "B|%d|", with_counts);
+        int cacheable = query_format(&query, key + prefix, sizeof(key) - prefix) == 0;
+        QueryTest test = { &query, with_counts };
+        SearchResult result = { NULL, NULL, 0 };
+        int cached = 0;
 
-        for (int i = 0; i < total; i++) {
-            DocumentMeta *doc = index_get(i);
-            if (!doc) continue;
+        pthread_rwlock_rdlock(&index_lock);
+        unsigned long generation = resultcache_generation();
+        if (cacheable) cached = resultcache_get(key, generation, top > 0 ? NULL : test_query, &test, &result);
+        if (!cached) {
+            result.ids = top > 0 ? query_rank(&query, snapshot_ids, index_get_count(), top, &result.count)
+                                 : query_run(&query, snapshot_ids, index_get_count(), &result.count);
+            if (result.ids && with_counts) result.counts = fill_counts(&query, result.ids, result.count);
+        }
+        pthread_rwlock_unlock(&index_lock);
+        if (!result.ids || (with_counts && !result.counts)) {
+            send_response(msg, "Error: Out of memory");
+            resultcache_free(&result);
+            free(args_copy);
+            return;
+        }
+        if (cacheable && !cached) resultcache_put(key, generation, &result);
 
-            char fullpath[MAX_PATH + 256];
-            if (snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, doc->path) >= sizeof(fullpath)) {
-                continue;  // Skip if path is too long
-            }
+        reply_hits(msg, result.ids, result.counts, result.count);
+        stats_count_search(1, 0);
+        resultcache_free(&result);
+        free(args_copy);
+        return;
+    }
 
-            int pipefd[2];
-            if (pipe(pipefd) == -1) continue;
-            
-            pid_t pid = fork();
-            if (pid == -1) {
-                close(pipefd[0]);
-                close(pipefd[1]);
-                continue;
-            }
-            
-            if (pid == 0) {
-                // Child process
-                close(pipefd[0]);
-                dup2(pipefd[1], STDOUT_FILENO);
-                close(pipefd[1]);
-                execlp("grep", "grep", "-q", keyword, fullpath, (char *)NULL);
-                _exit(1);
-            }
+    // ---------- SCAN MODE ----------
+    // Anything else is matched in-process like "grep -q", over a snapshot of the ids so
+    // the files are read without holding the index. A keyword made only of word
+    // characters can only occur inside one word, so the snapshot is narrowed to the
+    // documents the inverted index cannot rule out; they are still matched like the rest,
+    // so the result is the same as grep's. The index only learns of an edited file at the
+    // next --watch sweep, so it is trusted for narrowing only while the watcher runs;
+    // with --watch=0 every file is read. nproc is a concurrency hint: how many
+    // executor threads the scan is dealt to (1 or less: this thread alone). The snapshot
+    // is matched a window at a time and each window's hits are sent before the next one.
+    // Each distinct contents is read once, for its lowest id; the other ids sharing it
+    // reuse that result (kept for the whole snapshot, since it may be in an earlier window).
+    // The hits are cached under the keyword and patched by reading only the documents
+    // added since; that needs the file watcher, which turns an edited file into a remove
+    // and an add, so without it scans are never cached.
+    Pattern pattern;
+    if ((with_counts ? matcher_compile_counting(&pattern, keyword) : matcher_compile(&pattern, keyword)) == -1) {
+        send_response(msg, "[]");
+        free(args_copy);
+        return;
+    }
 
-            // Parent process
-            close(pipefd[1]);
-            close(pipefd[0]);
-            
-            int status;
-            waitpid(pid, &status, 0);
-            
-            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-                // Match found
-                if (!first) strncat(result, ", ", 65536 - strlen(result) - 1);
-                char buf[16];
-                snprintf(buf, sizeof(buf), "%d", doc->id);
-                strncat(result, buf, 65536 - strlen(result) - 1);
-                first = 0;
-            }
-        }
+    char key[RESULT_KEY_SIZE];
+    int cacheable = watch_interval > 0 && snprintf(key, sizeof(key), "S|%d|%s", with_counts, keyword) < (int)sizeof(key);
+    ScanTest test = { &pattern, with_counts };
+    SearchResult cached;
+    if (cacheable && resultcache_get(key, resultcache_generation(), test_scan, &test, &cached)) {
+        reply_hits(msg, cached.ids, cached.counts, cached.count);
+        stats_count_search(0, 0);
+        resultcache_free(&cached);
+        matcher_free(&pattern);
+        free(args_copy);
+        return;
+    }
 
-        strncat(result, "]", 65536 - strlen(result) - 1);
-        send_response(msg->client_fifo, result);
-        free(result);
+    char term[MAX_TERM + 1];
+    int narrowed = watch_interval > 0 && postings_normalize(keyword, term, sizeof(term)) == 0;
+    int total;
+    pthread_rwlock_rdlock(&index_lock);
+    unsigned long generation = resultcache_generation();
+    int *ids = narrowed ? postings_candidates(term, &total) : snapshot_ids(&total);
+    int *source = ids ? content_sources(ids, total) : NULL;
+    pthread_rwlock_unlock(&index_lock);
+    unsigned char *hits = malloc((size_t)total + 1);
+    long *counts = with_counts ? malloc(((size_t)total + 1) * 2 * sizeof(long)) : NULL;
+    if (!ids || !source || !hits || (with_counts && !counts)) {
+        send_response(msg, "[]");
+        free(ids);
+        free(source);
+        free(hits);
+        free(counts);
+        matcher_free(&pattern);
         free(args_copy);
         return;
     }
 
-    // ---------- CONCURRENT MODE ----------
-    if (nproc > total) nproc = total;  // Limit number of processes
-    
-    int fds[nproc][2];
-    pid_t pids[nproc];
-    int docs_per_proc = total / nproc;
-    int rest = total % nproc;
-
-    for (int i = 0, start = 0; i < nproc; i++) {
-        int count = docs_per_proc + (i < rest ? 1 : 0);
-        if (pipe(fds[i]) == -1) {
-            // Handle pipe creation error
-            for (int j = 0; j < i; j++) {
-                close(fds[j][0]);
-                kill(pids[j], SIGTERM);
-                waitpid(pids[j], NULL, 0);
-            }
-            send_response(msg->client_fifo, "[]");
-            free(result);
-            free(args_copy);
-            return;
-        }
+    reply_begin(msg, &stream, STATUS_OK, LENGTH_UNKNOWN);
+    stream_write(&stream, "[", 1);
+    long scanned = 0;
+    for (int base = 0; base < total && !stream.failed; base += SEARCH_WINDOW) {
+        int count = total - base < SEARCH_WINDOW ? total - base : SEARCH_WINDOW;
+        SearchJob job = { &pattern, ids, source, base, hits, counts };
+        executor_run(search_range, &job, count, nproc);
 
-        pids[i] = fork();
-        if (pids[i] == -1) {
-            // Handle fork error
-            for (int j = 0; j < i; j++) {
-                close(fds[j][0]);
-                kill(pids[j], SIGTERM);
-                waitpid(pids[j], NULL, 0);
+        for (int i = base; i < base + count; i++) {
+            if (source[i] == i) {
+                scanned++;
+            } else {
+                hits[i] = hits[source[i]];
+                if (counts) {
+                    counts[2 * i] = counts[2 * source[i]];
+                    counts[2 * i + 1] = counts[2 * source[i] + 1];
+                }
             }
-            close(fds[i][0]);
-            close(fds[i][1]);
-            send_response(msg->client_fifo, "[]");
-            free(result);
-            free(args_copy);
-            return;
+            if (hits[i]) stream_hit(&stream, &first, ids[i], counts ? counts + 2 * i : NULL);
         }
-        
-        if (pids[i] == 0) {
-            // Child process
-            for (int j = 0; j < i; j++) {
-                close(fds[j][0]);
-                close(fds[j][1]);
+    }
+    // Every window was matched: keep the hits (packed in place) for the next time
+    if (cacheable && !stream.failed) {
+        int found = 0;
+        for (int i = 0; i < total; i++) {
+            if (!hits[i]) continue;
+            ids[found] = ids[i];
+            if (counts) {
+                counts[2 * found] = counts[2 * i];
+                counts[2 * found + 1] = counts[2 * i + 1];
             }
-            close(fds[i][0]);
+            found++;
+        }
+        SearchResult result = { ids, counts, found };
+        resultcache_put(key, generation, &result);
+    }
+    stream_write(&stream, "]", 1);
+    reply_end(&stream);
+    stats_count_search(0, scanned);
 
-            char partial[4096] = "";
-            int first = 1;
+    free(ids);
+    free(source);
+    free(hits);
+    free(counts);
+    matcher_free(&pattern);
+    free(args_copy);
+}
 
-            for (int j = 0; j < count; j++) {
-                int index = start + j;
-                DocumentMeta *doc = index_get(index);
-                if (!doc) continue;
+#define BULK_COMMIT_BATCH 256   // documents inserted per hold of the write lock
 
-                char fullpath[MAX_PATH + 256];
-                if (snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, doc->path) >= sizeof(fullpath)) {
-                    continue;  // Skip if path is too long
-                }
+typedef struct {
+    char path[MAX_PATH + 1];
+    char title[MAX_TITLE + 1];
+    char authors[MAX_AUTHORS + 1];
+    DocumentTerms terms;
+    int ready;
+} BulkItem;
 
-                int grep_pipe[2];
-                if (pipe(grep_pipe) == -1) continue;
-                
-                pid_t grep_pid = fork();
-                if (grep_pid == -1) {
-                    close(grep_pipe[0]);
-                    close(grep_pipe[1]);
-                    continue;
-                }
-                
-                if (grep_pid == 0) {
-                    // Grep process
-                    close(grep_pipe[0]);
-                    dup2(grep_pipe[1], STDOUT_FILENO);
-                    close(grep_pipe[1]);
-                    execlp("grep", "grep", "-q", keyword, fullpath, (char *)NULL);
-                    _exit(1);
-                }
-                
-                // Child process handling grep result
-                close(grep_pipe[1]);
-                close(grep_pipe[0]);
-                
-                int status;
-                waitpid(grep_pid, &status, 0);
-                
-                if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-                    // Match found
-                    if (!first) strncat(partial, ", ", sizeof(partial) - strlen(partial) - 1);
-                    char buf[16];
-                    snprintf(buf, sizeof(buf), "%d", doc->id);
-                    strncat(partial, buf, sizeof(partial) - strlen(partial) - 1);
-                    first = 0;
-                }
-            }
+static int compare_bulk_items(const void *a, const void *b) {
+    return strcmp(((const BulkItem *)a)->path, ((const BulkItem *)b)->path);
+}
+
+static int bulk_append(BulkItem **items, int *count, int *capacity, const char *path) {
+    if (*count == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 256;
+        BulkItem *p = realloc(*items, (size_t)new_capacity * sizeof(BulkItem));
+        if (!p) return -1;
+        *items = p;
+        *capacity = new_capacity;
+    }
+    BulkItem *item = &(*items)[(*count)++];
+    memset(item, 0, sizeof(*item));
+    strcpy(item->path, path);
+    return 0;
+}
+
+// Documents named by a bulk add: every regular file of a directory, or one path per line
+// of a manifest file. Both are relative to the document folder, like the paths of -a.
+// Returns the number of entries skipped because their path is too long, or -1.
+static int bulk_collect(const char *source, BulkItem **items, int *count) {
+    char fullpath[MAX_PATH + 256];
+    int capacity = 0, skipped = 0;
+    *items = NULL;
+    *count = 0;
+
+    if (snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, source) >= (int)sizeof(fullpath)) return -1;
+    struct stat st;
+    if (stat(fullpath, &st) == -1) return -1;
 
-            ssize_t bytes_written = write(fds[i][1], partial, strlen(partial));
-            if (bytes_written == -1 || (size_t)bytes_written != strlen(partial)) {
-                if (debug_mode) perror("Write error in child process");
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(fullpath);
+        if (!dir) return -1;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+
+            char path[MAX_PATH + 256];
+            int len = strcmp(source, ".") == 0 ? snprintf(path, sizeof(path), "%s", entry->d_name)
+                                               : snprintf(path, sizeof(path), "%s/%s", source, entry->d_name);
+            char filepath[MAX_PATH + 512];
+            snprintf(filepath, sizeof(filepath), "%s/%s", document_folder, path);
+            if (stat(filepath, &st) == -1 || !S_ISREG(st.st_mode)) continue;
+            if (len > MAX_PATH) {
+                skipped++;
+                continue;
             }
-            close(fds[i][1]);
-            exit(0);
-        } else {
-            // Parent process
-            close(fds[i][1]);
-            start += count;
+            if (bulk_append(items, count, &capacity, path) == -1) break;
         }
+        closedir(dir);
+        // Same order as the shell glob the per-file scripts used
+        if (*count > 1) qsort(*items, *count, sizeof(BulkItem), compare_bulk_items);
+        return skipped;
     }
 
-    int first = 1;
-    for (int i = 0; i < nproc; i++) {
-        char buffer[4096] = {0};
-        ssize_t bytes_read = read(fds[i][0], buffer, sizeof(buffer) - 1);
-        close(fds[i][0]);
-        
-        int status;
-        waitpid(pids[i], &status, 0);
-        
-        if (bytes_read > 0) {
-            buffer[bytes_read] = '\0';
-            if (strlen(buffer) > 0) {
-                if (!first) strncat(result, ", ", 65536 - strlen(result) - 1);
-                strncat(result, buffer, 65536 - strlen(result) - 1);
-                first = 0;
-            }
+    FILE *fp = fopen(fullpath, "r");
+    if (!fp) return -1;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        if (strlen(line) > MAX_PATH) {
+            skipped++;
+            continue;
         }
+        if (bulk_append(items, count, &capacity, line) == -1) break;
     }
+    fclose(fp);
+    return skipped;
+}
 
-    strncat(result, "]", 65536 - strlen(result) - 1);
-    send_response(msg->client_fifo, result);
-    free(result);
-    free(args_copy);
+// Executor task: reads metadata and terms of items [begin, end); runs without any lock
+static void bulk_prepare(void *ctx, int begin, int end) {
+    BulkItem *items = ctx;
+    for (int i = begin; i < end; i++) {
+        char fullpath[sizeof(document_folder) + MAX_PATH + 2];
+        snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, items[i].path);
+        strcpy(items[i].title, "Desconhecido");
+        strcpy(items[i].authors, "Desconhecido");
+        if (extract_metadata(fullpath, items[i].title, sizeof(items[i].title),
+                             items[i].authors, sizeof(items[i].authors)) == -1) continue;
+        items[i].ready = postings_tokenize(fullpath, &items[i].terms) == 0;
+    }
+}
+
+// Adds every document of a directory or manifest: metadata and terms are extracted on all
+// executor threads, then the documents are inserted in batches and logged with one WAL sync.
+void handle_bulk_add(Message *msg) {
+    char source[MAX_PATH + 256] = {0};
+    char year[MAX_YEAR + 1] = {0};
+    if (sscanf(msg->args, "%319[^|]|%4[^|]", source, year) < 1) {
+        send_response(msg, "Error: Invalid format for bulk add command");
+        return;
+    }
+
+    BulkItem *items;
+    int count;
+    int skipped = bulk_collect(source, &items, &count);
+    if (skipped == -1) {
+        char response[RESPONSE_SIZE];
+        snprintf(response, sizeof(response), "Error: %s is not a directory or manifest", source);
+        send_response(msg, response);
+        return;
+    }
+
+    executor_run(bulk_prepare, items, count, executor_threads());
+
+    int added = 0, first_id = 0, last_id = 0;
+    long lsn = 0;
+    for (int i = 0; i < count; ) {
+        pthread_rwlock_wrlock(&index_lock);
+        for (int end = i + BULK_COMMIT_BATCH; i < count && i < end; i++) {
+            if (!items[i].ready) continue;
+            int id = index_add_prepared(items[i].title, items[i].authors, year, items[i].path, &items[i].terms);
+            if (id <= 0) continue;
+            long record = wal_log_add(id, items[i].title, items[i].authors, year, items[i].path);
+            resultcache_record(id, 1);
+            if (record == -1) lsn = -1;
+            else if (lsn != -1) lsn = record;
+            if (!first_id) first_id = id;
+            last_id = id;
+            added++;
+        }
+        pthread_rwlock_unlock(&index_lock);
+    }
+    for (int i = 0; i < count; i++) postings_free_terms(&items[i].terms);
+    free(items);
+
+    char response[RESPONSE_SIZE];
+    snprintf(response, sizeof(response), "Indexed %d documents (ids %d-%d), %d skipped",
+             added, first_id, last_id, count - added + skipped);
+    if (added == 0) {
+        send_response(msg, response);
+        return;
+    }
+    reply_when_durable(msg, lsn, response);
+}
+
+static double started_us = 0;
+
+static long resident_kb() {
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(fp);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Live counters; the server keeps running
+void handle_stats(Message *msg) {
+    ThreadStats totals;
+    stats_collect(&totals);
+
+    long hits, misses;
+    int cached;
+    cache_get_stats(&hits, &misses, &cached);
+    long result_hits, result_patched, result_misses;
+    int results, result_capacity;
+    resultcache_stats(&result_hits, &result_patched, &result_misses, &results, &result_capacity);
+
+    pthread_rwlock_rdlock(&index_lock);
+    int documents = index_get_count();
+    int terms = postings_term_count();
+    size_t store_bytes = index_memory_bytes();
+    size_t postings_bytes = postings_memory_bytes();
+    int shared = postings_alias_count();
+    long reindexed = watch_reindexed;
+    pthread_rwlock_unlock(&index_lock);
+
+    ResponseStream stream;
+    reply_begin(msg, &stream, STATUS_OK, LENGTH_UNKNOWN);
+    stream_printf(&stream, "uptime_s: %.1f\n", (stats_now_us() - started_us) / 1e6);
+    stream_printf(&stream, "workers: %d\nsearch_threads: %d\n", worker_count, executor_threads());
+
+    Histogram all;
+    histogram_init(&all);
+    for (int c = 0; c < STATS_COMMANDS; c++) histogram_merge(&all, &totals.latency[c]);
+    stream_printf(&stream, "requests: %lu\n", (unsigned long)all.total);
+    stream_printf(&stream, "latency_us: %-11s %9s %10s %9s %9s %9s %9s\n",
+                  "command", "count", "mean", "p50", "p99", "p99.9", "max");
+    for (int c = 0; c < STATS_COMMANDS; c++) {
+        const Histogram *h = &totals.latency[c];
+        if (h->total == 0) continue;
+        stream_printf(&stream, "latency_us: %-11s %9lu %10.1f %9lu %9lu %9lu %9lu\n", stats_command_name(c),
+                      (unsigned long)h->total, histogram_mean(h), (unsigned long)histogram_percentile(h, 50),
+                      (unsigned long)histogram_percentile(h, 99), (unsigned long)histogram_percentile(h, 99.9),
+                      (unsigned long)h->max);
+    }
+
+    stream_printf(&stream, "cache: policy=%s hits=%ld misses=%ld hit_ratio=%.3f entries=%d/%d\n", cache_policy_name(), hits, misses,
+                  hits + misses ? (double)hits / (hits + misses) : 0.0, cached, cache_size);
+    stream_printf(&stream, "result_cache: hits=%ld patched=%ld misses=%ld entries=%d/%d\n",
+                  result_hits, result_patched, result_misses, results, result_capacity);
+    stream_printf(&stream, "index: documents=%d shared_contents=%d terms=%d store_bytes=%zu postings_bytes=%zu\n",
+                  documents, shared, terms, store_bytes, postings_bytes);
+    stream_printf(&stream, "memory: rss_kb=%ld\n", resident_kb());
+    stream_printf(&stream, "search: indexed=%lu scans=%lu docs_scanned=%lu steals=%ld\n",
+                  (unsigned long)totals.indexed_searches, (unsigned long)totals.scans,
+                  (unsigned long)totals.docs_scanned, executor_steals());
+    stream_printf(&stream, "watch: interval_s=%d reindexed=%ld\n", watch_interval, reindexed);
+    stream_printf(&stream, "wal: bytes=%ld", wal_size());
+    reply_end(&stream);
 }
 
 void handle_shutdown(Message *msg) {
     char response[RESPONSE_SIZE];
     snprintf(response, sizeof(response), "Server is shutting down");
-    send_response(msg->client_fifo, response);
-    index_save("data/index.txt");
+    send_response(msg, response);
+    reap_checkpoint(1);
+    // Exclusive against the file watcher, the only thread still changing the index
+    pthread_rwlock_wrlock(&index_lock);
+    if (save_index()) wal_reset();
+    wal_close();
     cache_print_stats();
     unlink(FIFO_SERVER);
-    cache_export_snapshot("data/cache_snapshot.txt");
+    cache_export_snapshot(CACHE_SNAPSHOT_FILE);
+    cache_trace_close();
     exit(EXIT_SUCCESS);
 }
 
+static void dispatch(Message *msg) {
+    switch (msg->command) {
+        case CMD_ADD: handle_add(msg); break;
+        case CMD_QUERY: handle_query(msg); break;
+        case CMD_REMOVE: handle_remove(msg); break;
+        case CMD_LINE_COUNT: handle_line_count(msg); break;
+        case CMD_SEARCH: handle_search(msg); break;
+        case CMD_BULK_ADD: handle_bulk_add(msg); break;
+        case CMD_SESSION_END: handle_session_end(msg); break;
+        case CMD_STATS: handle_stats(msg); break;
+        default:
+            if (debug_mode) fprintf(stderr, "Unknown command: %d\n", msg->command);
+            send_response(msg, "Error: Unknown command");
+            break;
+    }
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    Message msg;
+    stats_register_thread();
+
+    while (1) {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_count == 0 && !queue_stopping) pthread_cond_wait(&queue_not_empty, &queue_lock);
+        if (queue_count == 0) {
+            pthread_mutex_unlock(&queue_lock);
+            return NULL;
+        }
+        msg = queue[queue_head];
+        double received = queue_times[queue_head];
+        queue_head = (queue_head + 1) % QUEUE_SIZE;
+        queue_count--;
+        queue_active++;
+        pthread_cond_signal(&queue_not_full);
+        pthread_mutex_unlock(&queue_lock);
+
+        dispatch(&msg);
+        stats_record(msg.command, (uint64_t)(stats_now_us() - received));
+
+        pthread_mutex_lock(&queue_lock);
+        queue_active--;
+        pthread_mutex_unlock(&queue_lock);
+    }
+}
+
+// Blocks while the queue is full, which pushes back on clients through the FIFO
+static void queue_submit(const Message *msg) {
+    pthread_mutex_lock(&queue_lock);
+    while (queue_count == QUEUE_SIZE) pthread_cond_wait(&queue_not_full, &queue_lock);
+    queue[(queue_head + queue_count) % QUEUE_SIZE] = *msg;
+    queue_times[(queue_head + queue_count) % QUEUE_SIZE] = stats_now_us();
+    queue_count++;
+    pthread_cond_signal(&queue_not_empty);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static int queue_idle() {
+    pthread_mutex_lock(&queue_lock);
+    int idle = queue_count == 0 && queue_active == 0;
+    pthread_mutex_unlock(&queue_lock);
+    return idle;
+}
+
+// Lets the workers finish every queued request, then joins them
+static void workers_stop() {
+    pthread_mutex_lock(&queue_lock);
+    queue_stopping = 1;
+    pthread_cond_broadcast(&queue_not_empty);
+    pthread_mutex_unlock(&queue_lock);
+    for (int i = 0; i < worker_count; i++) pthread_join(workers[i], NULL);
+}
+
+// Refills the cache from the last snapshot. The least valuable id goes in first, so
+// the policy ends up ranking the entries as the snapshot listed them.
+static void *warm_cache(void *arg) {
+    (void)arg;
+    int ids[MAX_CACHE];
+    int count = cache_size > 0 ? cache_snapshot_ids(CACHE_SNAPSHOT_FILE, ids, cache_size) : 0;
+    if (count <= 0) return NULL;
+
+    double start = stats_now_us();
+    int warmed = 0;
+    for (int i = count - 1; i >= 0; i--) {
+        pthread_rwlock_rdlock(&index_lock);
+        warmed += cache_warm(ids[i]);
+        pthread_rwlock_unlock(&index_lock);
+    }
+    printf("[INFO] Cache warmed with %d of %d snapshot entries (%.2f ms).\n", warmed, count,
+           (stats_now_us() - start) / 1000);
+    return NULL;
+}
+
+// Re-indexes documents whose files changed since they were read. A stat per document
+// finds the candidates; reading and tokenizing happen without the index lock, and only
+// the swap takes it exclusively. The swap is logged as a remove and an add of the same
+// id, so replaying the log reads the file again.
+static void *watch_files(void *arg) {
+    (void)arg;
+    while (1) {
+        sleep(watch_interval);
+
+        int count;
+        pthread_rwlock_rdlock(&index_lock);
+        int *ids = snapshot_ids(&count);
+        pthread_rwlock_unlock(&index_lock);
+        if (!ids) continue;
+
+        for (int i = 0; i < count; i++) {
+            char fullpath[512];
+            FileState known;
+            pthread_rwlock_rdlock(&index_lock);
+            DocumentMeta *doc = index_lookup(ids[i]);
+            int ok = doc && snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, index_str(doc->path)) < (int)sizeof(fullpath);
+            int tracked = ok && postings_file_state(ids[i], &known) == 0;
+            pthread_rwlock_unlock(&index_lock);
+
+            struct stat st;
+            if (!ok || stat(fullpath, &st) == -1) continue;
+            if (tracked && st.st_size == known.size &&
+                (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec == known.mtime_ns)
+                continue;
+
+            DocumentTerms terms;
+            if (postings_tokenize(fullpath, &terms) == -1) continue;
+            char title[MAX_TITLE + 1] = "Desconhecido";
+            char authors[MAX_AUTHORS + 1] = "Desconhecido";
+            int same = tracked && terms.state.size == known.size && terms.state.hash == known.hash;
+            if (!same) extract_metadata(fullpath, title, sizeof(title), authors, sizeof(authors));
+
+            long lsn = -1;
+            pthread_rwlock_wrlock(&index_lock);
+            if (same) {
+                // Touched but not changed: remember the new mtime so it is not read again
+                if (index_lookup(ids[i])) postings_set_file_state(ids[i], &terms.state);
+            } else if (index_replace(ids[i], title, authors, &terms) != -1) {
+                doc = index_lookup(ids[i]);
+                wal_log_remove(ids[i]);
+                lsn = wal_log_add(ids[i], index_str(doc->title), index_str(doc->authors), doc->year, index_str(doc->path));
+                resultcache_record(ids[i], 0);
+                resultcache_record(ids[i], 1);
+                watch_reindexed++;
+            }
+            pthread_rwlock_unlock(&index_lock);
+            postings_free_terms(&terms);
+
+            if (lsn != -1) {
+                wal_sync(lsn);
+                if (debug_mode) printf("[WATCH] Documento %d alterado — reindexado\n", ids[i]);
+            }
+        }
+        free(ids);
+    }
+    return NULL;
+}
+
+static int needs_compaction() {
+    pthread_rwlock_rdlock(&index_lock);
+    int needed = index_needs_compaction();
+    pthread_rwlock_unlock(&index_lock);
+    return needed;
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <document_folder> [cache_size]\n", argv[0]);
+        fprintf(stderr, "Usage: %s <document_folder> [cache_size] [--durability=none|batch|always] [--workers=N] [--search-threads=N] [--cache-policy=NAME] [--cache-trace=FILE] [--cache-warm=off|sync|background] [--watch=SECONDS] [--result-cache=N]\n", argv[0]);
+        fprintf(stderr, "  --watch=SECONDS  re-index edited files every SECONDS (default 5); -s may miss an edit until the next sweep.\n"
+                        "                   0 = never: plain -s keywords then read every file, queries keep the indexed text\n");
         return EXIT_FAILURE;
     }
 
+    const char *cache_arg = NULL;
+    const char *policy = "lru";
+    const char *trace = NULL;
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--durability=", 13) == 0) {
+            const char *level = argv[i] + 13;
+            if (strcmp(level, "none") == 0) durability = WAL_NONE;
+            else if (strcmp(level, "batch") == 0) durability = WAL_BATCH;
+            else if (strcmp(level, "always") == 0) durability = WAL_ALWAYS;
+            else {
+                fprintf(stderr, "Error: Unknown durability level %s\n", level);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--workers=", 10) == 0) {
+            worker_count = atoi(argv[i] + 10);
+            if (worker_count < 1 || worker_count > MAX_WORKERS) {
+                fprintf(stderr, "Error: Workers must be between 1 and %d\n", MAX_WORKERS);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--search-threads=", 17) == 0) {
+            search_threads = atoi(argv[i] + 17);
+            if (search_threads < 1 || search_threads > MAX_EXECUTOR_THREADS) {
+                fprintf(stderr, "Error: Search threads must be between 1 and %d\n", MAX_EXECUTOR_THREADS);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--cache-policy=", 15) == 0) {
+            policy = argv[i] + 15;
+            if (!cache_policy_find(policy)) {
+                fprintf(stderr, "Error: Unknown cache policy %s (%s)\n", policy, cache_policy_names());
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--cache-trace=", 14) == 0) {
+            trace = argv[i] + 14;
+        } else if (strncmp(argv[i], "--watch=", 8) == 0) {
+            watch_interval = atoi(argv[i] + 8);
+            if (watch_interval < 0) {
+                fprintf(stderr, "Error: Watch interval must be 0 (off) or more seconds\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--result-cache=", 15) == 0) {
+            result_cache_size = atoi(argv[i] + 15);
+            if (result_cache_size < 0) {
+                fprintf(stderr, "Error: Result cache size must be 0 (off) or more\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--cache-warm=", 13) == 0) {
+            const char *mode = argv[i] + 13;
+            if (strcmp(mode, "off") == 0) cache_warm_mode = WARM_OFF;
+            else if (strcmp(mode, "sync") == 0) cache_warm_mode = WARM_SYNC;
+            else if (strcmp(mode, "background") == 0) cache_warm_mode = WARM_BACKGROUND;
+            else {
+                fprintf(stderr, "Error: Unknown cache warm mode %s\n", mode);
+                return EXIT_FAILURE;
+            }
+        } else {
+            cache_arg = argv[i];
+        }
+    }
+
     // Create data directory if it doesn't exist
     mkdir("data", 0777);
 
-    if (index_load("data/index.txt") == 0) {
-        printf("[INFO] Index loaded successfully.\n");
-    } else {
-        printf("[INFO] No index loaded.\n");
-    }
-
     if (strlen(argv[1]) >= sizeof(document_folder)) {
         fprintf(stderr, "Error: Document folder path too long\n");
         return EXIT_FAILURE;
@@ -448,20 +1288,104 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    if (argc >= 3) {
-        cache_size = atoi(argv[2]);
+    // Loaded after document_folder is known, so postings can be rebuilt if needed
+    if (index_load(INDEX_FILE)) {
+        printf("[INFO] Index loaded successfully.\n");
+    } else if (index_import_text(INDEX_TEXT_FILE)) {
+        index_save(INDEX_FILE);
+        printf("[INFO] Imported %s into %s.\n", INDEX_TEXT_FILE, INDEX_FILE);
+    } else {
+        printf("[INFO] No index loaded.\n");
+    }
+    if (!postings_load(POSTINGS_FILE, index_get_count(), index_fingerprint())) {
+        index_rebuild_postings();
+        postings_save(POSTINGS_FILE, index_get_count(), index_fingerprint());
+    }
+
+    // Changes since the last checkpoint: an interrupted checkpoint's log, then the current one
+    WalHandlers handlers = { replay_add, replay_remove };
+    int replayed = 0;
+    int n = wal_replay(WAL_OLD_FILE, &handlers);
+    if (n > 0) replayed += n;
+    n = wal_replay(WAL_FILE, &handlers);
+    if (n > 0) replayed += n;
+    if (wal_open(WAL_FILE, durability) == -1) {
+        perror("open WAL");
+        return EXIT_FAILURE;
+    }
+    if (replayed > 0) {
+        printf("[INFO] Replayed %d logged changes.\n", replayed);
+        if (save_index() && wal_reset() == 0) unlink(WAL_OLD_FILE);
+    }
+
+    if (cache_arg) {
+        cache_size = atoi(cache_arg);
         if (cache_size > MAX_CACHE) cache_size = MAX_CACHE;
         if (cache_size <= 0) cache_size = 10; // Default value
     }
+    if (cache_init(policy) == -1) {
+        fprintf(stderr, "Error: Could not create the %s cache\n", policy);
+        return EXIT_FAILURE;
+    }
+    if (resultcache_init(result_cache_size) == -1) {
+        fprintf(stderr, "Error: Could not create the result cache\n");
+        return EXIT_FAILURE;
+    }
+    if (trace && cache_trace_open(trace) == -1) {
+        perror(trace);
+        return EXIT_FAILURE;
+    }
 
     unlink(FIFO_SERVER);
     if (mkfifo(FIFO_SERVER, 0666) == -1) {
         perror("mkfifo");
         return EXIT_FAILURE;
     }
+    // A client that goes away mid-response must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_rwlockattr_t lock_attr;
+    pthread_rwlockattr_init(&lock_attr);
+    pthread_rwlockattr_setkind_np(&lock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&index_lock, &lock_attr);
+    pthread_rwlockattr_destroy(&lock_attr);
 
+    if (search_threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        search_threads = cpus < 1 ? 1 : cpus > MAX_EXECUTOR_THREADS ? MAX_EXECUTOR_THREADS : (int)cpus;
+    }
+    if (executor_start(search_threads) == -1) {
+        perror("executor_start");
+        unlink(FIFO_SERVER);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i], NULL, worker_main, NULL) != 0) {
+            perror("pthread_create");
+            unlink(FIFO_SERVER);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Synchronous warming finishes before the first request is read; background
+    // warming only fills the slots live requests have not taken yet
+    if (cache_warm_mode == WARM_SYNC) {
+        warm_cache(NULL);
+    } else if (cache_warm_mode == WARM_BACKGROUND) {
+        pthread_t warmer;
+        if (pthread_create(&warmer, NULL, warm_cache, NULL) == 0) pthread_detach(warmer);
+    }
+
+    if (watch_interval > 0) {
+        pthread_t watcher;
+        if (pthread_create(&watcher, NULL, watch_files, NULL) == 0) pthread_detach(watcher);
+    }
+
+    started_us = stats_now_us();
     printf("Server started. Document folder: %s\n", document_folder);
-    printf("Loaded %d documents. Cache size: %d\n", index_get_count(), cache_size);
+    printf("Loaded %d documents. Cache size: %d (%s). Workers: %d. Search threads: %d\n",
+           index_get_count(), cache_size, cache_policy_name(), worker_count, executor_threads());
 
     int fd = open(FIFO_SERVER, O_RDWR);
     if (fd == -1) {
@@ -472,6 +1396,27 @@ int main(int argc, char *argv[]) {
 
     Message msg;
     while (1) {
+        reap_checkpoint(0);
+        if (wal_size() > WAL_CHECKPOINT_BYTES) start_checkpoint();
+
+        // Compact while no request is waiting or running; poll so a checkpoint child gets reaped
+        int compact = needs_compaction();
+        int timeout = -1;
+        if (compact) timeout = queue_idle() ? 0 : 10;
+        else if (checkpoint_pid != -1) timeout = 100;
+
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, timeout);
+        if (ready == 0) {
+            if (compact && queue_idle()) {
+                pthread_rwlock_wrlock(&index_lock);
+                index_compact_step(64);
+                pthread_rwlock_unlock(&index_lock);
+            }
+            continue;
+        }
+        if (ready == -1) continue;
+
         ssize_t bytes = read(fd, &msg, sizeof(msg));
         if (bytes <= 0) continue;
         
@@ -484,18 +1429,13 @@ int main(int argc, char *argv[]) {
         msg.client_fifo[sizeof(msg.client_fifo) - 1] = '\0';
         msg.args[sizeof(msg.args) - 1] = '\0';
 
-        switch (msg.command) {
-            case CMD_ADD: handle_add(&msg); break;
-            case CMD_QUERY: handle_query(&msg); break;
-            case CMD_REMOVE: handle_remove(&msg); break;
-            case CMD_LINE_COUNT: handle_line_count(&msg); break;
-            case CMD_SEARCH: handle_search(&msg); break;
-            case CMD_SHUTDOWN: handle_shutdown(&msg); break;
-            default:
-                if (debug_mode) fprintf(stderr, "Unknown command: %d\n", msg.command);
-                send_response(msg.client_fifo, "Error: Unknown command");
-                break;
+        // Shutdown runs here, after the requests already read have been answered
+        if (msg.command == CMD_SHUTDOWN) {
+            workers_stop();
+            executor_stop();
+            handle_shutdown(&msg);
         }
+        queue_submit(&msg);
     }
 
     close(fd);
@@ -0,0 +1,216 @@
+#include "common.h"
+#include "executor.h"
+#include <pthread.h>
+#include <stdint.h>
+
+// Work-stealing executor for data-parallel loops. A job over [0, count) starts as one
+// range per thread it is spread over. A thread running a range larger than the grain
+// pushes its upper half onto its own deque and keeps the lower half (lazy splitting);
+// it pops from the bottom of its deque and, once that is empty, steals from the top of
+// the others, where the largest ranges are. A range full of expensive items therefore
+// keeps being split up instead of leaving the rest of the pool idle.
+
+#define DEQUE_SIZE 4096          // power of two
+#define GRAIN_DIVISOR 64         // grain = count / (threads * GRAIN_DIVISOR)
+
+typedef struct {
+    TaskFn fn;
+    void *ctx;
+    int grain;                   // ranges up to this size are not split
+    int remaining;               // ranges not finished yet
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+} Job;
+
+typedef struct {
+    Job *job;
+    int begin;
+    int end;
+} Task;
+
+typedef struct {
+    Task tasks[DEQUE_SIZE];
+    unsigned int top;            // thieves take from here
+    unsigned int bottom;         // the owner pops from here
+    pthread_mutex_t lock;
+} Deque;
+
+static Deque deques[MAX_EXECUTOR_THREADS];
+static pthread_t threads[MAX_EXECUTOR_THREADS];
+static int thread_count = 0;
+static int next_deque = 0;       // first deque of the next job
+
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_available = PTHREAD_COND_INITIALIZER;
+static int queued_tasks = 0;     // tasks sitting in any deque
+static int stopping = 0;
+static long steals = 0;
+
+static int deque_push(Deque *d, const Task *t) {
+    pthread_mutex_lock(&d->lock);
+    int ok = d->bottom - d->top < DEQUE_SIZE;
+    if (ok) d->tasks[d->bottom++ & (DEQUE_SIZE - 1)] = *t;
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static int deque_pop(Deque *d, Task *t) {
+    pthread_mutex_lock(&d->lock);
+    int ok = d->bottom != d->top;
+    if (ok) *t = d->tasks[--d->bottom & (DEQUE_SIZE - 1)];
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static int deque_steal(Deque *d, Task *t) {
+    pthread_mutex_lock(&d->lock);
+    int ok = d->bottom != d->top;
+    if (ok) *t = d->tasks[d->top++ & (DEQUE_SIZE - 1)];
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+// self is the running thread's deque, or -1 when the submitter runs the task inline
+static void task_run(int self, Task *t) {
+    Job *job = t->job;
+    while (self >= 0 && t->end - t->begin > job->grain) {
+        Task upper = { job, t->begin + (t->end - t->begin) / 2, t->end };
+
+        // Counted before the push, as in executor_run
+        pthread_mutex_lock(&job->lock);
+        job->remaining++;
+        pthread_mutex_unlock(&job->lock);
+        pthread_mutex_lock(&idle_lock);
+        queued_tasks++;
+        pthread_mutex_unlock(&idle_lock);
+
+        if (!deque_push(&deques[self], &upper)) {
+            pthread_mutex_lock(&idle_lock);
+            queued_tasks--;
+            pthread_mutex_unlock(&idle_lock);
+            pthread_mutex_lock(&job->lock);
+            job->remaining--;
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_signal(&work_available);
+        pthread_mutex_unlock(&idle_lock);
+        t->end = upper.begin;
+    }
+
+    job->fn(job->ctx, t->begin, t->end);
+
+    // The job lives on the submitter's stack: do not touch it after the last unlock
+    pthread_mutex_lock(&job->lock);
+    if (--job->remaining == 0) pthread_cond_signal(&job->done);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static int take_task(int self, Task *t) {
+    if (deque_pop(&deques[self], t)) return 1;
+    for (int i = 1; i < thread_count; i++) {
+        if (deque_steal(&deques[(self + i) % thread_count], t)) {
+            __atomic_add_fetch(&steals, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *executor_main(void *arg) {
+    int self = (int)(intptr_t)arg;
+    Task t;
+
+    while (1) {
+        pthread_mutex_lock(&idle_lock);
+        while (queued_tasks == 0 && !stopping) pthread_cond_wait(&work_available, &idle_lock);
+        if (queued_tasks == 0) {
+            pthread_mutex_unlock(&idle_lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&idle_lock);
+
+        // Another thread may have taken the task first; just look again
+        if (!take_task(self, &t)) continue;
+
+        pthread_mutex_lock(&idle_lock);
+        queued_tasks--;
+        pthread_mutex_unlock(&idle_lock);
+        task_run(self, &t);
+    }
+}
+
+int executor_start(int count) {
+    if (count > MAX_EXECUTOR_THREADS) count = MAX_EXECUTOR_THREADS;
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_init(&deques[i].lock, NULL);
+        deques[i].top = deques[i].bottom = 0;
+    }
+    for (thread_count = 0; thread_count < count; thread_count++) {
+        if (pthread_create(&threads[thread_count], NULL, executor_main, (void *)(intptr_t)thread_count) != 0)
+            return thread_count ? 0 : -1;
+    }
+    return 0;
+}
+
+int executor_threads() {
+    return thread_count;
+}
+
+// Runs fn over [0, count) spread over up to `concurrency` threads and returns when
+// every item is done. With concurrency <= 1 the caller does the work itself.
+void executor_run(TaskFn fn, void *ctx, int count, int concurrency) {
+    if (count <= 0) return;
+    if (concurrency > thread_count) concurrency = thread_count;
+    if (concurrency <= 1) {
+        fn(ctx, 0, count);
+        return;
+    }
+
+    int chunks = concurrency < count ? concurrency : count;
+    int grain = count / (concurrency * GRAIN_DIVISOR);
+
+    Job job = { fn, ctx, grain > 0 ? grain : 1, chunks, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+    // Counted before the pushes, so a thread that takes a task early never sees a negative count
+    pthread_mutex_lock(&idle_lock);
+    int first = next_deque;
+    next_deque = (next_deque + concurrency) % thread_count;
+    queued_tasks += chunks;
+    pthread_mutex_unlock(&idle_lock);
+
+    for (int c = 0; c < chunks; c++) {
+        Task t = { &job, (int)((long)count * c / chunks), (int)((long)count * (c + 1) / chunks) };
+        if (!deque_push(&deques[(first + c) % thread_count], &t)) {
+            pthread_mutex_lock(&idle_lock);
+            queued_tasks--;
+            pthread_mutex_unlock(&idle_lock);
+            task_run(-1, &t);  // deque full: no point in waiting for room
+        }
+    }
+
+    pthread_mutex_lock(&idle_lock);
+    pthread_cond_broadcast(&work_available);
+    pthread_mutex_unlock(&idle_lock);
+
+    pthread_mutex_lock(&job.lock);
+    while (job.remaining > 0) pthread_cond_wait(&job.done, &job.lock);
+    pthread_mutex_unlock(&job.lock);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.done);
+}
+
+long executor_steals() {
+    return __atomic_load_n(&steals, __ATOMIC_RELAXED);
+}
+
+// Finishes the queued tasks, then joins the threads
+void executor_stop() {
+    pthread_mutex_lock(&idle_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&work_available);
+    pthread_mutex_unlock(&idle_lock);
+    for (int i = 0; i < thread_count; i++) pthread_join(threads[i], NULL);
+    thread_count = 0;
+}
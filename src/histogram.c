@@ -0,0 +1,86 @@
+#include "histogram.h"
+#include <string.h>
+
+static int bucket_of(uint64_t value) {
+    if (value >= (1ULL << HIST_MAX_BITS)) value = (1ULL << HIST_MAX_BITS) - 1;
+    if (value < HIST_SUB) return (int)value;
+    int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)((value >> shift) - HIST_SUB);
+}
+
+// Largest value that falls in a bucket
+uint64_t histogram_bucket_upper(int bucket) {
+    if (bucket < HIST_SUB) return bucket;
+    int shift = bucket / HIST_SUB - 1;
+    uint64_t lower = (uint64_t)(bucket % HIST_SUB + HIST_SUB) << shift;
+    return lower + (1ULL << shift) - 1;
+}
+
+void histogram_init(Histogram *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void histogram_record(Histogram *h, uint64_t value) {
+    h->counts[bucket_of(value)]++;
+    h->total++;
+    h->sum += value;
+    if (value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+}
+
+void histogram_merge(Histogram *dst, const Histogram *src) {
+    for (int i = 0; i < HIST_BUCKETS; i++) dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+// Single-writer variant: only the owning thread records, with relaxed stores instead
+// of locked adds, and other threads may read it at any time with histogram_merge_live
+void histogram_record_owned(Histogram *h, uint64_t value) {
+    int b = bucket_of(value);
+    __atomic_store_n(&h->counts[b], h->counts[b] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->total, h->total + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum, h->sum + value, __ATOMIC_RELAXED);
+    if (value < h->min) __atomic_store_n(&h->min, value, __ATOMIC_RELAXED);
+    if (value > h->max) __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+}
+
+// Merges a histogram another thread is still recording into; the total is recounted
+// from the buckets so percentiles stay consistent with what was read
+void histogram_merge_live(Histogram *dst, const Histogram *src) {
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        uint64_t n = __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+        dst->counts[i] += n;
+        dst->total += n;
+    }
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    uint64_t min = __atomic_load_n(&src->min, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    if (min < dst->min) dst->min = min;
+    if (max > dst->max) dst->max = max;
+}
+
+// Upper bound of the bucket holding the given percentile (never above the maximum seen)
+uint64_t histogram_percentile(const Histogram *h, double percent) {
+    if (h->total == 0) return 0;
+    uint64_t rank = (uint64_t)(percent / 100.0 * h->total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > h->total) rank = h->total;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t upper = histogram_bucket_upper(i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+double histogram_mean(const Histogram *h) {
+    return h->total ? (double)h->sum / h->total : 0;
+}
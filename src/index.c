@@ -1,23 +1,149 @@
 #include "common.h"
 #include "index.h"
+#include "postings.h"
+#include "cache.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
-
-static DocumentMeta docs[MAX_DOCUMENTS];
-static int doc_count = 0;
+#include <stdint.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+// Document store: records live in fixed-size chunks that never move once allocated,
+// and their strings live in an append-only arena referenced as (offset, length).
+#define STORE_CHUNK_BITS 12                     // 4096 records per chunk
+#define STORE_CHUNK (1 << STORE_CHUNK_BITS)
+#define ARENA_CHUNK_BITS 20                     // 1 MiB string chunks
+#define ARENA_CHUNK (1u << ARENA_CHUNK_BITS)
+#define DOC(slot) (&chunks[(slot) >> STORE_CHUNK_BITS][(slot) & (STORE_CHUNK - 1)])
+
+static DocumentMeta **chunks = NULL;
+static int chunk_count = 0;
+static int chunk_capacity = 0;
+
+static char **arena = NULL;
+static int arena_chunks = 0;
+static int arena_capacity = 0;
+static unsigned int arena_used = 0;    // bytes used in the last arena chunk
+static size_t arena_live = 0;          // bytes referenced by live documents
+static size_t arena_garbage = 0;       // bytes left behind by removed documents
+
+static int doc_count = 0;      // live documents
+static int slot_high = 0;      // slots [0, slot_high) have been handed out
 static int next_id = 1;
 
-// LRU Cache
+// Primary index: id -> slot + 1 (0 = absent). Ids come from next_id, so they are
+// dense enough for direct addressing; the table is chunked like the records.
+#define ID_CHUNK_BITS 12
+#define ID_CHUNK (1 << ID_CHUNK_BITS)
+
+static int **id_chunks = NULL;
+static int id_chunk_count = 0;
+static int id_chunk_capacity = 0;
+
+// Removed documents leave a tombstone (id 0, live bit cleared) whose slot goes on
+// a free stack for reuse; idle-time compaction moves tail records into the holes.
+static unsigned long long *live_bits = NULL;
+static int *free_slots = NULL;
+static int free_count = 0;
+static int free_capacity = 0;
+
+// Binary index file (index_save/index_load):
+//   header | id directory (int[next_id], slot + 1) | record table (DocumentMeta[]) | string heap
+// Records are stored exactly as they are used in memory, with StrRefs pointing into the
+// heap (STRREF_BASE set), so a loaded file is served straight from a private mapping
+// and pages are only faulted in when a record or string is touched.
+#define INDEX_MAGIC "DOCINDEX"
+#define INDEX_VERSION 1
+#define STRREF_BASE 0x80000000u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t record_count;
+    int32_t next_id;
+    uint64_t directory_offset;
+    uint64_t records_offset;
+    uint64_t heap_offset;
+    uint64_t heap_size;
+    uint32_t payload_crc;     // everything after the header
+    uint32_t header_crc;      // header with this field set to 0
+} IndexFileHeader;
+
+_Static_assert(sizeof(DocumentMeta) == 36, "DocumentMeta is the on-disk record layout");
+
+static char *base_map = NULL;          // mapping of the loaded file
+static size_t base_map_size = 0;
+static const char *base_heap = NULL;
+static size_t base_heap_size = 0;
+static int mapped_chunks = 0;          // record chunks pointing into the mapping
+static int mapped_id_chunks = 0;
+static unsigned int fingerprint = 0;   // payload checksum of the last loaded/saved file
+
+// Metadata cache: the eviction policy (cache.c) decides which ids stay cached; the
+// records themselves sit in a fixed pool, found through an id -> slot map
 static CacheEntry cache[MAX_CACHE];
+static int cache_free_slots[MAX_CACHE];
+static int cache_free_count = 0;
+static KeyMap cache_slots;
+static const CachePolicy *cache_policy = NULL;
+static void *cache_state = NULL;   // NULL while the cache is disabled
 static int cache_count = 0;
+static FILE *cache_trace = NULL;
 extern int cache_size;
 
 int debug_mode = DEBUG_MODE;
 static int cache_hits = 0;
 static int cache_misses = 0;
 
+// The store is not locked here: the server runs writers exclusively and lets readers
+// share it. Lookups still modify the cache, so the cache has its own mutex.
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Selects the eviction policy and sizes the cache to cache_size; -1 for an unknown policy
+int cache_init(const char *policy) {
+    const CachePolicy *selected = cache_policy_find(policy);
+    if (!selected) return -1;
+    cache_policy = selected;
+    if (cache_size <= 0) return 0;
+
+    if (keymap_init(&cache_slots, MAX_CACHE) == -1) return -1;
+    cache_state = cache_policy->create(cache_size);
+    if (!cache_state) {
+        keymap_free(&cache_slots);
+        return -1;
+    }
+    for (int i = cache_size - 1; i >= 0; i--) cache_free_slots[cache_free_count++] = i;
+    return 0;
+}
+
+const char *cache_policy_name() {
+    return cache_policy ? cache_policy->name : "none";
+}
+
+// Appends every id looked up with -c to a file, for replay with cachesim
+int cache_trace_open(const char *filename) {
+    cache_trace = fopen(filename, "a");
+    return cache_trace ? 0 : -1;
+}
+
+void cache_trace_close() {
+    pthread_mutex_lock(&cache_lock);
+    if (cache_trace) fclose(cache_trace);
+    cache_trace = NULL;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Live counters for CMD_STATS
+void cache_get_stats(long *hits, long *misses, int *entries) {
+    pthread_mutex_lock(&cache_lock);
+    *hits = cache_hits;
+    *misses = cache_misses;
+    *entries = cache_count;
+    pthread_mutex_unlock(&cache_lock);
+}
 
 void cache_print_stats() {
     if (debug_mode) {
@@ -26,98 +152,418 @@ void cache_print_stats() {
     }
 }
 
-
-void cache_move_to_front(int index) {
-    if (index <= 0 || index >= cache_count) return;
-    CacheEntry temp = cache[index];
-    for (int i = index; i > 0; i--) {
-        cache[i] = cache[i - 1];
-    }
-    cache[0] = temp;
-    if (debug_mode) printf("[CACHE] ID %d movido para o topo (LRU)\n", temp.id);
+static void cache_release(int id) {
+    int slot = keymap_get(&cache_slots, id);
+    if (slot == -1) return;
+    keymap_delete(&cache_slots, id);
+    cache[slot].id = 0;
+    cache_free_slots[cache_free_count++] = slot;
+    cache_count--;
 }
 
 void cache_add(int id, DocumentMeta *doc) {
-    for (int i = 0; i < cache_count; i++) {
-        if (cache[i].id == id) {
-            if (debug_mode) printf("[CACHE] ID %d já está na cache — não adicionado novamente\n", id);
-            return;
-        }
-    }
+    if (!cache_state) return;
 
-    if (cache_count == cache_size) {
-        if (debug_mode) printf("[CACHE] Removido ID %d (mais antigo)\n", cache[cache_count - 1].id);
-        cache_count--;
+    if (keymap_get(&cache_slots, id) != -1) {
+        if (debug_mode) printf("[CACHE] ID %d já está na cache — não adicionado novamente\n", id);
+        return;
     }
 
-    for (int i = cache_count; i > 0; i--) {
-        cache[i] = cache[i - 1];
+    int evicted = cache_policy->insert(cache_state, id);
+    if (evicted != -1) {
+        if (debug_mode) printf("[CACHE] Removido ID %d (%s)\n", evicted, cache_policy->name);
+        cache_release(evicted);
     }
 
-    cache[0].id = id;
-    memcpy(&cache[0].meta, doc, sizeof(DocumentMeta));
+    int slot = cache_free_slots[--cache_free_count];
+    cache[slot].id = id;
+    memcpy(&cache[slot].meta, doc, sizeof(DocumentMeta));
+    keymap_put(&cache_slots, id, slot);
     cache_count++;
 
     if (debug_mode) printf("[CACHE] ID %d adicionado\n", id);
 }
 
+// Drops a removed document so a later query can't be served a stale entry
+void cache_remove(int id) {
+    if (!cache_state || keymap_get(&cache_slots, id) == -1) return;
+
+    cache_policy->remove(cache_state, id);
+    cache_release(id);
+    if (debug_mode) printf("[CACHE] ID %d removido\n", id);
+}
+
+static int slot_of(int id);
 
-DocumentMeta* index_query(int id) {
-    for (int i = 0; i < cache_count; i++) {
-        if (cache[i].id == id) {
-            if (debug_mode) printf("[CACHE] HIT: ID %d\n", id);
-            cache_hits++;
-            cache_move_to_front(i);
-            return &cache[0].meta;
+// Re-copies cached records after the store moved their strings
+static void cache_refresh() {
+    for (int i = 0; i < cache_size && cache_state; i++) {
+        int slot = cache[i].id ? slot_of(cache[i].id) : -1;
+        if (slot != -1) cache[i].meta = *DOC(slot);
+    }
+}
+
+static int slot_is_live(int slot) {
+    return (live_bits[slot / 64] >> (slot % 64)) & 1;
+}
+
+// A loaded directory and its records are only checked here, when they are reached: the
+// entry must name a live record that carries the id back, with a terminated year
+static int slot_of(int id) {
+    if (id <= 0 || (id >> ID_CHUNK_BITS) >= id_chunk_count) return -1;
+    int slot = id_chunks[id >> ID_CHUNK_BITS][id & (ID_CHUNK - 1)] - 1;
+    if (slot < 0 || slot >= slot_high || !slot_is_live(slot)) return -1;
+    const DocumentMeta *doc = DOC(slot);
+    return doc->id == id && doc->year[MAX_YEAR] == '\0' ? slot : -1;
+}
+
+// A live record its id leads back to (see slot_of)
+static int slot_is_valid(int slot) {
+    return slot_of(DOC(slot)->id) == slot;
+}
+
+static int grow_array(void **ptr, int *capacity, int needed, size_t elem_size) {
+    if (needed <= *capacity) return 0;
+    int new_capacity = *capacity ? *capacity : 1024;
+    while (new_capacity < needed) new_capacity *= 2;
+    void *p = realloc(*ptr, (size_t)new_capacity * elem_size);
+    if (!p) return -1;
+    memset((char *)p + (size_t)*capacity * elem_size, 0, (size_t)(new_capacity - *capacity) * elem_size);
+    *ptr = p;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static int slot_bind(int slot, int id) {
+    while ((id >> ID_CHUNK_BITS) >= id_chunk_count) {
+        if (grow_array((void **)&id_chunks, &id_chunk_capacity, id_chunk_count + 1, sizeof(int *)) == -1)
+            return -1;
+        int *chunk = calloc(ID_CHUNK, sizeof(int));
+        if (!chunk) return -1;
+        id_chunks[id_chunk_count++] = chunk;
+    }
+    DOC(slot)->id = id;
+    id_chunks[id >> ID_CHUNK_BITS][id & (ID_CHUNK - 1)] = slot + 1;
+    live_bits[slot / 64] |= 1ULL << (slot % 64);
+    return 0;
+}
+
+static size_t arena_bytes(StrRef ref) {
+    return (ref.offset & STRREF_BASE) ? 0 : ref.length;
+}
+
+static void slot_release(int slot) {
+    DocumentMeta *doc = DOC(slot);
+    size_t bytes = arena_bytes(doc->title) + arena_bytes(doc->authors) + arena_bytes(doc->path);
+    arena_live -= bytes;
+    arena_garbage += bytes;
+
+    id_chunks[doc->id >> ID_CHUNK_BITS][doc->id & (ID_CHUNK - 1)] = 0;
+    memset(doc, 0, sizeof(DocumentMeta));
+    live_bits[slot / 64] &= ~(1ULL << (slot % 64));
+    if (grow_array((void **)&free_slots, &free_capacity, free_count + 1, sizeof(int)) == 0)
+        free_slots[free_count++] = slot;
+    while (slot_high > 0 && !slot_is_live(slot_high - 1)) slot_high--;
+}
+
+static int slot_alloc() {
+    while (free_count > 0) {
+        int slot = free_slots[--free_count];
+        // Entries above slot_high were trimmed away already
+        if (slot < slot_high && !slot_is_live(slot)) return slot;
+    }
+
+    if (slot_high == chunk_count * STORE_CHUNK) {
+        if (grow_array((void **)&chunks, &chunk_capacity, chunk_count + 1, sizeof(DocumentMeta *)) == -1)
+            return -1;
+        DocumentMeta *chunk = calloc(STORE_CHUNK, sizeof(DocumentMeta));
+        unsigned long long *bits = realloc(live_bits, (size_t)(chunk_count + 1) * (STORE_CHUNK / 64) * sizeof(*bits));
+        if (!chunk || !bits) {
+            free(chunk);
+            if (bits) live_bits = bits;
+            return -1;
         }
+        memset(bits + (size_t)chunk_count * (STORE_CHUNK / 64), 0, (STORE_CHUNK / 64) * sizeof(*bits));
+        live_bits = bits;
+        chunks[chunk_count++] = chunk;
     }
+    return slot_high++;
+}
 
-    if (debug_mode) printf("[CACHE] MISS: ID %d\n", id);
-    cache_misses++;
+static StrRef arena_store(const char *text) {
+    StrRef ref = {0, 0};
+    size_t len = strlen(text);
+    if (len == 0 || len >= ARENA_CHUNK) return ref;
+
+    if (arena_chunks == 0 || arena_used + len + 1 > ARENA_CHUNK) {
+        if (grow_array((void **)&arena, &arena_capacity, arena_chunks + 1, sizeof(char *)) == -1) return ref;
+        char *chunk = malloc(ARENA_CHUNK);
+        if (!chunk) return ref;
+        arena[arena_chunks++] = chunk;
+        arena_used = 0;
+    }
+
+    char *dst = arena[arena_chunks - 1] + arena_used;
+    memcpy(dst, text, len + 1);
+    ref.offset = ((unsigned int)(arena_chunks - 1) << ARENA_CHUNK_BITS) | arena_used;
+    ref.length = len;
+    arena_used += len + 1;
+    arena_live += len;
+    return ref;
+}
+
+// A damaged loaded record may hold any ref, so it must end inside its chunk
+static const char *arena_at(char **base, int count, StrRef ref) {
+    size_t off = ref.offset & (ARENA_CHUNK - 1);
+    if (ref.length == 0 || (int)(ref.offset >> ARENA_CHUNK_BITS) >= count || off + ref.length >= ARENA_CHUNK) return "";
+    const char *text = base[ref.offset >> ARENA_CHUNK_BITS] + off;
+    return text[ref.length] == '\0' ? text : "";
+}
+
+const char *index_str(StrRef ref) {
+    if (ref.offset & STRREF_BASE) {
+        size_t off = ref.offset & ~STRREF_BASE;
+        // The heap is not checksummed at load time, so never read past it
+        if (ref.length == 0 || off + ref.length >= base_heap_size || base_heap[off + ref.length] != '\0')
+            return "";
+        return base_heap + off;
+    }
+    return arena_at(arena, arena_chunks, ref);
+}
+
+// Strings that live in the mapped file stay there; only arena strings are moved
+static StrRef arena_move(char **old, int old_count, StrRef ref) {
+    if (ref.offset & STRREF_BASE) return ref;
+    return arena_store(arena_at(old, old_count, ref));
+}
 
-    for (int i = 0; i < doc_count; i++) {
-        if (docs[i].id == id) {
-            cache_add(id, &docs[i]);
-            return &docs[i];
+// Rewrites the live strings into fresh arena chunks, dropping removed documents' bytes
+static void arena_compact() {
+    char **old = arena;
+    int old_count = arena_chunks;
+
+    arena = NULL;
+    arena_chunks = arena_capacity = 0;
+    arena_used = 0;
+    arena_live = arena_garbage = 0;
+
+    for (int i = index_next(0); i != -1; i = index_next(i + 1)) {
+        DocumentMeta *doc = DOC(i);
+        doc->title = arena_move(old, old_count, doc->title);
+        doc->authors = arena_move(old, old_count, doc->authors);
+        doc->path = arena_move(old, old_count, doc->path);
+    }
+
+    for (int i = 0; i < old_count; i++) free(old[i]);
+    free(old);
+    pthread_mutex_lock(&cache_lock);
+    cache_refresh();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Next live slot at or after i, or -1; skips 64 tombstones per step, and records of a
+// loaded file that their id does not lead back to
+int index_next(int i) {
+    if (i < 0) i = 0;
+    while (i < slot_high) {
+        unsigned long long word = live_bits[i / 64] >> (i % 64);
+        if (word) {
+            i += __builtin_ctzll(word);
+            if (i >= slot_high) return -1;
+            if (slot_is_valid(i)) return i;
+            i++;
+            continue;
         }
+        i = (i / 64 + 1) * 64;
     }
+    return -1;
+}
 
-    return NULL;
+int index_needs_compaction() {
+    return slot_high > doc_count || (arena_garbage > ARENA_CHUNK && arena_garbage > arena_live);
+}
+
+// Moves up to max_moves records from the top of the slot range into free holes
+int index_compact_step(int max_moves) {
+    int moves = 0;
+    while (moves < max_moves && free_count > 0) {
+        int hole = free_slots[--free_count];
+        if (hole >= slot_high || slot_is_live(hole)) continue;
+
+        int from = slot_high - 1;
+        if (!slot_is_valid(from)) {
+            // Damaged on disk and unreachable by id: dropped instead of moved
+            memset(DOC(from), 0, sizeof(DocumentMeta));
+            live_bits[from / 64] &= ~(1ULL << (from % 64));
+            while (slot_high > 0 && !slot_is_live(slot_high - 1)) slot_high--;
+            doc_count--;
+            free_slots[free_count++] = hole;
+            continue;
+        }
+        *DOC(hole) = *DOC(from);
+        slot_bind(hole, DOC(from)->id);
+        memset(DOC(from), 0, sizeof(DocumentMeta));
+        live_bits[from / 64] &= ~(1ULL << (from % 64));
+        while (slot_high > 0 && !slot_is_live(slot_high - 1)) slot_high--;
+        moves++;
+    }
+
+    if (moves < max_moves && arena_garbage > ARENA_CHUNK && arena_garbage > arena_live) {
+        arena_compact();
+        moves++;
+    }
+    return moves;
 }
 
 
+// Copies the document into out, since a cache entry can be evicted by another reader
+DocumentMeta* index_query(int id, DocumentMeta *out) {
+    pthread_mutex_lock(&cache_lock);
+    if (cache_state && cache_policy->lookup(cache_state, id)) {
+        int entry = keymap_get(&cache_slots, id);
+        if (debug_mode) printf("[CACHE] HIT: ID %d\n", id);
+        if (cache_trace) fprintf(cache_trace, "%d\n", id);
+        cache_hits++;
+        *out = cache[entry].meta;
+        pthread_mutex_unlock(&cache_lock);
+        return out;
+    }
+
+    if (debug_mode) printf("[CACHE] MISS: ID %d\n", id);
+    cache_misses++;
+
+    int slot = slot_of(id);
+    if (slot != -1) {
+        if (cache_trace) fprintf(cache_trace, "%d\n", id);
+        cache_add(id, DOC(slot));
+        *out = *DOC(slot);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return slot == -1 ? NULL : out;
+}
+
+// One "ID <id>: <title>" line per entry, most valuable first as ranked by the policy.
+// Written to a temporary file and renamed, so a crash never leaves half a snapshot.
 void cache_export_snapshot(const char *filename) {
     if (!filename) return;
-    
-    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    if (fd == -1) {
+
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
         if (debug_mode) perror("[CACHE] Error creating snapshot file");
         return;
     }
 
-    char line[512];
+    pthread_mutex_lock(&cache_lock);
+    int ids[MAX_CACHE];
+    int count = cache_state ? cache_policy->keys(cache_state, ids, MAX_CACHE) : 0;
+    fprintf(fp, "Cache Snapshot - %d entries\n", count);
+    for (int i = 0; i < count; i++) {
+        char title[MAX_TITLE + 1];
+        int entry = keymap_get(&cache_slots, ids[i]);
+        snprintf(title, sizeof(title), "%s", index_str(cache[entry].meta.title));
+        for (char *c = title; *c; c++) {
+            if (*c == '\n' || *c == '\r') *c = ' ';
+        }
+        fprintf(fp, "ID %d: %s\n", ids[i], title);
+    }
+    pthread_mutex_unlock(&cache_lock);
 
-    int header_len = snprintf(line, sizeof(line), "Cache Snapshot - %d entries\n", cache_count);
-    if (write(fd, line, header_len) == -1) {
-        if (debug_mode) perror("[CACHE] Error writing header");
-        close(fd);
+    if (fclose(fp) != 0 || rename(tmp, filename) == -1) {
+        if (debug_mode) perror("[CACHE] Error writing snapshot");
+        unlink(tmp);
         return;
     }
-    
-    for (int i = 0; i < cache_count; i++) {
-        int len = snprintf(line, sizeof(line), "ID %d: %s\n", cache[i].id, cache[i].meta.title);
-        write(fd, line, len);
+    if (debug_mode) printf("[CACHE] Snapshot exportado para %s\n", filename);
+}
+
+// Reads the ids of a snapshot, most valuable first; -1 if there is none
+int cache_snapshot_ids(const char *filename, int *ids, int max) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return -1;
+
+    char line[512];
+    int count = 0;
+    while (count < max && fgets(line, sizeof(line), fp)) {
+        int id;
+        if (sscanf(line, "ID %d:", &id) == 1 && id > 0) ids[count++] = id;
     }
+    fclose(fp);
+    return count;
+}
 
-    close(fd);
-    if (debug_mode) printf("[CACHE] Snapshot exportado para %s\n", filename);
+// Caches a document ahead of any request, without counting a hit or miss. Only fills
+// free slots, and skips ids that no longer exist. The caller holds the index lock.
+int cache_warm(int id) {
+    pthread_mutex_lock(&cache_lock);
+    int slot = slot_of(id);
+    int added = cache_state && cache_count < cache_size && slot != -1 && keymap_get(&cache_slots, id) == -1;
+    if (added) cache_add(id, DOC(slot));
+    pthread_mutex_unlock(&cache_lock);
+    return added;
 }
 
 
-int index_add(const char *title, const char *authors, const char *year, const char *path) {
-    if (doc_count >= MAX_DOCUMENTS) return -1;
+static int store_insert(int id, const char *title, const char *authors, const char *year, const char *path) {
+    if (id <= 0 || slot_of(id) != -1) return -1;
+
+    int slot = slot_alloc();
+    if (slot == -1 || slot_bind(slot, id) == -1) return -1;
+    if (id >= next_id) next_id = id + 1;
+
+    DocumentMeta *doc = DOC(slot);
+    doc->title = arena_store(title);
+    doc->authors = arena_store(authors);
+    doc->path = arena_store(path);
+    strncpy(doc->year, year, MAX_YEAR);
+    doc_count++;
+    return id;
+}
+
+// Stores a document under a given id (WAL replay); the id must be free
+int index_insert(int id, const char *title, const char *authors, const char *year, const char *path) {
+    if (store_insert(id, title, authors, year, path) == -1) return -1;
+
+    char fullpath[512];
+    snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, path);
+    postings_add_document(id, fullpath);
+    return id;
+}
 
-    docs[doc_count].id = next_id++;
+// Adds a document whose metadata and terms were already extracted (bulk ingestion)
+int index_add_prepared(const char *title, const char *authors, const char *year, const char *path,
+                       const DocumentTerms *terms) {
+    int id = store_insert(next_id, title, authors, year, path);
+    if (id != -1) postings_add_terms(id, terms);
+    return id;
+}
+
+// Re-indexes a document whose file changed: same id, year and path, new metadata and
+// terms (read by the caller without holding the index). The record is updated in its
+// slot, so once the id is found nothing can fail and leave the document half removed.
+int index_replace(int id, const char *title, const char *authors, const DocumentTerms *terms) {
+    int slot = slot_of(id);
+    if (slot == -1) return -1;
+
+    postings_remove_document(id);
+    pthread_mutex_lock(&cache_lock);
+    cache_remove(id);
+    pthread_mutex_unlock(&cache_lock);
+
+    DocumentMeta *doc = DOC(slot);
+    size_t bytes = arena_bytes(doc->title) + arena_bytes(doc->authors);
+    arena_live -= bytes;
+    arena_garbage += bytes;
+    doc->title = arena_store(title);
+    doc->authors = arena_store(authors);
+    postings_add_terms(id, terms);
+    return id;
+}
+
+int index_add(const char *title, const char *authors, const char *year, const char *path) {
+    (void)title;
+    (void)authors;
 
     char real_title[MAX_TITLE + 1] = "Desconhecido";
     char real_author[MAX_AUTHORS + 1] = "Desconhecido";
@@ -125,34 +571,303 @@ int index_add(const char *title, const char *authors, const char *year, const ch
     snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, path);
     extract_metadata(fullpath, real_title, sizeof(real_title), real_author, sizeof(real_author));
 
-    strncpy(docs[doc_count].title, real_title, MAX_TITLE);
-    strncpy(docs[doc_count].authors, real_author, MAX_AUTHORS);
-    strncpy(docs[doc_count].year, year, MAX_YEAR);
-    strncpy(docs[doc_count].path, path, MAX_PATH);
+    return index_insert(next_id, real_title, real_author, year, path);
+}
 
-    doc_count++;
-    return docs[doc_count - 1].id;
+// Uncached lookup, for internal use (does not count as a cache hit or miss)
+DocumentMeta* index_lookup(int id) {
+    int slot = slot_of(id);
+    return slot == -1 ? NULL : DOC(slot);
 }
 
 int index_remove(int id) {
-    for (int i = 0; i < doc_count; i++) {
-        if (docs[i].id == id) {
-            for (int j = i; j < doc_count - 1; j++) {
-                docs[j] = docs[j + 1];
-            }
-            doc_count--;
-            return 0;
-        }
+    int slot = slot_of(id);
+    if (slot == -1) return -1;
+
+    postings_remove_document(id);
+    pthread_mutex_lock(&cache_lock);
+    cache_remove(id);
+    pthread_mutex_unlock(&cache_lock);
+    slot_release(slot);
+    doc_count--;
+    return 0;
+}
+
+// Drops every document and releases what the store owns (not the mapped chunks)
+static void store_reset() {
+    for (int i = mapped_chunks; i < chunk_count; i++) free(chunks[i]);
+    for (int i = mapped_id_chunks; i < id_chunk_count; i++) free(id_chunks[i]);
+    for (int i = 0; i < arena_chunks; i++) free(arena[i]);
+    free(chunks);
+    free(id_chunks);
+    free(arena);
+    free(live_bits);
+    free(free_slots);
+    if (base_map) munmap(base_map, base_map_size);
+
+    chunks = NULL;
+    id_chunks = NULL;
+    arena = NULL;
+    live_bits = NULL;
+    free_slots = NULL;
+    base_map = NULL;
+    base_heap = NULL;
+    chunk_count = chunk_capacity = mapped_chunks = 0;
+    id_chunk_count = id_chunk_capacity = mapped_id_chunks = 0;
+    arena_chunks = arena_capacity = 0;
+    arena_used = 0;
+    arena_live = arena_garbage = 0;
+    free_count = free_capacity = 0;
+    base_map_size = base_heap_size = 0;
+    doc_count = slot_high = 0;
+    next_id = 1;
+    fingerprint = 0;
+}
+
+// Points a chunk table at count entries of a mapped array; the partial last chunk is
+// copied so that later appends never write past the end of the mapping.
+static int map_chunks(void ***table, int *table_count, int *table_capacity, char *data,
+                      size_t count, int chunk_entries, size_t entry_size) {
+    int full = count / chunk_entries;
+    int rest = count % chunk_entries;
+    if (grow_array((void **)table, table_capacity, full + 1, sizeof(void *)) == -1) return -1;
+
+    for (int i = 0; i < full; i++) {
+        (*table)[i] = data + (size_t)i * chunk_entries * entry_size;
     }
-    return -1;
+    *table_count = full;
+    if (rest) {
+        void *chunk = calloc(chunk_entries, entry_size);
+        if (!chunk) return -1;
+        memcpy(chunk, data + (size_t)full * chunk_entries * entry_size, rest * entry_size);
+        (*table)[(*table_count)++] = chunk;
+    }
+    return full;
+}
+
+static int header_valid(const IndexFileHeader *h, size_t file_size) {
+    IndexFileHeader copy = *h;
+    copy.header_crc = 0;
+    return memcmp(h->magic, INDEX_MAGIC, 8) == 0 &&
+           h->version == INDEX_VERSION &&
+           h->record_size == sizeof(DocumentMeta) &&
+           h->next_id >= 1 &&
+           h->record_count < (uint32_t)h->next_id &&
+           crc32_update(0, &copy, sizeof(copy)) == h->header_crc &&
+           h->directory_offset >= sizeof(*h) && h->directory_offset % sizeof(int) == 0 &&
+           h->records_offset >= sizeof(*h) && h->records_offset % sizeof(int) == 0 &&
+           h->directory_offset <= file_size && (uint64_t)h->next_id * sizeof(int) <= file_size - h->directory_offset &&
+           h->records_offset <= file_size && (uint64_t)h->record_count * sizeof(DocumentMeta) <= file_size - h->records_offset &&
+           h->heap_offset <= file_size && h->heap_size <= file_size - h->heap_offset &&
+           h->heap_size < STRREF_BASE;
 }
 
+// Maps a binary index; only the header is read here, records are faulted in on use and
+// checked as they are reached (slot_of, index_next, index_str). 0 if the file is missing
+// or its header is damaged, so the caller falls back.
 int index_load(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(IndexFileHeader)) {
+        close(fd);
+        return 0;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    const IndexFileHeader *h = (const IndexFileHeader *)map;
+    if (!header_valid(h, st.st_size)) {
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    store_reset();
+    base_map = map;
+    base_map_size = st.st_size;
+    base_heap = map + h->heap_offset;
+    base_heap_size = h->heap_size;
+    fingerprint = h->payload_crc;
+
+    int rc = map_chunks((void ***)&chunks, &chunk_count, &chunk_capacity, map + h->records_offset,
+                        h->record_count, STORE_CHUNK, sizeof(DocumentMeta));
+    int id_rc = map_chunks((void ***)&id_chunks, &id_chunk_count, &id_chunk_capacity, map + h->directory_offset,
+                           h->next_id, ID_CHUNK, sizeof(int));
+    live_bits = calloc((size_t)(chunk_count ? chunk_count : 1) * (STORE_CHUNK / 64), sizeof(*live_bits));
+    if (rc == -1 || id_rc == -1 || !live_bits) {
+        mapped_chunks = rc < 0 ? 0 : rc;
+        mapped_id_chunks = id_rc < 0 ? 0 : id_rc;
+        store_reset();
+        return 0;
+    }
+    mapped_chunks = rc;
+    mapped_id_chunks = id_rc;
+
+    // Every record in the file is live: tombstones are never written
+    memset(live_bits, 0xff, h->record_count / 64 * sizeof(*live_bits));
+    if (h->record_count % 64) live_bits[h->record_count / 64] = (1ULL << (h->record_count % 64)) - 1;
+
+    doc_count = slot_high = h->record_count;
+    next_id = h->next_id;
+    return 1;
+}
+
+// Buffered writer that checksums everything it writes
+typedef struct {
+    int fd;
+    size_t len;
+    uint32_t crc;
+    int failed;
+    char buf[65536];
+} FileWriter;
+
+static void writer_put(FileWriter *w, const void *data, size_t n) {
+    w->crc = crc32_update(w->crc, data, n);
+    while (n > 0) {
+        if (w->len == sizeof(w->buf)) {
+            if (write(w->fd, w->buf, w->len) != (ssize_t)w->len) w->failed = 1;
+            w->len = 0;
+        }
+        size_t chunk = sizeof(w->buf) - w->len < n ? sizeof(w->buf) - w->len : n;
+        memcpy(w->buf + w->len, data, chunk);
+        w->len += chunk;
+        data = (const char *)data + chunk;
+        n -= chunk;
+    }
+}
+
+static void writer_flush(FileWriter *w) {
+    if (w->len && write(w->fd, w->buf, w->len) != (ssize_t)w->len) w->failed = 1;
+    w->len = 0;
+}
+
+static StrRef heap_ref(const char *text, uint64_t *heap_pos) {
+    StrRef ref = {0, 0};
+    size_t len = strlen(text);
+    if (len == 0) return ref;
+    ref.offset = (unsigned int)*heap_pos | STRREF_BASE;
+    ref.length = len;
+    *heap_pos += len + 1;
+    return ref;
+}
+
+// Writes the binary index to filename.tmp and renames it over filename
+int index_save(const char *filename) {
+    char tmp[512];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", filename) >= (int)sizeof(tmp)) return 0;
+
+    int *directory = calloc(next_id, sizeof(int));
+    FileWriter *w = malloc(sizeof(FileWriter));
+    if (!directory || !w) {
+        free(directory);
+        free(w);
+        return 0;
+    }
+    w->fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (w->fd == -1) {
+        free(directory);
+        free(w);
+        return 0;
+    }
+    w->len = 0;
+    w->crc = 0;
+    w->failed = 0;
+
+    IndexFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INDEX_MAGIC, 8);
+    h.version = INDEX_VERSION;
+    h.record_size = sizeof(DocumentMeta);
+    h.record_count = doc_count;
+    h.next_id = next_id;
+    h.directory_offset = sizeof(h);
+    h.records_offset = (h.directory_offset + (uint64_t)next_id * sizeof(int) + 7) & ~7ULL;
+    h.heap_offset = h.records_offset + (uint64_t)doc_count * sizeof(DocumentMeta);
+
+    // Live records are written densely, so the record at position n has slot n when loaded
+    int n = 0;
+    for (int i = index_next(0); i != -1; i = index_next(i + 1)) {
+        directory[DOC(i)->id] = ++n;
+    }
+
+    lseek(w->fd, sizeof(h), SEEK_SET);
+    writer_put(w, directory, (size_t)next_id * sizeof(int));
+    static const char padding[8] = {0};
+    writer_put(w, padding, h.records_offset - h.directory_offset - (uint64_t)next_id * sizeof(int));
+
+    uint64_t heap_pos = 0;
+    for (int i = index_next(0); i != -1; i = index_next(i + 1)) {
+        DocumentMeta *doc = DOC(i);
+        DocumentMeta rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.id = doc->id;
+        rec.title = heap_ref(index_str(doc->title), &heap_pos);
+        rec.authors = heap_ref(index_str(doc->authors), &heap_pos);
+        rec.path = heap_ref(index_str(doc->path), &heap_pos);
+        memcpy(rec.year, doc->year, sizeof(rec.year));
+        writer_put(w, &rec, sizeof(rec));
+    }
+
+    for (int i = index_next(0); i != -1; i = index_next(i + 1)) {
+        DocumentMeta *doc = DOC(i);
+        const char *fields[3] = { index_str(doc->title), index_str(doc->authors), index_str(doc->path) };
+        for (int f = 0; f < 3; f++) {
+            if (fields[f][0]) writer_put(w, fields[f], strlen(fields[f]) + 1);
+        }
+    }
+    writer_flush(w);
+
+    h.heap_size = heap_pos;
+    h.payload_crc = w->crc;
+    h.header_crc = crc32_update(0, &h, sizeof(h));
+    if (pwrite(w->fd, &h, sizeof(h), 0) != sizeof(h)) w->failed = 1;
+
+    int ok = !w->failed && heap_pos < STRREF_BASE;
+    close(w->fd);
+    free(directory);
+    free(w);
+
+    if (!ok || rename(tmp, filename) == -1) {
+        unlink(tmp);
+        return 0;
+    }
+    fingerprint = h.payload_crc;
+    return 1;
+}
+
+// Checks both checksums of a binary index; 0 if intact
+int index_verify(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(IndexFileHeader)) {
+        close(fd);
+        return -1;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const IndexFileHeader *h = (const IndexFileHeader *)map;
+    int ok = header_valid(h, st.st_size) &&
+             crc32_update(0, map + sizeof(*h), st.st_size - sizeof(*h)) == h->payload_crc;
+    munmap(map, st.st_size);
+    return ok ? 0 : -1;
+}
+
+unsigned int index_fingerprint() {
+    return fingerprint;
+}
+
+// Reads the old pipe-delimited text format ("id|title|authors|year|path")
+int index_import_text(const char *filename) {
     FILE *fp = fopen(filename, "r");
     if (!fp) return 0;
 
-    doc_count = 0;
-    next_id = 1;
+    store_reset();
 
     char line[1024];
     while (fgets(line, sizeof(line), fp)) {
@@ -161,16 +876,18 @@ int index_load(const char *filename) {
 
         if (sscanf(line, "%d|%200[^|]|%200[^|]|%4[^|]|%64[^\n]",
                    &id, title, authors, year, path) == 5) {
+            if (id <= 0 || slot_of(id) != -1) continue;
 
-            docs[doc_count].id = id;
-            strncpy(docs[doc_count].title, title, MAX_TITLE);
-            strncpy(docs[doc_count].authors, authors, MAX_AUTHORS);
-            strncpy(docs[doc_count].year, year, MAX_YEAR);
-            strncpy(docs[doc_count].path, path, MAX_PATH);
+            int slot = slot_alloc();
+            if (slot == -1 || slot_bind(slot, id) == -1) break;
+            DocumentMeta *doc = DOC(slot);
+            doc->title = arena_store(title);
+            doc->authors = arena_store(authors);
+            doc->path = arena_store(path);
+            strncpy(doc->year, year, MAX_YEAR);
 
             if (id >= next_id) next_id = id + 1;
             doc_count++;
-            if (doc_count >= MAX_DOCUMENTS) break;
         }
     }
 
@@ -178,6 +895,36 @@ int index_load(const char *filename) {
     return 1;
 }
 
+int index_export_text(const char *filename) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) return 0;
+
+    char buffer[1024];
+    for (int i = index_next(0); i != -1; i = index_next(i + 1)) {
+        DocumentMeta *doc = DOC(i);
+        int len = snprintf(buffer, sizeof(buffer), "%d|%s|%s|%s|%s\n",
+                           doc->id,
+                           index_str(doc->title),
+                           index_str(doc->authors),
+                           doc->year,
+                           index_str(doc->path));
+        write(fd, buffer, len);
+    }
+
+    close(fd);
+    return 1;
+}
+
+// Re-reads every document into fresh postings (missing or stale postings file)
+void index_rebuild_postings() {
+    postings_clear();
+    for (int i = index_next(0); i != -1; i = index_next(i + 1)) {
+        char fullpath[512];
+        snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, index_str(DOC(i)->path));
+        postings_add_document(DOC(i)->id, fullpath);
+    }
+}
+
 int extract_metadata(const char *filepath, char *title, size_t max_title, char *author, size_t max_author) {
     FILE *fp = fopen(filepath, "r");
     if (!fp) return -1;
@@ -204,34 +951,25 @@ int extract_metadata(const char *filepath, char *title, size_t max_title, char *
     return 0;
 }
 
-int index_save(const char *filename) {
-    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    if (fd == -1) return 0;
-
-    char buffer[1024];
-    for (int i = 0; i < doc_count; i++) {
-        int len = snprintf(buffer, sizeof(buffer), "%d|%s|%s|%s|%s\n",
-                           docs[i].id,
-                           docs[i].title,
-                           docs[i].authors,
-                           docs[i].year,
-                           docs[i].path);
-        write(fd, buffer, len);
-    }
-
-    close(fd);
-    return 1;
-}
-
+// Upper bound of the slot range; index_get returns NULL for removed slots
 int index_total() {
-    return doc_count;
+    return slot_high;
 }
 
 DocumentMeta* index_get(int i) {
-    if (i >= 0 && i < doc_count) return &docs[i];
+    if (i >= 0 && i < slot_high && slot_is_live(i) && slot_is_valid(i)) return DOC(i);
     return NULL;
 }
 
 int index_get_count() {
     return doc_count;
+}
+
+// Bytes held by the document store: record chunks, string arena and lookup tables
+size_t index_memory_bytes() {
+    return (size_t)chunk_count * STORE_CHUNK * sizeof(DocumentMeta)
+         + (size_t)chunk_count * STORE_CHUNK / 8
+         + (size_t)arena_chunks * ARENA_CHUNK
+         + (size_t)id_chunk_count * ID_CHUNK * sizeof(int)
+         + (size_t)free_capacity * sizeof(int);
 }
\ No newline at end of file
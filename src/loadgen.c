@@ -0,0 +1,453 @@
+#include "common.h"
+#include "protocol.h"
+#include "histogram.h"
+#include <pthread.h>
+#include <limits.h>
+
+// Load generator: starts dserver on a synthetic corpus (the files of a dataset folder
+// repeated up to N documents), bulk-indexes it, then runs concurrent closed-loop
+// clients with a weighted mix of -a/-c/-l/-s/-d and reports per-command throughput
+// and latency percentiles, optionally as JSON for regression tracking.
+
+typedef enum { OP_ADD, OP_QUERY, OP_LINE_COUNT, OP_SEARCH, OP_REMOVE, OP_COUNT } Op;
+
+static const char op_letters[OP_COUNT] = { 'a', 'c', 'l', 's', 'd' };
+static const char *op_names[OP_COUNT] = { "add", "query", "line_count", "search", "remove" };
+
+typedef struct {
+    int index;
+    char fifo[256];
+    int reply_fd;
+    int server_fd;
+    unsigned int seed;
+    Histogram latency[OP_COUNT];
+    long errors[OP_COUNT];
+} Client;
+
+static int weights[OP_COUNT] = { 5, 50, 20, 15, 10 };
+static int weight_total = 100;
+static int requests_per_client = 500;
+static double duration = 0;            // seconds; overrides requests_per_client
+static int corpus_size = 1000;
+static const char *keyword = "the";
+static const char *search_hint = "1";  // nr_processes sent with -s
+static int max_id = 0;                 // highest id known to exist (grows with adds)
+static volatile int stop_clients = 0;
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int parse_mix(const char *mix) {
+    int parsed[OP_COUNT] = { 0 };
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", mix);
+
+    char *saveptr;
+    for (char *item = strtok_r(copy, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        char letter;
+        int weight;
+        if (sscanf(item, " %c:%d", &letter, &weight) != 2 || weight < 0) return -1;
+        const char *p = memchr(op_letters, letter, OP_COUNT);
+        if (!p) return -1;
+        parsed[p - op_letters] = weight;
+    }
+
+    weight_total = 0;
+    for (int i = 0; i < OP_COUNT; i++) weight_total += weights[i] = parsed[i];
+    return weight_total > 0 ? 0 : -1;
+}
+
+static Op pick_op(Client *c) {
+    int r = rand_r(&c->seed) % weight_total;
+    for (int i = 0; i < OP_COUNT; i++) {
+        if (r < weights[i]) return (Op)i;
+        r -= weights[i];
+    }
+    return OP_QUERY;
+}
+
+// Sends one request and reads its framed response; -1 on a transport error,
+// 1 if the server answered with an error status
+static int request(Client *c, Message *msg, char *out, size_t out_size) {
+    snprintf(msg->client_fifo, sizeof(msg->client_fifo), "%s", c->fifo);
+    if (write(c->server_fd, msg, sizeof(*msg)) != sizeof(*msg)) return -1;
+
+    char payload[FRAME_PAYLOAD_MAX];
+    FrameHeader frame;
+    ResponseHeader header;
+    size_t used = 0;
+    if (frame_read(c->reply_fd, &frame, &header, sizeof(header)) == -1 || frame.type != FRAME_HEADER) return -1;
+    while (frame_read(c->reply_fd, &frame, payload, sizeof(payload)) == 0) {
+        if (frame.type == FRAME_END) {
+            if (out_size) out[used] = '\0';
+            return header.status == STATUS_OK ? 0 : 1;
+        }
+        if (frame.type != FRAME_DATA) return -1;
+        size_t n = frame.length < out_size - used - 1 ? frame.length : out_size - used - 1;
+        if (out_size && n > 0) {
+            memcpy(out + used, payload, n);
+            used += n;
+        }
+    }
+    return -1;
+}
+
+static void build_request(Client *c, Op op, Message *msg) {
+    int known = __atomic_load_n(&max_id, __ATOMIC_RELAXED);
+    int id = known > 0 ? rand_r(&c->seed) % known + 1 : 1;
+
+    memset(msg, 0, sizeof(*msg));
+    switch (op) {
+        case OP_ADD:
+            msg->command = CMD_ADD;
+            snprintf(msg->args, sizeof(msg->args), "Load %d|loadgen|2024|%d.txt",
+                     c->index, rand_r(&c->seed) % corpus_size + 1);
+            break;
+        case OP_QUERY:
+            msg->command = CMD_QUERY;
+            snprintf(msg->args, sizeof(msg->args), "%d", id);
+            break;
+        case OP_LINE_COUNT:
+            msg->command = CMD_LINE_COUNT;
+            snprintf(msg->args, sizeof(msg->args), "%d|%s", id, keyword);
+            break;
+        case OP_SEARCH:
+            msg->command = CMD_SEARCH;
+            snprintf(msg->args, sizeof(msg->args), "%s|%s", keyword, search_hint);
+            break;
+        default:
+            msg->command = CMD_REMOVE;
+            snprintf(msg->args, sizeof(msg->args), "%d", id);
+            break;
+    }
+}
+
+static void *client_main(void *arg) {
+    Client *c = arg;
+    char response[128];
+    Message msg;
+
+    for (int i = 0; duration > 0 ? !stop_clients : i < requests_per_client; i++) {
+        Op op = pick_op(c);
+        build_request(c, op, &msg);
+
+        double start = now_us();
+        int status = request(c, &msg, response, sizeof(response));
+        histogram_record(&c->latency[op], (uint64_t)(now_us() - start));
+
+        if (status != 0) c->errors[op]++;
+        if (status == -1) break;   // the channel is out of step
+        int id;
+        if (op == OP_ADD && sscanf(response, "Document %d indexed", &id) == 1) {
+            int known = __atomic_load_n(&max_id, __ATOMIC_RELAXED);
+            while (id > known && !__atomic_compare_exchange_n(&max_id, &known, id, 0,
+                                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+        }
+    }
+    return NULL;
+}
+
+static int client_open(Client *c, int index) {
+    c->index = index;
+    c->seed = 0x9e3779b9u * (index + 1);
+    for (int i = 0; i < OP_COUNT; i++) histogram_init(&c->latency[i]);
+    snprintf(c->fifo, sizeof(c->fifo), "/tmp/docindex_%d_%d_fifo", getpid(), index);
+    unlink(c->fifo);
+    if (mkfifo(c->fifo, 0666) == -1) return -1;
+    // Held open for reading and writing, so the server's opens never block and reads never see EOF
+    c->reply_fd = open(c->fifo, O_RDWR);
+    c->server_fd = open(FIFO_SERVER, O_WRONLY);
+    return c->reply_fd == -1 || c->server_fd == -1 ? -1 : 0;
+}
+
+static void client_close(Client *c) {
+    if (c->reply_fd != -1) close(c->reply_fd);
+    if (c->server_fd != -1) close(c->server_fd);
+    unlink(c->fifo);
+}
+
+// ---------- CORPUS AND SERVER ----------
+
+static int write_file(const char *path, const char *data, size_t len) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+    size_t written = fwrite(data, 1, len, fp);
+    return fclose(fp) == 0 && written == len ? 0 : -1;
+}
+
+// Fills workdir/corpus with 1.txt..N.txt, cycling over the dataset's files
+static int make_corpus(const char *dataset, const char *workdir) {
+    char path[PATH_MAX];
+    struct dirent **entries;
+    int n = scandir(dataset, &entries, NULL, alphasort);   // sorted, so runs are comparable
+    if (n == -1) return -1;
+
+    char *contents[256];
+    size_t lengths[256];
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dataset, entries[i]->d_name);
+        free(entries[i]);
+        if (count == 256 || stat(path, &st) == -1 || !S_ISREG(st.st_mode)) continue;
+        FILE *fp = fopen(path, "r");
+        if (!fp) continue;
+        contents[count] = malloc(st.st_size + 1);
+        lengths[count] = contents[count] ? fread(contents[count], 1, st.st_size, fp) : 0;
+        fclose(fp);
+        if (contents[count]) count++;
+    }
+    free(entries);
+    if (count == 0) return -1;
+
+    snprintf(path, sizeof(path), "%s/corpus", workdir);
+    mkdir(path, 0777);
+    int failed = 0;
+    for (int i = 1; i <= corpus_size && !failed; i++) {
+        snprintf(path, sizeof(path), "%s/corpus/%d.txt", workdir, i);
+        failed = write_file(path, contents[(i - 1) % count], lengths[(i - 1) % count]) == -1;
+    }
+    for (int i = 0; i < count; i++) free(contents[i]);
+    return failed ? -1 : 0;
+}
+
+// Removes the index a previous run left in workdir/data
+static void clear_data(const char *workdir) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/data", workdir);
+    DIR *dir = opendir(path);
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/data/%s", workdir, entry->d_name);
+        unlink(path);
+    }
+    closedir(dir);
+}
+
+static pid_t start_server(const char *server, const char *workdir, char **server_args) {
+    char binary[PATH_MAX];
+    if (!realpath(server, binary)) return -1;
+
+    // A reader on the server FIFO means a server is already running
+    int probe = open(FIFO_SERVER, O_WRONLY | O_NONBLOCK);
+    if (probe != -1) {
+        close(probe);
+        fprintf(stderr, "loadgen: a server is already running\n");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        char *argv[16] = { "dserver", "corpus" };
+        int argc = 2;
+        for (int i = 0; server_args[i] && argc < 15; i++) argv[argc++] = server_args[i];
+        argv[argc] = NULL;
+
+        if (chdir(workdir) == -1) _exit(1);
+        int log = open("server.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log == -1) log = open("/dev/null", O_WRONLY);
+        dup2(log, STDOUT_FILENO);
+        dup2(log, STDERR_FILENO);
+        execv(binary, argv);
+        _exit(1);
+    }
+
+    // Ready once it has a reader on its FIFO
+    for (int i = 0; pid > 0 && i < 1000; i++) {
+        probe = open(FIFO_SERVER, O_WRONLY | O_NONBLOCK);
+        if (probe != -1) {
+            close(probe);
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) return -1;
+        usleep(10000);
+    }
+    return -1;
+}
+
+// ---------- REPORT ----------
+
+static void print_row(const char *name, const Histogram *h, long errors, double seconds) {
+    printf("%-11s %8lu %7ld %10.1f %9.1f %9lu %9lu %9lu %9lu\n", name, (unsigned long)h->total, errors,
+           h->total / seconds, histogram_mean(h), (unsigned long)histogram_percentile(h, 50),
+           (unsigned long)histogram_percentile(h, 99), (unsigned long)histogram_percentile(h, 99.9),
+           (unsigned long)(h->total ? h->max : 0));
+}
+
+static void json_command(FILE *fp, const char *name, const Histogram *h, long errors, double seconds, int last) {
+    fprintf(fp, "    \"%s\": {\"count\": %lu, \"errors\": %ld, \"ops_per_s\": %.1f, \"mean_us\": %.1f, "
+                "\"p50_us\": %lu, \"p99_us\": %lu, \"p999_us\": %lu, \"max_us\": %lu, \"histogram\": [",
+            name, (unsigned long)h->total, errors, h->total / seconds, histogram_mean(h),
+            (unsigned long)histogram_percentile(h, 50), (unsigned long)histogram_percentile(h, 99),
+            (unsigned long)histogram_percentile(h, 99.9), (unsigned long)(h->total ? h->max : 0));
+    // Non-empty buckets as [upper bound in us, count]
+    int first = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (!h->counts[i]) continue;
+        fprintf(fp, "%s[%lu, %lu]", first ? "" : ", ", (unsigned long)histogram_bucket_upper(i),
+                (unsigned long)h->counts[i]);
+        first = 0;
+    }
+    fprintf(fp, "]}%s\n", last ? "" : ",");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] [-- dserver options]\n", prog);
+    fprintf(stderr, "  -c clients      concurrent clients (8)\n");
+    fprintf(stderr, "  -n requests     requests per client (500)\n");
+    fprintf(stderr, "  -t seconds      run for a fixed time instead\n");
+    fprintf(stderr, "  -m mix          command weights (a:5,c:50,l:20,s:15,d:10)\n");
+    fprintf(stderr, "  -k keyword      keyword for -l and -s (the)\n");
+    fprintf(stderr, "  -p hint         nr_processes sent with -s (1)\n");
+    fprintf(stderr, "  -N documents    synthetic corpus size (1000)\n");
+    fprintf(stderr, "  -D dataset      folder the corpus is built from (mini_dataset)\n");
+    fprintf(stderr, "  -w workdir      scratch folder for the corpus and index (tmp/loadgen)\n");
+    fprintf(stderr, "  -s dserver      server binary (bin/dserver)\n");
+    fprintf(stderr, "  -j file         also write the results as JSON\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    int clients = 8;
+    const char *mix = "a:5,c:50,l:20,s:15,d:10";
+    const char *dataset = "mini_dataset";
+    const char *workdir = "tmp/loadgen";
+    const char *server = "bin/dserver";
+    const char *json = NULL;
+    char *no_args[] = { NULL };
+    char **server_args = no_args;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            server_args = argv + i + 1;
+            break;
+        }
+        if (argv[i][0] != '-' || !argv[i][1] || argv[i][2] || i + 1 >= argc) usage(argv[0]);
+        const char *value = argv[++i];
+        switch (argv[i - 1][1]) {
+            case 'c': clients = atoi(value); break;
+            case 'n': requests_per_client = atoi(value); break;
+            case 't': duration = atof(value); break;
+            case 'm': mix = value; break;
+            case 'k': keyword = value; break;
+            case 'p': search_hint = value; break;
+            case 'N': corpus_size = atoi(value); break;
+            case 'D': dataset = value; break;
+            case 'w': workdir = value; break;
+            case 's': server = value; break;
+            case 'j': json = value; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (clients <= 0 || requests_per_client <= 0 || corpus_size <= 0 || parse_mix(mix) == -1) usage(argv[0]);
+
+    char path[PATH_MAX];
+    mkdir(workdir, 0777);
+    snprintf(path, sizeof(path), "%s/data", workdir);
+    mkdir(path, 0777);
+    clear_data(workdir);
+    if (make_corpus(dataset, workdir) == -1) {
+        fprintf(stderr, "loadgen: cannot build the corpus from %s in %s\n", dataset, workdir);
+        return EXIT_FAILURE;
+    }
+
+    pid_t server_pid = start_server(server, workdir, server_args);
+    if (server_pid == -1) {
+        fprintf(stderr, "loadgen: cannot start %s\n", server);
+        return EXIT_FAILURE;
+    }
+
+    Client *pool = calloc(clients + 1, sizeof(Client));
+    pthread_t *threads = calloc(clients, sizeof(pthread_t));
+    Client *control = &pool[clients];   // preload and shutdown
+    int failed = !pool || !threads || client_open(control, clients) == -1;
+
+    // Index the whole corpus in one bulk add
+    Message msg;
+    char response[128];
+    memset(&msg, 0, sizeof(msg));
+    msg.command = CMD_BULK_ADD;
+    snprintf(msg.args, sizeof(msg.args), ".|2024");
+    double start = now_us();
+    if (!failed && request(control, &msg, response, sizeof(response)) != 0) failed = 1;
+    max_id = corpus_size;
+    if (!failed) printf("loadgen: %s (%.0f ms)\n", response, (now_us() - start) / 1000);
+
+    int started = 0;
+    if (!failed) {
+        start = now_us();
+        for (; started < clients; started++) {
+            if (client_open(&pool[started], started) == -1 ||
+                pthread_create(&threads[started], NULL, client_main, &pool[started]) != 0) {
+                failed = 1;
+                break;
+            }
+        }
+        if (duration > 0) {
+            usleep((useconds_t)(duration * 1e6));
+            stop_clients = 1;
+        }
+        for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    }
+    double seconds = (now_us() - start) / 1e6;
+
+    // Shut the server down
+    if (pool && control->server_fd > 0) {
+        memset(&msg, 0, sizeof(msg));
+        msg.command = CMD_SHUTDOWN;
+        request(control, &msg, response, sizeof(response));
+    }
+    waitpid(server_pid, NULL, 0);
+
+    Histogram totals;
+    long total_errors = 0;
+    histogram_init(&totals);
+    Histogram merged[OP_COUNT];
+    long errors[OP_COUNT] = { 0 };
+    for (int op = 0; op < OP_COUNT; op++) {
+        histogram_init(&merged[op]);
+        for (int i = 0; i < started; i++) {
+            histogram_merge(&merged[op], &pool[i].latency[op]);
+            errors[op] += pool[i].errors[op];
+        }
+        histogram_merge(&totals, &merged[op]);
+        total_errors += errors[op];
+    }
+
+    printf("loadgen: %d clients, %s, mix %s, %d documents, %.2f s\n", clients,
+           duration > 0 ? "timed" : "closed loop", mix, corpus_size, seconds);
+    printf("%-11s %8s %7s %10s %9s %9s %9s %9s %9s\n", "command", "count", "errors", "ops/s",
+           "mean_us", "p50_us", "p99_us", "p99.9_us", "max_us");
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (merged[op].total) print_row(op_names[op], &merged[op], errors[op], seconds);
+    }
+    print_row("total", &totals, total_errors, seconds);
+
+    if (json) {
+        FILE *fp = fopen(json, "w");
+        if (fp) {
+            fprintf(fp, "{\n  \"clients\": %d,\n  \"mix\": \"%s\",\n  \"documents\": %d,\n  \"seconds\": %.3f,\n"
+                        "  \"commands\": {\n", clients, mix, corpus_size, seconds);
+            for (int op = 0; op < OP_COUNT; op++) {
+                json_command(fp, op_names[op], &merged[op], errors[op], seconds, 0);
+            }
+            json_command(fp, "total", &totals, total_errors, seconds, 1);
+            fprintf(fp, "  }\n}\n");
+            fclose(fp);
+        } else {
+            perror(json);
+        }
+    }
+
+    for (int i = 0; i <= clients && pool; i++) {
+        if (pool[i].fifo[0]) client_close(&pool[i]);
+    }
+    free(pool);
+    free(threads);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,269 @@
+#include "common.h"
+#include "matcher.h"
+#include <sys/mman.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATCHER_X86 1
+#endif
+
+// In-process replacement for "grep -c <fixed string>": counts lines containing the pattern.
+// Candidates are found by comparing the first and last pattern bytes over a whole vector,
+// and only positions where both agree are verified with memcmp.
+
+typedef const char *(*FindFn)(const char *s, size_t n, const char *p, size_t m);
+
+// Characters that make a basic regular expression differ from a fixed string
+int matcher_is_fixed(const char *pattern) {
+    return strpbrk(pattern, ".[]*^$\\\n") == NULL;
+}
+
+static const char *find_scalar(const char *s, size_t n, const char *p, size_t m) {
+    const char *end = s + n;
+    while ((size_t)(end - s) >= m) {
+        const char *c = memchr(s, p[0], end - s - m + 1);
+        if (!c) return NULL;
+        if (c[m - 1] == p[m - 1] && memcmp(c, p, m) == 0) return c;
+        s = c + 1;
+    }
+    return NULL;
+}
+
+#ifdef MATCHER_X86
+static const char *find_sse2(const char *s, size_t n, const char *p, size_t m) {
+    if (n < m) return NULL;
+    const __m128i first = _mm_set1_epi8(p[0]);
+    const __m128i last = _mm_set1_epi8(p[m - 1]);
+    size_t i = 0;
+
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + m - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                            _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (m <= 2 || memcmp(s + i + bit + 1, p + 1, m - 2) == 0) return s + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(s + i, n - i, p, m);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *s, size_t n, const char *p, size_t m) {
+    if (n < m) return NULL;
+    const __m256i first = _mm256_set1_epi8(p[0]);
+    const __m256i last = _mm256_set1_epi8(p[m - 1]);
+    size_t i = 0;
+
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + m - 1));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                                  _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (m <= 2 || memcmp(s + i + bit + 1, p + 1, m - 2) == 0) return s + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_sse2(s + i, n - i, p, m);
+}
+#endif
+
+MatcherImpl matcher_best_impl() {
+#ifdef MATCHER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return MATCHER_AVX2;
+    if (__builtin_cpu_supports("sse2")) return MATCHER_SSE2;
+#endif
+    return MATCHER_SCALAR;
+}
+
+const char *matcher_impl_name(MatcherImpl impl) {
+    switch (impl) {
+        case MATCHER_AVX2: return "avx2";
+        case MATCHER_SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+static FindFn find_for(MatcherImpl impl) {
+#ifdef MATCHER_X86
+    if (impl == MATCHER_AVX2) return find_avx2;
+    if (impl == MATCHER_SSE2) return find_sse2;
+#endif
+    (void)impl;
+    return find_scalar;
+}
+
+long matcher_count_lines_with(MatcherImpl impl, const char *buf, size_t len, const char *pattern, size_t plen) {
+    const char *end = buf + len;
+    long count = 0;
+
+    // Like grep, an empty pattern matches every line, including an unterminated last one
+    if (plen == 0) {
+        for (const char *s = buf; s < end; count++) {
+            const char *nl = memchr(s, '\n', end - s);
+            if (!nl) {
+                count++;
+                break;
+            }
+            s = nl + 1;
+        }
+        return count;
+    }
+
+    FindFn find = find_for(impl);
+    const char *s = buf;
+    while (s < end) {
+        const char *hit = find(s, end - s, pattern, plen);
+        if (!hit) break;
+        count++;
+        // The rest of a matching line cannot add to the count
+        const char *nl = memchr(hit + plen, '\n', end - hit - plen);
+        if (!nl) break;
+        s = nl + 1;
+    }
+    return count;
+}
+
+// Resolved on first use; threads racing here all store the same value
+static MatcherImpl best_impl() {
+    static int best = -1;
+    int impl = __atomic_load_n(&best, __ATOMIC_RELAXED);
+    if (impl == -1) {
+        impl = matcher_best_impl();
+        __atomic_store_n(&best, impl, __ATOMIC_RELAXED);
+    }
+    return (MatcherImpl)impl;
+}
+
+long matcher_count_lines(const char *buf, size_t len, const char *pattern, size_t plen) {
+    return matcher_count_lines_with(best_impl(), buf, len, pattern, plen);
+}
+
+// Maps a whole file for one sequential pass; *data is NULL for an empty file
+static int map_file(const char *filepath, char **data, size_t *size) {
+    int fd = open(filepath, O_RDONLY);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    *data = NULL;
+    *size = st.st_size;
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (*data == MAP_FAILED) return -1;
+    madvise(*data, st.st_size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+int matcher_count_file(const char *filepath, const char *pattern, long *count) {
+    char *data;
+    size_t size;
+    if (map_file(filepath, &data, &size) == -1) return -1;
+
+    *count = data ? matcher_count_lines(data, size, pattern, strlen(pattern)) : 0;
+    if (data) munmap(data, size);
+    return 0;
+}
+
+static int compile(Pattern *p, const char *pattern, int flags) {
+    p->fixed = matcher_is_fixed(pattern);
+    p->text = pattern;
+    p->length = strlen(pattern);
+    if (p->fixed) return 0;
+    // REG_NEWLINE keeps matches inside one line, as grep does
+    return regcomp(&p->regex, pattern, flags | REG_NEWLINE) == 0 ? 0 : -1;
+}
+
+int matcher_compile(Pattern *p, const char *pattern) {
+    return compile(p, pattern, REG_NOSUB);
+}
+
+// Also keeps match offsets, which matcher_file_counts needs to count every occurrence
+int matcher_compile_counting(Pattern *p, const char *pattern) {
+    return compile(p, pattern, 0);
+}
+
+// 1 if some line of the file matches (like "grep -q"), 0 if none, -1 if it cannot be read
+int matcher_file_matches(const Pattern *p, const char *filepath) {
+    char *data;
+    size_t size;
+    if (map_file(filepath, &data, &size) == -1) return -1;
+    if (!data) return 0;  // no lines at all
+
+    int found;
+    if (p->fixed) {
+        found = p->length == 0 || find_for(best_impl())(data, size, p->text, p->length) != NULL;
+    } else {
+        // REG_STARTEND lets regexec work on the mapping, which is not NUL-terminated
+        regmatch_t range = { 0, (regoff_t)size };
+        found = regexec(&p->regex, data, 1, &range, REG_STARTEND) == 0;
+    }
+    munmap(data, size);
+    return found;
+}
+
+// Counts, in one pass over the file, the occurrences of the pattern (non-overlapping,
+// like "grep -o") and the lines holding any (like "grep -c"); the pattern must come from
+// matcher_compile_counting. Returns 1 if there was a match, 0 if not, -1 if unreadable.
+int matcher_file_counts(const Pattern *p, const char *filepath, long *occurrences, long *lines) {
+    char *data;
+    size_t size;
+    *occurrences = *lines = 0;
+    if (map_file(filepath, &data, &size) == -1) return -1;
+    if (!data) return 0;
+
+    const char *end = data + size;
+    const char *line_end = data;   // just past the last line counted
+    if (p->fixed && p->length == 0) {
+        *lines = *occurrences = matcher_count_lines(data, size, "", 0);
+    } else if (p->fixed) {
+        FindFn find = find_for(best_impl());
+        for (const char *s = data; s < end; ) {
+            const char *hit = find(s, end - s, p->text, p->length);
+            if (!hit) break;
+            (*occurrences)++;
+            if (hit >= line_end) {
+                const char *nl = memchr(hit + p->length, '\n', end - hit - p->length);
+                line_end = nl ? nl + 1 : end;
+                (*lines)++;
+            }
+            s = hit + p->length;
+        }
+    } else {
+        for (regoff_t off = 0; off < (regoff_t)size; ) {
+            regmatch_t m = { off, (regoff_t)size };
+            int flags = REG_STARTEND | (off > 0 && data[off - 1] != '\n' ? REG_NOTBOL : 0);
+            if (regexec(&p->regex, data, 1, &m, flags) != 0) break;
+            if (data + m.rm_so >= line_end) {
+                const char *nl = memchr(data + m.rm_so, '\n', size - m.rm_so);
+                line_end = nl ? nl + 1 : end;
+                (*lines)++;
+            }
+            if (m.rm_eo > m.rm_so) {
+                (*occurrences)++;
+                off = m.rm_eo;
+            } else {
+                off = m.rm_eo + 1;   // an empty match only counts its line
+            }
+        }
+    }
+    munmap(data, size);
+    return *lines > 0;
+}
+
+void matcher_free(Pattern *p) {
+    if (!p->fixed) regfree(&p->regex);
+}
@@ -0,0 +1,1274 @@
+#include "common.h"
+#include "postings.h"
+#include "codec.h"
+
+// Inverted index: term dictionary (open addressing) + sorted posting lists of doc ids.
+// Every posting also keeps the term's positions in the document (word ordinals), as a
+// varint frequency followed by varint gaps, packed in one buffer per term.
+// Lists are stored in blocks of up to POSTING_BLOCK postings, each block the id gaps and
+// the byte length of each posting's positions, either bit-packed (codec.c) or as varints,
+// whichever is smaller. A skip entry per block lets a cursor jump past whole blocks.
+// A forward list per document (id -> terms) makes removal touch only its own terms.
+// Documents with the same contents (size and XXH64) share one content record, and only
+// its representative, the lowest id, has postings; the others resolve to it.
+// Words longer than MAX_TERM all go under LONG_WORD, which is not made of term characters
+// and so can never be a real term: a substring search cannot rule those documents out.
+
+#define LONG_WORD "*"
+
+typedef struct {
+    char *text;
+    unsigned int hash;
+    PostingBlock *blocks;            // skip entries, in id order
+    int block_count;
+    int block_capacity;
+    unsigned char *data;             // the encoded blocks, one after the other
+    unsigned int data_length;
+    unsigned int data_capacity;
+    unsigned char *positions;
+    unsigned int positions_length;
+    unsigned int positions_capacity;
+    int count;
+    int max_frequency;               // highest frequency it ever had in a document
+} Term;
+
+typedef struct {
+    int *terms;
+    int count;
+    int capacity;
+    int length;                      // indexed words in the document
+    unsigned char *lines;            // positions that start a new line, as varint gaps
+    int lines_length;
+    FileState state;                 // file version the terms were read from
+    int content;                     // content record index + 1, 0 = none
+} DocTerms;
+
+typedef struct {
+    unsigned long long hash;
+    long long size;
+    int *ids;                        // ascending; ids[0] holds the postings
+    int count;
+    int capacity;
+} Content;
+
+static Term *terms = NULL;
+static int term_count = 0;
+static int term_capacity = 0;
+
+static int *table = NULL;       // term index + 1, 0 = empty slot
+static int table_size = 0;
+
+static DocTerms *forward = NULL;  // indexed by document id
+static int forward_capacity = 0;
+
+static Content *contents = NULL;
+static int content_count = 0;
+static int content_capacity = 0;
+static int *content_table = NULL;   // content index + 1, 0 = empty slot
+static int content_table_size = 0;
+static int alias_count = 0;         // documents resolved to another one's postings
+
+static long total_length = 0;    // words over every indexed document, for the average
+static int length_count = 0;     // documents with at least one word
+static int min_length = 0;       // shortest document seen (a lower bound after removals)
+
+static int is_term_char(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+static char to_lower(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : (char)c;
+}
+
+static unsigned int term_hash(const char *text, int len) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)text[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int grow(void **ptr, int *capacity, int needed, size_t elem_size) {
+    if (needed <= *capacity) return 0;
+    int new_capacity = *capacity ? *capacity : 16;
+    while (new_capacity < needed) new_capacity *= 2;
+    void *p = realloc(*ptr, (size_t)new_capacity * elem_size);
+    if (!p) return -1;
+    memset((char *)p + (size_t)*capacity * elem_size, 0, (size_t)(new_capacity - *capacity) * elem_size);
+    *ptr = p;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static int varint_put(unsigned char *out, unsigned int value) {
+    int n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+static unsigned int varint_get(const unsigned char **p) {
+    unsigned int value = 0;
+    int shift = 0;
+    while (**p & 0x80) {
+        value |= (unsigned int)(*(*p)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    return value | (unsigned int)*(*p)++ << shift;
+}
+
+static int data_reserve(Term *t, unsigned int needed) {
+    if (needed <= t->data_capacity) return 0;
+    unsigned int capacity = t->data_capacity ? t->data_capacity : 16;
+    while (capacity < needed) capacity *= 2;
+    unsigned char *p = realloc(t->data, capacity);
+    if (!p) return -1;
+    t->data = p;
+    t->data_capacity = capacity;
+    return 0;
+}
+
+static int positions_reserve(Term *t, unsigned int needed) {
+    if (needed <= t->positions_capacity) return 0;
+    unsigned int capacity = t->positions_capacity ? t->positions_capacity : 16;
+    while (capacity < needed) capacity *= 2;
+    unsigned char *p = realloc(t->positions, capacity);
+    if (!p) return -1;
+    t->positions = p;
+    t->positions_capacity = capacity;
+    return 0;
+}
+
+static int table_rehash(int new_size) {
+    int *t = calloc(new_size, sizeof(int));
+    if (!t) return -1;
+    for (int i = 0; i < term_count; i++) {
+        int slot = terms[i].hash & (new_size - 1);
+        while (t[slot]) slot = (slot + 1) & (new_size - 1);
+        t[slot] = i + 1;
+    }
+    free(table);
+    table = t;
+    table_size = new_size;
+    return 0;
+}
+
+// Returns the term index, creating the entry when create is set; -1 if absent.
+static int term_find(const char *text, int len, int create) {
+    unsigned int h = term_hash(text, len);
+
+    if (table_size) {
+        int slot = h & (table_size - 1);
+        while (table[slot]) {
+            Term *t = &terms[table[slot] - 1];
+            if (t->hash == h && (int)strlen(t->text) == len && memcmp(t->text, text, len) == 0)
+                return table[slot] - 1;
+            slot = (slot + 1) & (table_size - 1);
+        }
+    }
+    if (!create) return -1;
+
+    if ((term_count + 1) * 2 > table_size && table_rehash(table_size ? table_size * 2 : 1024) == -1)
+        return -1;
+    if (grow((void **)&terms, &term_capacity, term_count + 1, sizeof(Term)) == -1) return -1;
+
+    Term *t = &terms[term_count];
+    t->text = malloc(len + 1);
+    if (!t->text) return -1;
+    memcpy(t->text, text, len);
+    t->text[len] = '\0';
+    t->hash = h;
+    t->blocks = NULL;
+    t->block_count = t->block_capacity = 0;
+    t->data = NULL;
+    t->data_length = t->data_capacity = 0;
+    t->positions = NULL;
+    t->positions_length = t->positions_capacity = 0;
+    t->count = 0;
+    t->max_frequency = 0;
+
+    int slot = h & (table_size - 1);
+    while (table[slot]) slot = (slot + 1) & (table_size - 1);
+    table[slot] = term_count + 1;
+    return term_count++;
+}
+
+static int find_id(const int *ids, int count, int id) {
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ids[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// ---------- BLOCKS ----------
+// A block holds, for each posting, the gap to the previous id (0 for the first, which is
+// in the skip entry) and the byte length of its positions. Bit-packed blocks keep the
+// lengths shifted by one (0, then the length of the posting before), so both decode with
+// a prefix sum; variable-byte blocks are (gap, length) pairs, so the open last block of a
+// list grows by appending a pair.
+
+#define PACK_MIN 16   // smaller blocks are always variable-byte
+
+// First block at or after from whose last id is >= id: doubles the step over the skip
+// entries, then bisects
+static int block_find(const PostingBlock *blocks, int count, int from, int id) {
+    int step = 1, hi = from;
+    while (hi < count && blocks[hi].last < id) {
+        from = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > count) hi = count;
+    while (from < hi) {
+        int mid = from + (hi - from) / 2;
+        if (blocks[mid].last < id) from = mid + 1;
+        else hi = mid;
+    }
+    return from;
+}
+
+// Ids of a block and, unless offsets is NULL, where each one's positions start. A
+// bit-packed block always decodes POSTING_BLOCK values, so both need that much room.
+static void block_decode(const PostingBlock *block, const unsigned char *data, int *ids, unsigned int *offsets) {
+    const unsigned char *p = data + block->data;
+    if (block->packed) {
+        p += codec_decode(p, (unsigned int *)ids);
+        codec_prefix_sum((unsigned int *)ids, block->count, (unsigned int)block->first);
+        if (offsets) {
+            codec_decode(p, offsets);
+            codec_prefix_sum(offsets, block->count, block->positions);
+        }
+        return;
+    }
+    int id = block->first;
+    unsigned int offset = block->positions;
+    for (int i = 0; i < block->count; i++) {
+        id += (int)varint_get(&p);
+        ids[i] = id;
+        if (offsets) offsets[i] = offset;
+        offset += varint_get(&p);
+    }
+}
+
+// Position in a decoded block of the first id >= id
+static int block_search(const int *ids, int from, int count, int id) {
+    while (from < count) {
+        int mid = from + (count - from) / 2;
+        if (ids[mid] < id) from = mid + 1;
+        else count = mid;
+    }
+    return from;
+}
+
+// Where the positions after block b start
+static unsigned int block_end(const Term *t, int b) {
+    return b + 1 < t->block_count ? t->blocks[b + 1].positions : t->positions_length;
+}
+
+// Inserts an empty skip entry at b (its postings are stored with block_store)
+static int block_open(Term *t, int b) {
+    if (grow((void **)&t->blocks, &t->block_capacity, t->block_count + 1, sizeof(PostingBlock)) == -1) return -1;
+    memmove(&t->blocks[b + 1], &t->blocks[b], (size_t)(t->block_count - b) * sizeof(PostingBlock));
+    PostingBlock *block = &t->blocks[b];
+    memset(block, 0, sizeof(*block));
+    block->data = b < t->block_count ? t->blocks[b + 1].data : t->data_length;
+    block->positions = b < t->block_count ? t->blocks[b + 1].positions : t->positions_length;
+    t->block_count++;
+    return 0;
+}
+
+// Re-encodes block b with the given postings (count of them, the last one's positions
+// ending at end), in whichever format is smaller; with count 0 the block is dropped
+static int block_store(Term *t, int b, const int *ids, const unsigned int *offsets, int count, unsigned int end) {
+    unsigned int gaps[POSTING_BLOCK] = { 0 }, lengths[POSTING_BLOCK] = { 0 };
+    unsigned char varints[POSTING_BLOCK * 10], packed[2 * CODEC_MAX_BYTES];
+    size_t varint_length = 0, packed_length = (size_t)-1;
+    for (int i = 0; i < count; i++) {
+        unsigned int length = (i + 1 < count ? offsets[i + 1] : end) - offsets[i];
+        gaps[i] = i ? (unsigned int)(ids[i] - ids[i - 1]) : 0;
+        if (i + 1 < count) lengths[i + 1] = length;
+        varint_length += varint_put(varints + varint_length, gaps[i]);
+        varint_length += varint_put(varints + varint_length, length);
+    }
+    if (count >= PACK_MIN) {
+        packed_length = codec_encode(gaps, packed);
+        packed_length += codec_encode(lengths, packed + packed_length);
+    }
+    int use_packed = packed_length < varint_length;
+    const unsigned char *bytes = use_packed ? packed : varints;
+    unsigned int length = (unsigned int)(use_packed ? packed_length : varint_length);
+
+    unsigned int start = t->blocks[b].data;
+    unsigned int old_end = b + 1 < t->block_count ? t->blocks[b + 1].data : t->data_length;
+    if (data_reserve(t, t->data_length - (old_end - start) + length) == -1) return -1;
+    memmove(t->data + start + length, t->data + old_end, t->data_length - old_end);
+    memcpy(t->data + start, bytes, length);
+    t->data_length = t->data_length - (old_end - start) + length;
+    for (int j = b + 1; j < t->block_count; j++) t->blocks[j].data = t->blocks[j].data - (old_end - start) + length;
+
+    if (count == 0) {
+        memmove(&t->blocks[b], &t->blocks[b + 1], (size_t)(t->block_count - b - 1) * sizeof(PostingBlock));
+        t->block_count--;
+        return 0;
+    }
+    PostingBlock *block = &t->blocks[b];
+    block->first = ids[0];
+    block->last = ids[count - 1];
+    block->positions = offsets[0];
+    block->count = (unsigned short)count;
+    block->packed = (unsigned char)use_packed;
+    return 0;
+}
+
+// Byte range of a document's positions in a term; 0 if it has no posting there
+static int posting_run(const Term *t, int id, unsigned int *start, unsigned int *end) {
+    int ids[POSTING_BLOCK];
+    unsigned int offsets[POSTING_BLOCK];
+    int b = block_find(t->blocks, t->block_count, 0, id);
+    if (b == t->block_count || t->blocks[b].first > id) return 0;
+    block_decode(&t->blocks[b], t->data, ids, offsets);
+    int k = block_search(ids, 0, t->blocks[b].count, id);
+    if (k == t->blocks[b].count || ids[k] != id) return 0;
+    *start = offsets[k];
+    *end = k + 1 < t->blocks[b].count ? offsets[k + 1] : block_end(t, b);
+    return 1;
+}
+
+// Adds a posting with its encoded positions (run)
+static int posting_insert(int term, int id, const unsigned char *run, unsigned int run_length) {
+    Term *t = &terms[term];
+    int b = t->block_count - 1;
+    if (b >= 0 && t->blocks[b].last >= id) b = block_find(t->blocks, t->block_count, 0, id);
+    if (positions_reserve(t, t->positions_length + run_length) == -1) return -1;
+
+    if (b == -1 || (id > t->blocks[b].last && t->blocks[b].count == POSTING_BLOCK)) {
+        // A new last block
+        unsigned int at = t->positions_length;
+        memcpy(t->positions + at, run, run_length);
+        t->positions_length += run_length;
+        if (block_open(t, t->block_count) == -1 ||
+            block_store(t, t->block_count - 1, &id, &at, 1, t->positions_length) == -1) return -1;
+    } else if (id > t->blocks[b].last && !t->blocks[b].packed) {
+        // Documents are normally indexed in id order, so this is an append to the open
+        // last block; it is re-encoded (maybe bit-packed) once it is full
+        if (data_reserve(t, t->data_length + 10) == -1) return -1;
+        memcpy(t->positions + t->positions_length, run, run_length);
+        t->positions_length += run_length;
+        PostingBlock *block = &t->blocks[b];
+        t->data_length += varint_put(t->data + t->data_length, (unsigned int)(id - block->last));
+        t->data_length += varint_put(t->data + t->data_length, run_length);
+        block->last = id;
+        if (++block->count == POSTING_BLOCK) {
+            int ids[POSTING_BLOCK];
+            unsigned int offsets[POSTING_BLOCK];
+            block_decode(block, t->data, ids, offsets);
+            if (block_store(t, b, ids, offsets, POSTING_BLOCK, t->positions_length) == -1) return -1;
+        }
+    } else {
+        int ids[POSTING_BLOCK + 1];
+        unsigned int offsets[POSTING_BLOCK + 1];
+        int count = t->blocks[b].count;
+        unsigned int end = block_end(t, b);
+        block_decode(&t->blocks[b], t->data, ids, offsets);
+        int k = block_search(ids, 0, count, id);
+        if (k < count && ids[k] == id) return 0;
+
+        unsigned int at = k < count ? offsets[k] : end;
+        memmove(t->positions + at + run_length, t->positions + at, t->positions_length - at);
+        memcpy(t->positions + at, run, run_length);
+        t->positions_length += run_length;
+        for (int j = b + 1; j < t->block_count; j++) t->blocks[j].positions += run_length;
+
+        memmove(&ids[k + 1], &ids[k], (size_t)(count - k) * sizeof(int));
+        memmove(&offsets[k + 1], &offsets[k], (size_t)(count - k) * sizeof(unsigned int));
+        ids[k] = id;
+        offsets[k] = at;
+        for (int i = k + 1; i <= count; i++) offsets[i] += run_length;
+        count++;
+        end += run_length;
+
+        // A full block spills its last posting into a block of its own
+        if (count <= POSTING_BLOCK) {
+            if (block_store(t, b, ids, offsets, count, end) == -1) return -1;
+        } else if (block_open(t, b + 1) == -1 ||
+                   block_store(t, b, ids, offsets, POSTING_BLOCK, offsets[POSTING_BLOCK]) == -1 ||
+                   block_store(t, b + 1, &ids[POSTING_BLOCK], &offsets[POSTING_BLOCK], 1, end) == -1) {
+            return -1;
+        }
+    }
+    t->count++;
+
+    const unsigned char *p = run;
+    int frequency = (int)varint_get(&p);
+    if (frequency > t->max_frequency) t->max_frequency = frequency;
+
+    if (grow((void **)&forward, &forward_capacity, id + 1, sizeof(DocTerms)) == -1) return -1;
+    DocTerms *d = &forward[id];
+    if (grow((void **)&d->terms, &d->capacity, d->count + 1, sizeof(int)) == -1) return -1;
+    d->terms[d->count++] = term;
+    if (strcmp(t->text, LONG_WORD) != 0) d->length += frequency;   // lengths count indexed words
+    return 1;
+}
+
+// Removes a document's posting with its positions, merging its block into the next one
+// when both fit in one
+static void posting_delete(Term *t, int id) {
+    int ids[POSTING_BLOCK * 2];
+    unsigned int offsets[POSTING_BLOCK * 2];
+    int b = block_find(t->blocks, t->block_count, 0, id);
+    if (b == t->block_count || t->blocks[b].first > id) return;
+    int count = t->blocks[b].count;
+    unsigned int end = block_end(t, b);
+    block_decode(&t->blocks[b], t->data, ids, offsets);
+    int k = block_search(ids, 0, count, id);
+    if (k == count || ids[k] != id) return;
+
+    unsigned int from = offsets[k];
+    unsigned int to = k + 1 < count ? offsets[k + 1] : end;
+    memmove(t->positions + from, t->positions + to, t->positions_length - to);
+    t->positions_length -= to - from;
+    for (int j = b + 1; j < t->block_count; j++) t->blocks[j].positions -= to - from;
+
+    memmove(&ids[k], &ids[k + 1], (size_t)(count - k - 1) * sizeof(int));
+    memmove(&offsets[k], &offsets[k + 1], (size_t)(count - k - 1) * sizeof(unsigned int));
+    count--;
+    for (int i = k; i < count; i++) offsets[i] -= to - from;
+    end -= to - from;
+    t->count--;
+
+    if (count > 0 && b + 1 < t->block_count && count + t->blocks[b + 1].count <= POSTING_BLOCK) {
+        int next = t->blocks[b + 1].count;
+        end = block_end(t, b + 1);
+        block_decode(&t->blocks[b + 1], t->data, &ids[count], &offsets[count]);
+        if (block_store(t, b + 1, NULL, NULL, 0, 0) == -1) return;
+        count += next;
+    }
+    block_store(t, b, ids, offsets, count, end);
+}
+
+// Moves a document's postings to an id that has none (the new representative of its
+// contents); the length statistics are unchanged
+static void postings_rename(int from, int to) {
+    if (grow((void **)&forward, &forward_capacity, to + 1, sizeof(DocTerms)) == -1) return;
+    DocTerms *d = &forward[from];
+
+    for (int i = 0; i < d->count; i++) {
+        Term *t = &terms[d->terms[i]];
+        unsigned int start, end;
+        if (!posting_run(t, from, &start, &end)) continue;
+        unsigned char *run = malloc(end - start);
+        if (!run) continue;
+        memcpy(run, t->positions + start, end - start);
+        posting_delete(t, from);
+        posting_insert(d->terms[i], to, run, end - start);
+        free(run);
+    }
+    forward[to].lines = d->lines;
+    forward[to].lines_length = d->lines_length;
+    free(d->terms);
+    d->terms = NULL;
+    d->lines = NULL;
+    d->count = d->capacity = d->length = d->lines_length = 0;
+}
+
+static unsigned int content_home(unsigned long long hash) {
+    return (unsigned int)(hash ^ (hash >> 32)) & (content_table_size - 1);
+}
+
+static int content_find(const FileState *state) {
+    if (content_table_size == 0) return -1;
+    for (unsigned int pos = content_home(state->hash); content_table[pos]; pos = (pos + 1) & (content_table_size - 1)) {
+        const Content *c = &contents[content_table[pos] - 1];
+        if (c->hash == state->hash && c->size == state->size) return content_table[pos] - 1;
+    }
+    return -1;
+}
+
+static void content_place(int c) {
+    unsigned int pos = content_home(contents[c].hash);
+    while (content_table[pos]) pos = (pos + 1) & (content_table_size - 1);
+    content_table[pos] = c + 1;
+}
+
+static int content_rehash(int size) {
+    int *table = calloc(size, sizeof(int));
+    if (!table) return -1;
+    free(content_table);
+    content_table = table;
+    content_table_size = size;
+    for (int c = 0; c < content_count; c++) content_place(c);
+    return 0;
+}
+
+static unsigned int content_slot(int c) {
+    unsigned int pos = content_home(contents[c].hash);
+    while (content_table[pos] != c + 1) pos = (pos + 1) & (content_table_size - 1);
+    return pos;
+}
+
+// Drops an empty content record (no tombstones: later entries shift back); the last
+// record moves into its place
+static void content_delete(int c) {
+    unsigned int mask = content_table_size - 1;
+    unsigned int hole = content_slot(c), pos = hole;
+    for (;;) {
+        pos = (pos + 1) & mask;
+        if (!content_table[pos]) break;
+        unsigned int home = content_home(contents[content_table[pos] - 1].hash);
+        if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+            content_table[hole] = content_table[pos];
+            hole = pos;
+        }
+    }
+    content_table[hole] = 0;
+
+    free(contents[c].ids);
+    int last = --content_count;
+    if (c != last) {
+        content_table[content_slot(last)] = c + 1;
+        contents[c] = contents[last];
+        for (int i = 0; i < contents[c].count; i++) forward[contents[c].ids[i]].content = c + 1;
+    }
+}
+
+// Adds a document to the record of its contents, creating it if they are new; returns
+// the record, or -1 if out of memory
+static int content_join(int id, const FileState *state) {
+    if (grow((void **)&forward, &forward_capacity, id + 1, sizeof(DocTerms)) == -1) return -1;
+    int c = content_find(state);
+    if (c == -1) {
+        if ((content_count + 1) * 2 > content_table_size &&
+            content_rehash(content_table_size ? content_table_size * 2 : 1024) == -1)
+            return -1;
+        if (grow((void **)&contents, &content_capacity, content_count + 1, sizeof(Content)) == -1) return -1;
+        c = content_count++;
+        contents[c] = (Content){ state->hash, state->size, NULL, 0, 0 };
+        content_place(c);
+    }
+
+    Content *ct = &contents[c];
+    if (grow((void **)&ct->ids, &ct->capacity, ct->count + 1, sizeof(int)) == -1) {
+        if (ct->count == 0) content_delete(c);
+        return -1;
+    }
+    int pos = find_id(ct->ids, ct->count, id);
+    memmove(&ct->ids[pos + 1], &ct->ids[pos], (size_t)(ct->count - pos) * sizeof(int));
+    ct->ids[pos] = id;
+    ct->count++;
+    forward[id].content = c + 1;
+    if (ct->count > 1) alias_count++;
+    return c;
+}
+
+// The document whose postings stand for this one's contents
+static int content_representative(int id) {
+    int c = id > 0 && id < forward_capacity ? forward[id].content : 0;
+    return c ? contents[c - 1].ids[0] : id;
+}
+
+// Counts a document whose postings are all in place towards the length statistics
+static void length_add(int id) {
+    if (id >= forward_capacity || forward[id].length == 0) return;
+    total_length += forward[id].length;
+    length_count++;
+    if (min_length == 0 || forward[id].length < min_length) min_length = forward[id].length;
+}
+
+// Returns the term's index in d, adding it if it is new; -1 if out of memory
+static int terms_add(DocumentTerms *d, const char *token, int len) {
+    unsigned int h = term_hash(token, len);
+
+    if ((d->count + 1) * 2 > d->table_size) {
+        int size = d->table_size ? d->table_size * 2 : 256;
+        int *t = calloc(size, sizeof(int));
+        int *offsets = realloc(d->offsets, (size_t)(size / 2) * sizeof(int));
+        if (!t || !offsets) {
+            free(t);
+            if (offsets) d->offsets = offsets;
+            return -1;
+        }
+        d->offsets = offsets;
+        for (int i = 0; i < d->table_size; i++) {
+            if (!d->table[i]) continue;
+            const char *text = d->text + d->offsets[d->table[i] - 1];
+            int slot = term_hash(text, strlen(text)) & (size - 1);
+            while (t[slot]) slot = (slot + 1) & (size - 1);
+            t[slot] = d->table[i];
+        }
+        free(d->table);
+        d->table = t;
+        d->table_size = size;
+    }
+
+    int slot = h & (d->table_size - 1);
+    while (d->table[slot]) {
+        const char *text = d->text + d->offsets[d->table[slot] - 1];
+        if (strncmp(text, token, len) == 0 && text[len] == '\0') return d->table[slot] - 1;
+        slot = (slot + 1) & (d->table_size - 1);
+    }
+
+    if (d->length + len + 1 > d->capacity) {
+        size_t capacity = d->capacity ? d->capacity : 4096;
+        while (d->length + len + 1 > capacity) capacity *= 2;
+        char *text = realloc(d->text, capacity);
+        if (!text) return -1;
+        d->text = text;
+        d->capacity = capacity;
+    }
+    memcpy(d->text + d->length, token, len);
+    d->text[d->length + len] = '\0';
+    d->offsets[d->count] = (int)d->length;
+    d->table[slot] = d->count + 1;
+    d->length += len + 1;
+    return d->count++;
+}
+
+static void tokens_add(DocumentTerms *d, int term) {
+    if (grow((void **)&d->tokens, &d->token_capacity, d->token_count + 1, sizeof(int)) == 0)
+        d->tokens[d->token_count++] = term;
+}
+
+static void breaks_add(DocumentTerms *d) {
+    if (grow((void **)&d->breaks, &d->break_capacity, d->break_count + 1, sizeof(int)) == 0)
+        d->breaks[d->break_count++] = d->token_count;
+}
+
+// Collects the distinct terms of a file, the term at each position and the positions
+// that start a line. Touches nothing shared, so documents can be tokenized in parallel
+// and merged with postings_add_terms. A word longer than MAX_TERM takes a position under
+// LONG_WORD.
+int postings_tokenize(const char *filepath, DocumentTerms *out) {
+    memset(out, 0, sizeof(*out));
+    int fd = open(filepath, O_RDONLY);
+    if (fd == -1) return -1;
+
+    // Stat before reading: a write that lands mid-read leaves a newer mtime behind
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        out->state.size = st.st_size;
+        out->state.mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    }
+    Xxh64 hash;
+    xxh64_init(&hash, 0);
+
+    char buf[65536];
+    char token[MAX_TERM];
+    int len = 0, too_long = 0, new_line = 0;
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        xxh64_update(&hash, buf, n);
+        for (ssize_t i = 0; i < n; i++) {
+            unsigned char c = buf[i];
+            if (is_term_char(c)) {
+                if (len == 0 && !too_long && new_line) {
+                    breaks_add(out);
+                    new_line = 0;
+                }
+                if (len < MAX_TERM) token[len++] = to_lower(c);
+                else too_long = 1;
+            } else if (len > 0) {
+                tokens_add(out, too_long ? terms_add(out, LONG_WORD, 1) : terms_add(out, token, len));
+                len = 0;
+                too_long = 0;
+            }
+            if (c == '\n') new_line = 1;
+        }
+    }
+    if (len > 0) tokens_add(out, too_long ? terms_add(out, LONG_WORD, 1) : terms_add(out, token, len));
+    out->state.hash = xxh64_digest(&hash);
+
+    close(fd);
+    return 0;
+}
+
+int postings_add_terms(int id, const DocumentTerms *d) {
+    if (id <= 0) return -1;
+
+    // Contents already indexed under another id: share its postings, handing them to
+    // this id if it is the lower one
+    int c = d->state.mtime_ns ? content_join(id, &d->state) : -1;
+    if (c != -1 && contents[c].count > 1) {
+        if (contents[c].ids[0] == id) postings_rename(contents[c].ids[1], id);
+        forward[id].state = d->state;
+        return 0;
+    }
+
+    // Groups the positions by term (counting sort), so each term's come out ascending
+    int *start = calloc((size_t)d->count + 1, sizeof(int));
+    int *order = malloc(((size_t)d->token_count + 1) * sizeof(int));
+    unsigned char *run = malloc(((size_t)d->token_count + 1) * 5 + 5);
+    if (!start || !order || !run) {
+        free(start);
+        free(order);
+        free(run);
+        return -1;
+    }
+    for (int i = 0; i < d->token_count; i++) {
+        if (d->tokens[i] >= 0) start[d->tokens[i] + 1]++;
+    }
+    for (int k = 0; k < d->count; k++) start[k + 1] += start[k];
+    for (int i = 0; i < d->token_count; i++) {
+        if (d->tokens[i] >= 0) order[start[d->tokens[i]]++] = i;
+    }
+    // start[k] now holds the end of term k's positions
+
+    for (int k = 0, from = 0; k < d->count; from = start[k++]) {
+        int len = varint_put(run, start[k] - from);
+        for (int i = from, last = 0; i < start[k]; last = order[i++]) len += varint_put(run + len, order[i] - last);
+
+        const char *text = d->text + d->offsets[k];
+        int term = term_find(text, strlen(text), 1);
+        if (term >= 0) posting_insert(term, id, run, len);
+    }
+    length_add(id);
+    postings_set_file_state(id, &d->state);
+
+    // Line starts, so matching lines can be counted from positions alone
+    if (d->break_count > 0 && grow((void **)&forward, &forward_capacity, id + 1, sizeof(DocTerms)) == 0) {
+        DocTerms *doc = &forward[id];
+        unsigned char *lines = malloc((size_t)d->break_count * 5);
+        if (lines) {
+            int len = 0;
+            for (int i = 0, last = 0; i < d->break_count; last = d->breaks[i++]) len += varint_put(lines + len, d->breaks[i] - last);
+            free(doc->lines);
+            doc->lines = lines;
+            doc->lines_length = len;
+        }
+    }
+    free(start);
+    free(order);
+    free(run);
+    return 0;
+}
+
+void postings_free_terms(DocumentTerms *d) {
+    free(d->text);
+    free(d->offsets);
+    free(d->table);
+    free(d->tokens);
+    free(d->breaks);
+    memset(d, 0, sizeof(*d));
+}
+
+int postings_add_document(int id, const char *filepath) {
+    if (id <= 0) return -1;
+    DocumentTerms d;
+    if (postings_tokenize(filepath, &d) == -1) return -1;
+    int rc = postings_add_terms(id, &d);
+    postings_free_terms(&d);
+    return rc;
+}
+
+void postings_remove_document(int id) {
+    if (id <= 0 || id >= forward_capacity) return;
+
+    // Leaves its content record; postings it held for others go to the next lowest id
+    int c = forward[id].content - 1;
+    if (c >= 0) {
+        Content *ct = &contents[c];
+        int pos = find_id(ct->ids, ct->count, id);
+        memmove(&ct->ids[pos], &ct->ids[pos + 1], (size_t)(ct->count - pos - 1) * sizeof(int));
+        ct->count--;
+        forward[id].content = 0;
+        if (ct->count == 0) {
+            content_delete(c);
+        } else {
+            alias_count--;
+            if (pos == 0) postings_rename(id, ct->ids[0]);
+            memset(&forward[id].state, 0, sizeof(FileState));
+            return;
+        }
+    }
+
+    DocTerms *d = &forward[id];
+    for (int i = 0; i < d->count; i++) posting_delete(&terms[d->terms[i]], id);
+    if (d->length > 0) {
+        total_length -= d->length;
+        length_count--;
+    }
+    free(d->terms);
+    free(d->lines);
+    d->terms = NULL;
+    d->lines = NULL;
+    d->count = d->capacity = d->length = d->lines_length = 0;
+    memset(&d->state, 0, sizeof(d->state));
+}
+
+// Documents with the same contents as id, itself included, ascending; 0 if there are
+// none known (its contents were never read)
+int postings_same_content(int id, const int **ids) {
+    int c = id > 0 && id < forward_capacity ? forward[id].content : 0;
+    if (!c) return 0;
+    *ids = contents[c - 1].ids;
+    return contents[c - 1].count;
+}
+
+int postings_content_of(int id) {
+    return content_representative(id);
+}
+
+// Documents that have no postings of their own, because another has their contents
+int postings_alias_count() {
+    return alias_count;
+}
+
+// The file version a document's terms came from; -1 if it is not known
+int postings_file_state(int id, FileState *state) {
+    if (id <= 0 || id >= forward_capacity || forward[id].state.mtime_ns == 0) return -1;
+    *state = forward[id].state;
+    return 0;
+}
+
+// Records a new version of the file whose contents did not change (a touch)
+void postings_set_file_state(int id, const FileState *state) {
+    if (id > 0 && grow((void **)&forward, &forward_capacity, id + 1, sizeof(DocTerms)) == 0)
+        forward[id].state = *state;
+}
+
+// Document frequency of a term (0 if it is unknown)
+int postings_count(const char *term) {
+    int t = term_find(term, strlen(term), 0);
+    return t < 0 ? 0 : terms[t].count;
+}
+
+// A term's ids, ascending, decoded into a new array (caller frees); NULL if out of memory
+int *postings_ids(const char *term, int *count) {
+    int t = term_find(term, strlen(term), 0);
+    int n = t < 0 ? 0 : terms[t].count;
+    int *ids = malloc(((size_t)n + POSTING_BLOCK) * sizeof(int));
+    *count = 0;
+    if (!ids) return NULL;
+    for (int b = 0; t >= 0 && b < terms[t].block_count; b++) {
+        block_decode(&terms[t].blocks[b], terms[t].data, ids + *count, NULL);
+        *count += terms[t].blocks[b].count;
+    }
+    return ids;
+}
+
+static void list_open(const Term *t, PostingList *list) {
+    list->blocks = t->blocks;
+    list->data = t->data;
+    list->positions = t->positions;
+    list->block_count = t->block_count;
+    list->count = t->count;
+    list->max_frequency = t->max_frequency;
+    list->block = list->index = 0;
+    list->id = -1;
+    if (t->block_count > 0) {
+        block_decode(&t->blocks[0], t->data, list->ids, list->offsets);
+        list->id = list->ids[0];
+    }
+}
+
+// Opens a term's posting list at its first posting; returns its document frequency
+// (0 if the term is unknown).
+int postings_list(const char *term, PostingList *list) {
+    int t = term_find(term, strlen(term), 0);
+    if (t < 0) {
+        memset(list, 0, offsetof(PostingList, ids));
+        list->id = -1;
+        return 0;
+    }
+    list_open(&terms[t], list);
+    return list->count;
+}
+
+static int list_load(PostingList *list, int b) {
+    list->block = b;
+    list->index = 0;
+    if (b == list->block_count) return list->id = -1;
+    block_decode(&list->blocks[b], list->data, list->ids, list->offsets);
+    return list->id = list->ids[0];
+}
+
+// Moves to the next posting; returns its id, -1 past the end
+int postings_next(PostingList *list) {
+    if (list->id == -1) return -1;
+    if (++list->index < list->blocks[list->block].count) return list->id = list->ids[list->index];
+    return list_load(list, list->block + 1);
+}
+
+// Moves to the first posting whose id is >= target (never backwards); returns its id,
+// -1 past the end. Blocks that end before target are skipped without being decoded.
+int postings_advance(PostingList *list, int target) {
+    if (list->id == -1 || list->id >= target) return list->id;
+    if (list->blocks[list->block].last < target) {
+        int b = block_find(list->blocks, list->block_count, list->block + 1, target);
+        if (list_load(list, b) == -1 || list->id >= target) return list->id;
+    }
+    list->index = block_search(list->ids, list->index, list->blocks[list->block].count, target);
+    return list->id = list->ids[list->index];
+}
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Documents that can contain a keyword of term characters (given lowercased) as a
+// substring: such a keyword only ever occurs inside one word, so they are the documents
+// with a term that contains it, and those with a word too long to have been indexed.
+// Every id sharing their contents is included. Ascending, in a new array (caller frees);
+// NULL if out of memory.
+int *postings_candidates(const char *keyword, int *count) {
+    int *ids = NULL, capacity = 0, n = 0;
+    *count = 0;
+    for (int i = 0; i < term_count; i++) {
+        Term *t = &terms[i];
+        if (t->count == 0 || (!strstr(t->text, keyword) && strcmp(t->text, LONG_WORD) != 0)) continue;
+        if (grow((void **)&ids, &capacity, n + t->count + POSTING_BLOCK, sizeof(int)) == -1) {
+            free(ids);
+            return NULL;
+        }
+        for (int b = 0; b < t->block_count; b++) {
+            block_decode(&t->blocks[b], t->data, ids + n, NULL);
+            n += t->blocks[b].count;
+        }
+    }
+    if (n == 0) return malloc(sizeof(int));
+    qsort(ids, n, sizeof(int), compare_ints);
+
+    // Only representatives have postings: bring in the documents that resolve to them
+    int distinct = 0;
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || ids[i] != ids[i - 1]) ids[distinct++] = ids[i];
+    }
+    n = distinct;
+    for (int i = 0; i < distinct; i++) {
+        const int *same;
+        int shared = postings_same_content(ids[i], &same);
+        for (int j = 0; j < shared; j++) {
+            if (same[j] == ids[i]) continue;
+            if (grow((void **)&ids, &capacity, n + 1, sizeof(int)) == -1) {
+                free(ids);
+                return NULL;
+            }
+            ids[n++] = same[j];
+        }
+    }
+    if (n > distinct) qsort(ids, n, sizeof(int), compare_ints);
+    *count = n;
+    return ids;
+}
+
+// How many times the term occurs in the document at the cursor
+int postings_frequency(const PostingList *list) {
+    const unsigned char *p = list->positions + list->offsets[list->index];
+    return (int)varint_get(&p);
+}
+
+int postings_document_length(int id) {
+    id = content_representative(id);
+    return id > 0 && id < forward_capacity ? forward[id].length : 0;
+}
+
+// Distinct lines among positions of the document (ascending)
+int postings_count_lines(int id, const int *positions, int count) {
+    const unsigned char *p = NULL, *end = NULL;
+    id = content_representative(id);
+    if (id > 0 && id < forward_capacity && forward[id].lines) {
+        p = forward[id].lines;
+        end = p + forward[id].lines_length;
+    }
+    int next_break = p < end ? (int)varint_get(&p) : -1;
+    int line = 0, last_line = -1, lines = 0;
+    for (int i = 0; i < count; i++) {
+        while (next_break != -1 && positions[i] >= next_break) {
+            line++;
+            next_break = p < end ? next_break + (int)varint_get(&p) : -1;
+        }
+        if (line != last_line) {
+            lines++;
+            last_line = line;
+        }
+    }
+    return lines;
+}
+
+// Average and minimum document length, over the documents holding any word
+void postings_length_stats(double *average, int *minimum) {
+    *average = length_count ? (double)total_length / length_count : 0;
+    *minimum = min_length;
+}
+
+// Opens the positions of a term in a document; returns the term frequency (0 if absent).
+// The cursor reads the index in place, so it is valid while the index lock is held.
+int postings_positions(const char *term, int id, PositionCursor *cursor) {
+    cursor->left = 0;
+    id = content_representative(id);
+    int t = term_find(term, strlen(term), 0);
+    unsigned int start, end;
+    if (t < 0 || !posting_run(&terms[t], id, &start, &end)) return 0;
+
+    cursor->p = terms[t].positions + start;
+    cursor->left = (int)varint_get(&cursor->p);
+    cursor->last = 0;
+    return cursor->left;
+}
+
+// Opens the positions of the posting at a list's cursor; returns the term frequency
+int postings_list_positions(const PostingList *list, PositionCursor *cursor) {
+    cursor->p = list->positions + list->offsets[list->index];
+    cursor->left = (int)varint_get(&cursor->p);
+    cursor->last = 0;
+    return cursor->left;
+}
+
+// Next position in ascending order, or -1 when there are no more
+int postings_next_position(PositionCursor *cursor) {
+    if (cursor->left == 0) return -1;
+    cursor->left--;
+    cursor->last += (int)varint_get(&cursor->p);
+    return cursor->last;
+}
+
+// Splits text into terms the way documents are tokenized, as NUL-separated strings;
+// returns how many, or -1 if they don't fit or one is too long
+int postings_split(const char *text, char *out, size_t max_out) {
+    size_t used = 0;
+    int count = 0, len = 0;
+    for (const char *p = text; ; p++) {
+        if (*p && is_term_char((unsigned char)*p)) {
+            if (len == MAX_TERM || used + 1 >= max_out) return -1;
+            out[used++] = to_lower((unsigned char)*p);
+            len++;
+            continue;
+        }
+        if (len > 0) {
+            out[used++] = '\0';
+            count++;
+            len = 0;
+        }
+        if (!*p) return count;
+    }
+}
+
+// Normalizes a keyword into a single term; -1 if it is not exactly one term.
+int postings_normalize(const char *keyword, char *term, size_t max_term) {
+    size_t len = strlen(keyword);
+    if (len == 0 || len > MAX_TERM || len >= max_term) return -1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (!is_term_char((unsigned char)keyword[i])) return -1;
+        term[i] = to_lower((unsigned char)keyword[i]);
+    }
+    term[len] = '\0';
+    return 0;
+}
+
+int postings_term_count() {
+    return term_count;
+}
+
+// Bytes held by the dictionary, the posting lists (with positions) and the forward lists
+size_t postings_memory_bytes() {
+    size_t bytes = (size_t)term_capacity * sizeof(Term) + (size_t)table_size * sizeof(int)
+                 + (size_t)forward_capacity * sizeof(DocTerms);
+    for (int i = 0; i < term_count; i++) {
+        bytes += strlen(terms[i].text) + 1 + (size_t)terms[i].block_capacity * sizeof(PostingBlock)
+               + terms[i].data_capacity + terms[i].positions_capacity;
+    }
+    for (int i = 0; i < forward_capacity; i++) {
+        bytes += (size_t)forward[i].capacity * sizeof(int) + forward[i].lines_length;
+    }
+    bytes += (size_t)content_capacity * sizeof(Content) + (size_t)content_table_size * sizeof(int);
+    for (int i = 0; i < content_count; i++) bytes += (size_t)contents[i].capacity * sizeof(int);
+    return bytes;
+}
+
+void postings_clear() {
+    for (int i = 0; i < term_count; i++) {
+        free(terms[i].text);
+        free(terms[i].blocks);
+        free(terms[i].data);
+        free(terms[i].positions);
+    }
+    for (int i = 0; i < forward_capacity; i++) {
+        free(forward[i].terms);
+        free(forward[i].lines);
+    }
+    for (int i = 0; i < content_count; i++) free(contents[i].ids);
+    free(terms);
+    free(table);
+    free(forward);
+    free(contents);
+    free(content_table);
+    terms = NULL;
+    table = NULL;
+    forward = NULL;
+    contents = NULL;
+    content_table = NULL;
+    term_count = term_capacity = table_size = forward_capacity = 0;
+    content_count = content_capacity = content_table_size = alias_count = 0;
+    total_length = 0;
+    length_count = min_length = 0;
+}
+
+// Format: a header identifying the document set, then one "term|id:gaps,id:gaps,..." line
+// per term, where gaps are the term's positions in the document as space-separated deltas,
+// then one "#id|gaps" line per document with the positions that start a line and one
+// "@id|size mtime_ns hash" line per document with the file version it was read from.
+// Documents sharing contents have postings only under the lowest of their ids.
+// Written to a temporary file and renamed, so an interrupted save keeps the previous file.
+int postings_save(const char *filename, int doc_count, unsigned int fingerprint) {
+    char tmp[512];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", filename) >= (int)sizeof(tmp)) return 0;
+
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return 0;
+
+    fprintf(fp, "POSTINGS6 %d %u\n", doc_count, fingerprint);
+    for (int i = 0; i < term_count; i++) {
+        Term *t = &terms[i];
+        if (t->count == 0) continue;
+        fprintf(fp, "%s|", t->text);
+        PostingList list;
+        list_open(t, &list);
+        for (int j = 0; list.id != -1; j++, postings_next(&list)) {
+            const unsigned char *p = t->positions + list.offsets[list.index];
+            unsigned int frequency = varint_get(&p);
+            fprintf(fp, j ? ",%d:" : "%d:", list.id);
+            for (unsigned int k = 0; k < frequency; k++) {
+                fprintf(fp, k ? " %u" : "%u", varint_get(&p));
+            }
+        }
+        fputc('\n', fp);
+    }
+    for (int id = 1; id < forward_capacity; id++) {
+        if (!forward[id].lines) continue;
+        fprintf(fp, "#%d|", id);
+        for (const unsigned char *p = forward[id].lines; p < forward[id].lines + forward[id].lines_length; ) {
+            int first = p == forward[id].lines;
+            fprintf(fp, first ? "%u" : " %u", varint_get(&p));
+        }
+        fputc('\n', fp);
+    }
+    for (int id = 1; id < forward_capacity; id++) {
+        const FileState *st = &forward[id].state;
+        if (st->mtime_ns) fprintf(fp, "@%d|%lld %lld %016llx\n", id, st->size, st->mtime_ns, st->hash);
+    }
+
+    int ok = (fflush(fp) == 0);
+    if (fclose(fp) != 0) ok = 0;
+    if (ok && rename(tmp, filename) == -1) ok = 0;
+    if (!ok) unlink(tmp);
+    return ok;
+}
+
+// Reads a decimal number starting at *c; *c is left on the first character after it
+static unsigned int read_number(FILE *fp, int *c) {
+    unsigned int value = 0;
+    while (*c >= '0' && *c <= '9') {
+        value = value * 10 + (unsigned int)(*c - '0');
+        *c = fgetc(fp);
+    }
+    return value;
+}
+
+// Loads postings only if they were saved for the same document set. Files written
+// before positions, line starts, file versions, shared contents and long words were stored have
+// another header, so the index is rebuilt.
+int postings_load(const char *filename, int doc_count, unsigned int fingerprint) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return 0;
+
+    int saved_count;
+    unsigned int saved_fingerprint;
+    if (fscanf(fp, "POSTINGS6 %d %u\n", &saved_count, &saved_fingerprint) != 2 ||
+        saved_count != doc_count || saved_fingerprint != fingerprint) {
+        fclose(fp);
+        return 0;
+    }
+
+    postings_clear();
+
+    char token[MAX_TERM + 1];
+    unsigned char *run = NULL;
+    size_t run_capacity = 0;
+    int c;
+    while ((c = fgetc(fp)) != EOF) {
+        if (c == '#') {
+            c = fgetc(fp);
+            int id = (int)read_number(fp, &c);
+            if (c == '|' && id > 0 && grow((void **)&forward, &forward_capacity, id + 1, sizeof(DocTerms)) == 0) {
+                DocTerms *d = &forward[id];
+                int capacity = 0;
+                c = fgetc(fp);
+                while (c >= '0' && c <= '9') {
+                    unsigned int gap = read_number(fp, &c);
+                    if (d->lines_length + 5 > capacity) {
+                        int size = capacity ? capacity * 2 : 64;
+                        unsigned char *p = realloc(d->lines, size);
+                        if (!p) break;
+                        d->lines = p;
+                        capacity = size;
+                    }
+                    d->lines_length += varint_put(d->lines + d->lines_length, gap);
+                    if (c == ' ') c = fgetc(fp);
+                }
+            }
+            while (c != '\n' && c != EOF) c = fgetc(fp);
+            continue;
+        }
+        if (c == '@') {
+            int id;
+            FileState st;
+            if (fscanf(fp, "%d|%lld %lld %llx", &id, &st.size, &st.mtime_ns, &st.hash) == 4) postings_set_file_state(id, &st);
+            while (c != '\n' && c != EOF) c = fgetc(fp);
+            continue;
+        }
+        int len = 0;
+        while (c != EOF && c != '|' && c != '\n') {
+            if (len < MAX_TERM) token[len++] = (char)c;
+            c = fgetc(fp);
+        }
+        if (c != '|') continue;
+
+        int term = term_find(token, len, 1);
+        do {
+            c = fgetc(fp);
+            int id = (int)read_number(fp, &c);
+            if (c != ':') break;
+
+            // Frequency goes first, so the gaps are encoded after room for it
+            unsigned int frequency = 0, length = 5;
+            c = fgetc(fp);
+            while (c >= '0' && c <= '9') {
+                unsigned int gap = read_number(fp, &c);
+                if (length + 5 > run_capacity) {
+                    size_t capacity = run_capacity ? run_capacity * 2 : 4096;
+                    unsigned char *p = realloc(run, capacity);
+                    if (!p) break;
+                    run = p;
+                    run_capacity = capacity;
+                }
+                length += varint_put(run + length, gap);
+                frequency++;
+                if (c == ' ') c = fgetc(fp);
+            }
+            if (!run || id <= 0 || term < 0) continue;
+            unsigned char head[5];
+            int head_length = varint_put(head, frequency);
+            memcpy(run + 5 - head_length, head, head_length);
+            posting_insert(term, id, run + 5 - head_length, length - 5 + head_length);
+        } while (c == ',');
+        while (c != '\n' && c != EOF) c = fgetc(fp);
+    }
+
+    // Ascending, so each content record gets the lowest id, the one its postings were saved under
+    for (int id = 1; id < forward_capacity; id++) {
+        if (forward[id].state.mtime_ns) content_join(id, &forward[id].state);
+        length_add(id);
+    }
+    free(run);
+    fclose(fp);
+    return 1;
+}
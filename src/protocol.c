@@ -0,0 +1,122 @@
+#include "common.h"
+#include "protocol.h"
+#include <stdarg.h>
+#include <pthread.h>
+
+int read_full(int fd, void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, (char *)buf + done, len - done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+int write_full(int fd, const void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, (const char *)buf + done, len - done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+// Header and payload go out in one write, so the frame is atomic
+static int frame_write(int fd, FrameType type, uint32_t request_id, const void *payload, size_t len, char *scratch) {
+    FrameHeader h = { type, request_id, (uint32_t)len };
+    memcpy(scratch, &h, sizeof(h));
+    if (payload != scratch + sizeof(h)) memcpy(scratch + sizeof(h), payload, len);
+    return write_full(fd, scratch, sizeof(h) + len);
+}
+
+// Reads one frame; -1 on a closed channel or a malformed frame
+int frame_read(int fd, FrameHeader *header, void *payload, size_t max) {
+    if (read_full(fd, header, sizeof(*header)) == -1) return -1;
+    if (header->length > max) return -1;
+    return read_full(fd, payload, header->length);
+}
+
+// Starts a response on an open FIFO; the caller owns fd and closes it after stream_end
+int stream_begin(ResponseStream *s, int fd, uint32_t request_id, ResponseStatus status, uint64_t total_length) {
+    s->fd = fd;
+    s->failed = 0;
+    s->request_id = request_id;
+    s->sent = 0;
+    s->used = 0;
+    s->ring = NULL;
+    s->chunk = NULL;
+    if (fd == -1) {
+        s->failed = 1;
+        return -1;
+    }
+
+    ResponseHeader rh = { status, 0, total_length };
+    if (frame_write(fd, FRAME_HEADER, request_id, &rh, sizeof(rh), s->frame) == -1) s->failed = 1;
+    return s->failed ? -1 : 0;
+}
+
+// Sends the rest of the response through a shared-memory ring; -1 leaves it on the FIFO
+int stream_use_ring(ResponseStream *s, RingWriter *ring) {
+    if (!ring || s->used > 0 || !(s->chunk = malloc(RING_CHUNK))) return -1;
+    s->ring = ring;
+    return 0;
+}
+
+static void stream_flush(ResponseStream *s) {
+    if (s->used == 0 || s->failed) return;
+    if (s->ring) {
+        // Put and announced under one lock, so RING frames arrive in ring order
+        uint32_t length = s->used;
+        pthread_mutex_lock(&s->ring->lock);
+        if (ring_put(s->ring->shm, s->chunk, s->used) == -1 ||
+            frame_write(s->fd, FRAME_RING, s->request_id, &length, sizeof(length), s->frame) == -1) s->failed = 1;
+        pthread_mutex_unlock(&s->ring->lock);
+    } else if (frame_write(s->fd, FRAME_DATA, s->request_id, s->frame + sizeof(FrameHeader), s->used, s->frame) == -1) {
+        s->failed = 1;
+    }
+    s->used = 0;
+}
+
+int stream_write(ResponseStream *s, const void *data, size_t len) {
+    char *buffer = s->ring ? s->chunk : s->frame + sizeof(FrameHeader);
+    size_t capacity = s->ring ? RING_CHUNK : FRAME_PAYLOAD_MAX;
+    const char *p = data;
+    while (len > 0 && !s->failed) {
+        size_t n = capacity - s->used;
+        if (n > len) n = len;
+        memcpy(buffer + s->used, p, n);
+        s->used += n;
+        s->sent += n;
+        p += n;
+        len -= n;
+        if (s->used == capacity) stream_flush(s);
+    }
+    return s->failed ? -1 : 0;
+}
+
+int stream_printf(ResponseStream *s, const char *fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n < 0) return -1;
+    return stream_write(s, buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+}
+
+// Flushes the last DATA frame and ends the response
+int stream_end(ResponseStream *s) {
+    stream_flush(s);
+    if (!s->failed) {
+        uint64_t total = s->sent;
+        if (frame_write(s->fd, FRAME_END, s->request_id, &total, sizeof(total), s->frame) == -1) s->failed = 1;
+    }
+    free(s->chunk);
+    s->chunk = NULL;
+    s->ring = NULL;
+    return s->failed ? -1 : 0;
+}
@@ -0,0 +1,945 @@
+#include "common.h"
+#include "query.h"
+#include <math.h>
+
+// ---------- PARSER ----------
+// query := or ; or := and ("OR" and)* ; and := unary (["AND"] unary)* ;
+// unary := "NOT" unary | "(" or ")" | term | '"' term* '"'
+
+typedef enum { TOK_END, TOK_TERM, TOK_PHRASE, TOK_AND, TOK_OR, TOK_NOT, TOK_OPEN, TOK_CLOSE, TOK_INVALID } TokenType;
+
+typedef struct {
+    const char *p;
+    TokenType type;
+    char text[MAX_QUERY_TEXT];  // TERM/PHRASE: NUL-separated terms
+    int length;                 // how many
+    int size;                   // bytes used in text
+    int operators;          // operators and parentheses seen, to tell a query from a plain keyword
+    const char *error;
+    Query *query;
+} Parser;
+
+static int is_query_char(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+static void next_token(Parser *ps) {
+    while (*ps->p == ' ' || *ps->p == '\t') ps->p++;
+    if (!*ps->p) {
+        ps->type = TOK_END;
+        return;
+    }
+    if (*ps->p == '(' || *ps->p == ')') {
+        ps->type = *ps->p++ == '(' ? TOK_OPEN : TOK_CLOSE;
+        ps->operators++;
+        return;
+    }
+    if (*ps->p == '"') {
+        // Split like document text; an unterminated quote leaves a plain keyword
+        const char *end = strchr(ps->p + 1, '"');
+        char inner[MAX_QUERY_TEXT];
+        size_t len = end ? (size_t)(end - ps->p - 1) : 0;
+        if (!end || len >= sizeof(inner) || (end[1] && end[1] != ' ' && end[1] != '\t' && end[1] != '(' && end[1] != ')')) {
+            ps->type = TOK_INVALID;
+            return;
+        }
+        memcpy(inner, ps->p + 1, len);
+        inner[len] = '\0';
+        ps->p = end + 1;
+        ps->length = postings_split(inner, ps->text, sizeof(ps->text));
+        if (ps->length == -1) {
+            ps->type = TOK_INVALID;
+            return;
+        }
+        ps->size = 0;
+        for (int i = 0; i < ps->length; i++) ps->size += strlen(ps->text + ps->size) + 1;
+        ps->type = ps->length == 1 ? TOK_TERM : TOK_PHRASE;
+        ps->operators++;
+        return;
+    }
+
+    const char *start = ps->p;
+    while (is_query_char((unsigned char)*ps->p)) ps->p++;
+    size_t len = ps->p - start;
+    if (len == 0 || (*ps->p && *ps->p != ' ' && *ps->p != '\t' && *ps->p != '(' && *ps->p != ')')) {
+        ps->type = TOK_INVALID;
+        return;
+    }
+
+    char word[MAX_TERM + 2];
+    if (len > MAX_TERM) {
+        ps->type = TOK_INVALID;
+        return;
+    }
+    memcpy(word, start, len);
+    word[len] = '\0';
+    if (strcmp(word, "AND") == 0) ps->type = TOK_AND;
+    else if (strcmp(word, "OR") == 0) ps->type = TOK_OR;
+    else if (strcmp(word, "NOT") == 0) ps->type = TOK_NOT;
+    else {
+        ps->type = postings_normalize(word, ps->text, MAX_TERM + 1) == 0 ? TOK_TERM : TOK_INVALID;
+        ps->length = 1;
+        ps->size = strlen(ps->text) + 1;
+        return;
+    }
+    ps->operators++;
+}
+
+static int new_node(Parser *ps, QueryNodeType type, int left, int right) {
+    Query *q = ps->query;
+    if (q->count == MAX_QUERY_NODES) {
+        ps->error = "Error: Query too long";
+        return -1;
+    }
+    QueryNode *node = &q->nodes[q->count];
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    node->text = 0;
+    node->length = 0;
+    return q->count++;
+}
+
+// A term or phrase node holding the current token's terms
+static int text_node(Parser *ps) {
+    Query *q = ps->query;
+    if (ps->length > MAX_PHRASE_TERMS) {
+        ps->error = "Error: Phrase too long in query";
+        return -1;
+    }
+    if (q->text_length + ps->size > MAX_QUERY_TEXT) {
+        ps->error = "Error: Query too long";
+        return -1;
+    }
+    int node = new_node(ps, ps->type == TOK_PHRASE ? QUERY_PHRASE : QUERY_TERM, -1, -1);
+    if (node == -1) return -1;
+    memcpy(q->text + q->text_length, ps->text, ps->size);
+    q->nodes[node].text = q->text_length;
+    q->nodes[node].length = ps->length;
+    q->text_length += ps->size;
+    return node;
+}
+
+static int parse_or(Parser *ps);
+
+static int parse_unary(Parser *ps) {
+    if (ps->type == TOK_NOT) {
+        next_token(ps);
+        int child = parse_unary(ps);
+        return child == -1 ? -1 : new_node(ps, QUERY_NOT, child, -1);
+    }
+    if (ps->type == TOK_OPEN) {
+        next_token(ps);
+        int inner = parse_or(ps);
+        if (inner == -1) return -1;
+        if (ps->type != TOK_CLOSE) {
+            ps->error = "Error: Missing ')' in query";
+            return -1;
+        }
+        next_token(ps);
+        return inner;
+    }
+    if (ps->type == TOK_PHRASE && ps->length == 0) {
+        ps->error = "Error: Empty phrase in query";
+        return -1;
+    }
+    if (ps->type == TOK_TERM || ps->type == TOK_PHRASE) {
+        int node = text_node(ps);
+        next_token(ps);
+        return node;
+    }
+    ps->error = "Error: Expected a term in query";
+    return -1;
+}
+
+static int parse_and(Parser *ps) {
+    int left = parse_unary(ps);
+    while (left != -1 && (ps->type == TOK_AND || ps->type == TOK_NOT || ps->type == TOK_OPEN || ps->type == TOK_TERM ||
+                              ps->type == TOK_PHRASE)) {
+        if (ps->type == TOK_AND) next_token(ps);
+        int right = parse_unary(ps);
+        left = right == -1 ? -1 : new_node(ps, QUERY_AND, left, right);
+    }
+    return left;
+}
+
+static int parse_or(Parser *ps) {
+    int left = parse_and(ps);
+    while (left != -1 && ps->type == TOK_OR) {
+        next_token(ps);
+        int right = parse_and(ps);
+        left = right == -1 ? -1 : new_node(ps, QUERY_OR, left, right);
+    }
+    return left;
+}
+
+// Parentheses around a lone word add nothing, so "((The))" is the plain keyword The and
+// matches like it; returns the word, cut out of text in place, or text if it is anything else
+char *query_unwrap(char *text) {
+    char *start = text;
+    char *end = text + strlen(text);
+    int depth = 0;
+    for (;;) {
+        while (*start == ' ' || *start == '\t') start++;
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        if (end - start < 2 || *start != '(' || end[-1] != ')') break;
+        start++;
+        end--;
+        depth++;
+    }
+    if (depth == 0 || start == end) return text;
+    for (const char *c = start; c < end; c++) {
+        if (!is_query_char((unsigned char)*c)) return text;
+    }
+    size_t len = end - start;
+    if ((len == 3 && (strncmp(start, "AND", 3) == 0 || strncmp(start, "NOT", 3) == 0)) ||
+        (len == 2 && strncmp(start, "OR", 2) == 0)) return text;
+    *end = '\0';
+    return start;
+}
+
+// 1 if text is a boolean query (parsed into query), 0 if it is a plain keyword (no
+// operators, or characters a term can't hold), -1 with *error set if it is malformed
+int query_parse(const char *text, Query *query, const char **error) {
+    Parser ps = { text, TOK_END, "", 0, 0, 0, NULL, query };
+
+    // A plain keyword keeps its old meaning (single term or grep-style scan)
+    for (next_token(&ps); ps.type != TOK_END; next_token(&ps)) {
+        if (ps.type == TOK_INVALID) return 0;
+    }
+    if (ps.operators == 0) return 0;
+
+    ps.p = text;
+    query->count = 0;
+    query->text_length = 0;
+    next_token(&ps);
+    query->root = parse_or(&ps);
+    if (query->root != -1 && ps.type != TOK_END) {
+        ps.error = ps.type == TOK_CLOSE ? "Error: Unbalanced ')' in query" : "Error: Unexpected operator in query";
+        query->root = -1;
+    }
+    if (query->root == -1) {
+        *error = ps.error;
+        return -1;
+    }
+    return 1;
+}
+
+// Any of the words of text, as an OR of terms (the free-text form of a ranked search);
+// returns how many terms, 0 if it has none or too many
+int query_parse_words(const char *text, Query *query) {
+    Parser ps = { text, TOK_TERM, "", 0, 0, 0, NULL, query };
+    int count = postings_split(text, ps.text, sizeof(ps.text));
+    if (count <= 0 || count > MAX_QUERY_NODES / 2) return 0;
+
+    query->count = 0;
+    query->text_length = 0;
+    query->root = -1;
+    const char *term = ps.text;
+    for (int i = 0; i < count; i++, term += strlen(term) + 1) {
+        memcpy(query->text + query->text_length, term, strlen(term) + 1);
+        int node = new_node(&ps, QUERY_TERM, -1, -1);
+        query->nodes[node].text = query->text_length;
+        query->nodes[node].length = 1;
+        query->text_length += strlen(term) + 1;
+        query->root = query->root == -1 ? node : new_node(&ps, QUERY_OR, query->root, node);
+    }
+    return count;
+}
+
+static int append(char *out, size_t size, size_t *used, const char *text) {
+    size_t length = strlen(text);
+    if (*used + length >= size) return -1;
+    memcpy(out + *used, text, length + 1);
+    *used += length;
+    return 0;
+}
+
+// Canonical text of a parsed query: prefix form with every operator explicit, e.g.
+// "(AND romeo (OR juliet tybalt))", so queries that differ only in case, spacing,
+// implicit ANDs or redundant parentheses read the same
+static int format_node(const Query *q, int node, char *out, size_t size, size_t *used) {
+    const QueryNode *n = &q->nodes[node];
+    if (n->type == QUERY_TERM || n->type == QUERY_PHRASE) {
+        const char *term = q->text + n->text;
+        if (n->type == QUERY_PHRASE && append(out, size, used, "\"") == -1) return -1;
+        for (int i = 0; i < n->length; i++, term += strlen(term) + 1) {
+            if ((i && append(out, size, used, " ") == -1) || append(out, size, used, term) == -1) return -1;
+        }
+        return n->type == QUERY_PHRASE ? append(out, size, used, "\"") : 0;
+    }
+
+    const char *name = n->type == QUERY_AND ? "(AND " : n->type == QUERY_OR ? "(OR " : "(NOT ";
+    if (append(out, size, used, name) == -1 || format_node(q, n->left, out, size, used) == -1) return -1;
+    if (n->right != -1 && (append(out, size, used, " ") == -1 || format_node(q, n->right, out, size, used) == -1)) return -1;
+    return append(out, size, used, ")");
+}
+
+// Writes the canonical text of a query; -1 if it does not fit
+int query_format(const Query *query, char *out, size_t size) {
+    size_t used = 0;
+    if (size == 0) return -1;
+    out[0] = '\0';
+    if (query->count == 0) return 0;
+    return format_node(query, query->root, out, size, &used);
+}
+
+// ---------- EVALUATION ----------
+// Every node yields a sorted id list. Terms are views of their posting lists (nothing
+// is copied); conjunctions start from their most selective operand and gallop through
+// the others, so an AND costs about as much as its rarest term. A phrase is the AND of
+// its terms, then keeps the documents where their positions line up.
+// Documents with the same contents share postings (see postings.c), so evaluation sees
+// one id per distinct contents and the result is expanded to all of them at the end.
+
+typedef struct {
+    int *ids;
+    int count;
+} IdList;
+
+typedef struct {
+    const Query *query;
+    QueryUniverse universe;
+    int doc_count;
+} Eval;
+
+static int compare_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static void list_free(IdList *list) {
+    free(list->ids);
+    list->ids = NULL;
+    list->count = 0;
+}
+
+// First position at or after from whose id is >= target: doubles the step, then bisects
+static int gallop(const int *ids, int count, int from, int target) {
+    int step = 1, hi = from;
+    while (hi < count && ids[hi] < target) {
+        from = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > count) hi = count;
+    while (from < hi) {
+        int mid = from + (hi - from) / 2;
+        if (ids[mid] < target) from = mid + 1;
+        else hi = mid;
+    }
+    return from;
+}
+
+// Keeps the ids of a that are (keep = 1) or are not (keep = 0) in b
+static int filter(IdList *a, const IdList *b, int keep) {
+    int *out = malloc(((size_t)a->count + 1) * sizeof(int));
+    if (!out) return -1;
+    int n = 0, pos = 0;
+    for (int i = 0; i < a->count; i++) {
+        pos = gallop(b->ids, b->count, pos, a->ids[i]);
+        int found = pos < b->count && b->ids[pos] == a->ids[i];
+        if (found == keep) out[n++] = a->ids[i];
+    }
+    list_free(a);
+    a->ids = out;
+    a->count = n;
+    return 0;
+}
+
+// Same as filter, against a term's posting list read through its skip entries: only the
+// blocks that could hold one of a's ids are decoded
+static void filter_term(IdList *a, const char *term, int keep) {
+    PostingList list;
+    postings_list(term, &list);
+    int n = 0;
+    for (int i = 0; i < a->count; i++) {
+        int found = postings_advance(&list, a->ids[i]) == a->ids[i];
+        if (found == keep) a->ids[n++] = a->ids[i];
+    }
+    a->count = n;
+}
+
+static int merge(IdList *a, const IdList *b) {
+    int *out = malloc(((size_t)a->count + b->count + 1) * sizeof(int));
+    if (!out) return -1;
+    int i = 0, j = 0, n = 0;
+    while (i < a->count || j < b->count) {
+        if (j == b->count || (i < a->count && a->ids[i] < b->ids[j])) out[n++] = a->ids[i++];
+        else if (i == a->count || b->ids[j] < a->ids[i]) out[n++] = b->ids[j++];
+        else {
+            out[n++] = a->ids[i++];
+            j++;
+        }
+    }
+    list_free(a);
+    a->ids = out;
+    a->count = n;
+    return 0;
+}
+
+// Upper bound on a node's result size, used to order operands
+static long estimate(const Eval *ev, int node) {
+    const QueryNode *n = &ev->query->nodes[node];
+    const char *term = ev->query->text + n->text;
+    long left, right, count;
+    switch (n->type) {
+        case QUERY_TERM:
+            return postings_count(term);
+        case QUERY_PHRASE:
+            left = ev->doc_count;
+            for (int i = 0; i < n->length; i++, term += strlen(term) + 1) {
+                count = postings_count(term);
+                if (count < left) left = count;
+            }
+            return left;
+        case QUERY_NOT:
+            return ev->doc_count;
+        case QUERY_OR:
+            return estimate(ev, n->left) + estimate(ev, n->right);
+        default:
+            left = ev->query->nodes[n->left].type == QUERY_NOT ? ev->doc_count : estimate(ev, n->left);
+            right = ev->query->nodes[n->right].type == QUERY_NOT ? ev->doc_count : estimate(ev, n->right);
+            return left < right ? left : right;
+    }
+}
+
+// Gathers the operands of a chain of nodes of the same type (a AND b AND c -> a, b, c)
+static void flatten(const Query *q, int node, QueryNodeType type, int *out, int *count) {
+    const QueryNode *n = &q->nodes[node];
+    if (n->type == type) {
+        flatten(q, n->left, type, out, count);
+        flatten(q, n->right, type, out, count);
+    } else {
+        out[(*count)++] = node;
+    }
+}
+
+static int eval(const Eval *ev, int node, IdList *out);
+
+// Growable list of positions
+typedef struct {
+    int *items;
+    int count;
+    int capacity;
+} Positions;
+
+static int positions_push(Positions *p, int position) {
+    if (p->count == p->capacity) {
+        int capacity = p->capacity ? p->capacity * 2 : 256;
+        int *items = realloc(p->items, (size_t)capacity * sizeof(int));
+        if (!items) return -1;
+        p->items = items;
+        p->capacity = capacity;
+    }
+    p->items[p->count++] = position;
+    return 0;
+}
+
+// Where the terms occur at consecutive positions, given a cursor on each one's positions
+// in the document: every cursor leapfrogs to the furthest candidate start until they all
+// agree. Without out it stops at the first match; returns how many start positions were
+// found, -1 if out of memory.
+static int phrase_match(PositionCursor *cursors, int length, Positions *out) {
+    int start[MAX_PHRASE_TERMS];
+    int found = 0;
+    for (int i = 0; i < length; i++) start[i] = postings_next_position(&cursors[i]) - i;
+    for (;;) {
+        int target = start[0], agree = 1;
+        for (int i = 1; i < length; i++) {
+            if (start[i] > target) target = start[i];
+        }
+        for (int i = 0; i < length; i++) {
+            while (start[i] < target) {
+                int position = postings_next_position(&cursors[i]);
+                if (position == -1) return found;
+                start[i] = position - i;
+            }
+            if (start[i] != target) agree = 0;
+        }
+        if (!agree) continue;
+        found++;
+        if (!out) return found;
+        if (positions_push(out, target) == -1) return -1;
+        int position = postings_next_position(&cursors[0]);
+        if (position == -1) return found;
+        start[0] = position;
+    }
+}
+
+static int phrase_find(const char *const *terms, int length, int id, Positions *out) {
+    PositionCursor cursors[MAX_PHRASE_TERMS];
+    for (int i = 0; i < length; i++) {
+        if (postings_positions(terms[i], id, &cursors[i]) == 0) return 0;
+    }
+    return phrase_match(cursors, length, out);
+}
+
+// A term's posting list, decoded
+static int eval_term(const char *term, IdList *out) {
+    out->ids = postings_ids(term, &out->count);
+    return out->ids ? 0 : -1;
+}
+
+// Walks the rarest term's list and looks each document up in the others' through their
+// skip entries; where all hold it, their cursors also give the positions to check
+static int eval_phrase(const Eval *ev, const QueryNode *n, IdList *out) {
+    PostingList lists[MAX_PHRASE_TERMS];
+    int rarest = 0;
+    const char *term = ev->query->text + n->text;
+    for (int i = 0; i < n->length; i++, term += strlen(term) + 1) {
+        postings_list(term, &lists[i]);
+        if (lists[i].count < lists[rarest].count) rarest = i;
+    }
+
+    out->ids = malloc(((size_t)lists[rarest].count + 1) * sizeof(int));
+    if (!out->ids) return -1;
+    for (int id = lists[rarest].id; id != -1; id = postings_next(&lists[rarest])) {
+        int all = 1;
+        for (int i = 0; i < n->length && all; i++) all = i == rarest || postings_advance(&lists[i], id) == id;
+        if (!all) continue;
+
+        PositionCursor cursors[MAX_PHRASE_TERMS];
+        for (int i = 0; i < n->length; i++) postings_list_positions(&lists[i], &cursors[i]);
+        if (phrase_match(cursors, n->length, NULL) > 0) out->ids[out->count++] = id;
+    }
+    return 0;
+}
+
+static int eval_universe(const Eval *ev, IdList *out) {
+    out->ids = ev->universe(&out->count);
+    if (!out->ids) return -1;
+
+    int kept = 0;
+    for (int i = 0; i < out->count; i++) {
+        if (postings_content_of(out->ids[i]) == out->ids[i]) out->ids[kept++] = out->ids[i];
+    }
+    out->count = kept;
+    return 0;
+}
+
+static int eval_and(const Eval *ev, int node, IdList *out) {
+    int operands[MAX_QUERY_NODES], count = 0;
+    int positive[MAX_QUERY_NODES], positives = 0;
+    long cost[MAX_QUERY_NODES];
+    flatten(ev->query, node, QUERY_AND, operands, &count);
+
+    // Most selective operand first; NOTs only ever remove ids, so they go last
+    for (int i = 0; i < count; i++) {
+        if (ev->query->nodes[operands[i]].type == QUERY_NOT) continue;
+        long c = estimate(ev, operands[i]);
+        int j = positives;
+        while (j > 0 && cost[j - 1] > c) {
+            positive[j] = positive[j - 1];
+            cost[j] = cost[j - 1];
+            j--;
+        }
+        positive[j] = operands[i];
+        cost[j] = c;
+        positives++;
+    }
+
+    // A term operand is never decoded whole: the ids so far are looked up in it
+    if (positives == 0 ? eval_universe(ev, out) : eval(ev, positive[0], out)) return -1;
+    for (int i = 1; i < positives && out->count > 0; i++) {
+        const QueryNode *n = &ev->query->nodes[positive[i]];
+        if (n->type == QUERY_TERM) {
+            filter_term(out, ev->query->text + n->text, 1);
+            continue;
+        }
+        IdList other = { NULL, 0 };
+        if (eval(ev, positive[i], &other) == -1 || filter(out, &other, 1) == -1) {
+            list_free(&other);
+            return -1;
+        }
+        list_free(&other);
+    }
+    for (int i = 0; i < count && out->count > 0; i++) {
+        const QueryNode *n = &ev->query->nodes[operands[i]];
+        if (n->type != QUERY_NOT) continue;
+        const QueryNode *child = &ev->query->nodes[n->left];
+        if (child->type == QUERY_TERM) {
+            filter_term(out, ev->query->text + child->text, 0);
+            continue;
+        }
+        IdList excluded = { NULL, 0 };
+        if (eval(ev, n->left, &excluded) == -1 || filter(out, &excluded, 0) == -1) {
+            list_free(&excluded);
+            return -1;
+        }
+        list_free(&excluded);
+    }
+    return 0;
+}
+
+static int eval(const Eval *ev, int node, IdList *out) {
+    const QueryNode *n = &ev->query->nodes[node];
+    out->ids = NULL;
+    out->count = 0;
+
+    if (n->type == QUERY_TERM) return eval_term(ev->query->text + n->text, out);
+    if (n->type == QUERY_PHRASE) return eval_phrase(ev, n, out);
+    if (n->type == QUERY_AND || n->type == QUERY_NOT) return eval_and(ev, node, out);
+
+    int operands[MAX_QUERY_NODES], count = 0;
+    flatten(ev->query, node, QUERY_OR, operands, &count);
+    for (int i = 0; i < count; i++) {
+        IdList other;
+        if (eval(ev, operands[i], &other) == -1) {
+            list_free(&other);
+            return -1;
+        }
+        if (i == 0) {
+            *out = other;
+            continue;
+        }
+        int failed = merge(out, &other);
+        list_free(&other);
+        if (failed) return -1;
+    }
+    return 0;
+}
+
+// Adds the documents that share contents with the given ones; ids stay ascending.
+// Frees ids; NULL if out of memory.
+static int *expand(int *ids, int *count) {
+    if (postings_alias_count() == 0) return ids;
+
+    int total = 0;
+    const int *same;
+    for (int i = 0; i < *count; i++) {
+        int n = postings_same_content(ids[i], &same);
+        total += n ? n : 1;
+    }
+    int *out = malloc(((size_t)total + 1) * sizeof(int));
+    if (out) {
+        int used = 0;
+        for (int i = 0; i < *count; i++) {
+            int n = postings_same_content(ids[i], &same);
+            if (n == 0) out[used++] = ids[i];
+            for (int j = 0; j < n; j++) out[used++] = same[j];
+        }
+        qsort(out, total, sizeof(int), compare_int);
+        *count = total;
+    }
+    free(ids);
+    return out;
+}
+
+// Matching ids of distinct contents, ascending
+static int *run(const Query *query, QueryUniverse universe, int contents, int *count) {
+    Eval ev = { query, universe, contents };
+    IdList result;
+    if (eval(&ev, query->root, &result) == -1) {
+        list_free(&result);
+        return NULL;
+    }
+    *count = result.count;
+    return result.ids;
+}
+
+static int matches(const Query *q, int node, int id) {
+    const QueryNode *n = &q->nodes[node];
+    if (n->type == QUERY_AND) return matches(q, n->left, id) && matches(q, n->right, id);
+    if (n->type == QUERY_OR) return matches(q, n->left, id) || matches(q, n->right, id);
+    if (n->type == QUERY_NOT) return !matches(q, n->left, id);
+
+    const char *terms[MAX_PHRASE_TERMS];
+    const char *term = q->text + n->text;
+    for (int i = 0; i < n->length; i++, term += strlen(term) + 1) terms[i] = term;
+    if (n->type == QUERY_PHRASE) return phrase_find(terms, n->length, id, NULL) > 0;
+    PositionCursor cursor;
+    return postings_positions(terms[0], id, &cursor) > 0;
+}
+
+// Whether one live document matches, without evaluating the query over the whole index
+// (used to bring a cached result up to date). The caller holds the index lock.
+int query_matches(const Query *query, int id) {
+    return query->count > 0 && matches(query, query->root, id);
+}
+
+// Matching ids in ascending order (caller frees), or NULL if out of memory. The
+// caller holds the index lock; universe is called at most once per NOT-only operand.
+int *query_run(const Query *query, QueryUniverse universe, int doc_count, int *count) {
+    int *ids = run(query, universe, doc_count - postings_alias_count(), count);
+    return ids ? expand(ids, count) : NULL;
+}
+
+// ---------- RANKING ----------
+// BM25 over the query's positive terms (those not under a NOT; a phrase contributes its
+// words). Only the best k documents are kept, in a min-heap. A query that is just an OR
+// of terms is scored straight off the posting lists with MaxScore: once the heap is full,
+// the terms whose combined best score can't beat its weakest entry stop producing
+// candidates and are only probed for documents that still could.
+
+#define BM25_K1 1.2
+#define BM25_B 0.75
+#define MAX_RANK_TERMS MAX_QUERY_NODES
+
+typedef struct {
+    PostingList list;   // cursor, only ever moved forward
+    double idf;
+    double bound;       // the most the term can add to any document's score
+} RankTerm;
+
+typedef struct {
+    double score;
+    int id;
+} Ranked;
+
+typedef struct {
+    Ranked *heap;       // root = weakest kept result
+    int size;
+    int k;
+    double average_length;
+} Ranking;
+
+static double term_score(const RankTerm *t, int frequency, int length, double average) {
+    double norm = BM25_K1 * (1 - BM25_B + BM25_B * length / average);
+    return t->idf * frequency * (BM25_K1 + 1) / (frequency + norm);
+}
+
+// a loses to b: lower score, or the same score and a later id
+static int weaker(const Ranked *a, const Ranked *b) {
+    return a->score < b->score || (a->score == b->score && a->id > b->id);
+}
+
+// Threshold a new document (whose id is larger than every kept one) has to beat
+static double rank_threshold(const Ranking *r) {
+    return r->size == r->k ? r->heap[0].score : -1;
+}
+
+// Puts item at the root of the heap and sifts it down
+static void heap_replace_root(Ranked *heap, int size, Ranked item) {
+    int i = 0;
+    while (2 * i + 1 < size) {
+        int child = 2 * i + 1;
+        if (child + 1 < size && weaker(&heap[child + 1], &heap[child])) child++;
+        if (!weaker(&heap[child], &item)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = item;
+}
+
+static void rank_offer(Ranking *r, int id, double score) {
+    Ranked item = { score, id };
+    if (r->size < r->k) {
+        int i = r->size++;
+        for (; i > 0 && weaker(&item, &r->heap[(i - 1) / 2]); i = (i - 1) / 2) r->heap[i] = r->heap[(i - 1) / 2];
+        r->heap[i] = item;
+    } else if (weaker(&r->heap[0], &item)) {
+        heap_replace_root(r->heap, r->size, item);
+    }
+}
+
+// Terms of the positive part of the query, each once
+static void rank_collect(const Query *q, int node, RankTerm *out, const char **texts, int *count) {
+    const QueryNode *n = &q->nodes[node];
+    if (n->type == QUERY_NOT) return;
+    if (n->type == QUERY_AND || n->type == QUERY_OR) {
+        rank_collect(q, n->left, out, texts, count);
+        rank_collect(q, n->right, out, texts, count);
+        return;
+    }
+    const char *term = q->text + n->text;
+    for (int i = 0; i < n->length; i++, term += strlen(term) + 1) {
+        int seen = 0;
+        for (int j = 0; j < *count && !seen; j++) seen = strcmp(texts[j], term) == 0;
+        if (seen || *count == MAX_RANK_TERMS || postings_list(term, &out[*count].list) == 0) continue;
+        texts[(*count)++] = term;
+    }
+}
+
+static int is_disjunction(const Query *q, int node) {
+    const QueryNode *n = &q->nodes[node];
+    if (n->type == QUERY_OR) return is_disjunction(q, n->left) && is_disjunction(q, n->right);
+    return n->type == QUERY_TERM;
+}
+
+// Scores a document on terms[from, to), moving their cursors to it
+static double score_document(RankTerm *terms, int from, int to, int id, int length, double average) {
+    double score = 0;
+    for (int i = from; i < to; i++) {
+        RankTerm *t = &terms[i];
+        if (postings_advance(&t->list, id) == id) score += term_score(t, postings_frequency(&t->list), length, average);
+    }
+    return score;
+}
+
+static void rank_maxscore(RankTerm *terms, int n, Ranking *r) {
+    // Ascending bounds; prefix[i] is what terms [0, i) can add together
+    for (int i = 1; i < n; i++) {
+        RankTerm t = terms[i];
+        int j = i;
+        for (; j > 0 && terms[j - 1].bound > t.bound; j--) terms[j] = terms[j - 1];
+        terms[j] = t;
+    }
+    double prefix[MAX_RANK_TERMS + 1];
+    prefix[0] = 0;
+    for (int i = 0; i < n; i++) prefix[i + 1] = prefix[i] + terms[i].bound;
+
+    int essential = 0;      // only terms [essential, n) propose candidates
+    for (;;) {
+        int id = -1;
+        for (int i = essential; i < n; i++) {
+            int next = terms[i].list.id;
+            if (next != -1 && (id == -1 || next < id)) id = next;
+        }
+        if (id == -1) return;
+
+        int length = postings_document_length(id);
+        double score = score_document(terms, essential, n, id, length, r->average_length);
+        for (int i = essential; i < n; i++) {
+            if (terms[i].list.id == id) postings_next(&terms[i].list);
+        }
+        // Non-essential terms, strongest first, only while they could still matter
+        for (int i = essential - 1; i >= 0 && score + prefix[i + 1] > rank_threshold(r); i--) {
+            score += score_document(terms, i, i + 1, id, length, r->average_length);
+        }
+
+        if (score > rank_threshold(r)) {
+            rank_offer(r, id, score);
+            while (essential < n && prefix[essential + 1] <= rank_threshold(r)) essential++;
+        }
+    }
+}
+
+static int compare_ranked(const void *a, const void *b) {
+    return weaker(a, b) ? 1 : weaker(b, a) ? -1 : 0;
+}
+
+// Every document with the contents of the kept ones (each scores what its contents do),
+// best first, cut back to k. The lowest id of each contents is the one that was kept, so
+// the best k documents are all among these.
+static Ranked *rank_expand(Ranked *best, int *size, int k) {
+    if (postings_alias_count() == 0) return best;
+
+    int total = 0;
+    const int *same;
+    for (int i = 0; i < *size; i++) {
+        int n = postings_same_content(best[i].id, &same);
+        total += n ? n : 1;
+    }
+    Ranked *out = malloc(((size_t)total + 1) * sizeof(Ranked));
+    if (out) {
+        int used = 0;
+        for (int i = 0; i < *size; i++) {
+            int n = postings_same_content(best[i].id, &same);
+            if (n == 0) out[used++] = best[i];
+            for (int j = 0; j < n; j++) out[used++] = (Ranked){ best[i].score, same[j] };
+        }
+        qsort(out, total, sizeof(Ranked), compare_ranked);
+        *size = total < k ? total : k;
+    }
+    free(best);
+    return out;
+}
+
+// The best k matches, best first (caller frees), or NULL if out of memory. Scores use
+// BM25 with document lengths from the index, over distinct contents. The caller holds
+// the index lock.
+int *query_rank(const Query *query, QueryUniverse universe, int doc_count, int k, int *count) {
+    RankTerm terms[MAX_RANK_TERMS];
+    const char *texts[MAX_RANK_TERMS];
+    int n = 0;
+    rank_collect(query, query->root, terms, texts, &n);
+
+    int wanted = k;
+    doc_count -= postings_alias_count();
+    if (k > doc_count) k = doc_count;
+    Ranking r = { malloc(((size_t)k + 1) * sizeof(Ranked)), 0, k, 0 };
+    if (!r.heap) return NULL;
+
+    int min_length;
+    postings_length_stats(&r.average_length, &min_length);
+    for (int i = 0; i < n; i++) {
+        RankTerm *t = &terms[i];
+        double df = t->list.count;
+        t->idf = log(1 + (doc_count - df + 0.5) / (df + 0.5));
+        // Frequency raises the score and length lowers it, so the extremes bound it
+        t->bound = term_score(t, t->list.max_frequency, min_length, r.average_length);
+    }
+
+    // With no positive term (e.g. "NOT x") every match scores 0 and ties go by id
+    if (k > 0 && (n > 0 || !is_disjunction(query, query->root))) {
+        if (is_disjunction(query, query->root)) {
+            rank_maxscore(terms, n, &r);
+        } else {
+            int matches = 0;
+            int *ids = run(query, universe, doc_count, &matches);
+            if (!ids) {
+                free(r.heap);
+                return NULL;
+            }
+            for (int i = 0; i < matches; i++) {
+                int length = postings_document_length(ids[i]);
+                rank_offer(&r, ids[i], score_document(terms, 0, n, ids[i], length, r.average_length));
+            }
+            free(ids);
+        }
+    }
+
+    // Pop the weakest into the back, so the best ends up first
+    int size = r.size;
+    while (r.size > 0) {
+        Ranked weakest = r.heap[0];
+        r.size--;
+        heap_replace_root(r.heap, r.size, r.heap[r.size]);
+        r.heap[r.size] = weakest;
+    }
+    Ranked *best = rank_expand(r.heap, &size, wanted);
+    int *out = best ? malloc(((size_t)size + 1) * sizeof(int)) : NULL;
+    for (int i = 0; out && i < size; i++) out[i] = best[i].id;
+    free(best);
+    *count = out ? size : 0;
+    return out;
+}
+
+// ---------- COUNTS ----------
+
+// Positions of the positive terms of the query in one document; a phrase adds where
+// each of its matches starts
+static int collect_positions(const Query *q, int node, int id, Positions *out) {
+    const QueryNode *n = &q->nodes[node];
+    if (n->type == QUERY_NOT) return 0;
+    if (n->type == QUERY_AND || n->type == QUERY_OR) {
+        if (collect_positions(q, n->left, id, out) == -1) return -1;
+        return collect_positions(q, n->right, id, out);
+    }
+
+    const char *terms[MAX_PHRASE_TERMS];
+    const char *term = q->text + n->text;
+    for (int i = 0; i < n->length; i++, term += strlen(term) + 1) terms[i] = term;
+    if (n->type == QUERY_PHRASE) return phrase_find(terms, n->length, id, out) == -1 ? -1 : 0;
+
+    PositionCursor cursor;
+    postings_positions(terms[0], id, &cursor);
+    for (int position; (position = postings_next_position(&cursor)) != -1; ) {
+        if (positions_push(out, position) == -1) return -1;
+    }
+    return 0;
+}
+
+// Occurrences of the query in a document (its positive terms, a phrase counting once per
+// match) and how many lines hold any, from the stored positions alone; -1 if out of memory.
+// These count indexed words, so they are not the substring counts of -l or a scan.
+// The caller holds the index lock.
+int query_counts(const Query *query, int id, long *occurrences, long *lines) {
+    Positions found = { NULL, 0, 0 };
+    if (collect_positions(query, query->root, id, &found) == -1) {
+        free(found.items);
+        return -1;
+    }
+
+    // The same word can come from more than one node ("a OR a", a term inside a phrase)
+    qsort(found.items, found.count, sizeof(int), compare_int);
+    int unique = 0;
+    for (int i = 0; i < found.count; i++) {
+        if (unique == 0 || found.items[i] != found.items[unique - 1]) found.items[unique++] = found.items[i];
+    }
+    *occurrences = unique;
+    *lines = postings_count_lines(id, found.items, unique);
+    free(found.items);
+    return 0;
+}
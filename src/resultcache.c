@@ -0,0 +1,278 @@
+#include "common.h"
+#include "resultcache.h"
+#include "cache.h"
+#include <pthread.h>
+
+// Entries are few (one per distinct query kept), so they are found by a linear scan
+// over their key hashes. Eviction is LRU, through the same policies as the metadata
+// cache; the policy knows each entry by a serial number.
+typedef struct {
+    char *key;
+    unsigned int hash;
+    int serial;                  // 0 = free slot
+    unsigned long generation;    // the corpus the result is exact for
+    SearchResult result;
+} ResultEntry;
+
+typedef struct {
+    int id;
+    int added;
+} CorpusChange;
+
+static ResultEntry *entries = NULL;
+static int capacity = 0;
+static int entry_count = 0;
+static int *free_slots = NULL;
+static int free_count = 0;
+static KeyMap slots;                    // serial -> slot
+static const CachePolicy *policy = NULL;
+static void *policy_state = NULL;       // NULL while the cache is disabled
+static int next_serial = 1;
+
+// Change g (counting from 1) is at changes[(g - 1) % RESULT_LOG_SIZE]
+static CorpusChange changes[RESULT_LOG_SIZE];
+static unsigned long generation = 0;
+
+static long hits = 0;       // served as stored
+static long patched = 0;    // served after testing the documents that changed
+static long misses = 0;
+
+static pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int resultcache_init(int size) {
+    if (size <= 0) return 0;
+    policy = cache_policy_find("lru");
+    entries = calloc(size, sizeof(ResultEntry));
+    free_slots = malloc(size * sizeof(int));
+    if (!policy || !entries || !free_slots || keymap_init(&slots, size) == -1) return -1;
+    policy_state = policy->create(size);
+    if (!policy_state) return -1;
+    capacity = size;
+    for (int i = 0; i < size; i++) free_slots[free_count++] = size - 1 - i;
+    return 0;
+}
+
+void resultcache_free(SearchResult *result) {
+    free(result->ids);
+    free(result->counts);
+    result->ids = NULL;
+    result->counts = NULL;
+    result->count = 0;
+}
+
+static int result_copy(const SearchResult *from, SearchResult *to) {
+    to->count = from->count;
+    to->ids = malloc(((size_t)from->count + 1) * sizeof(int));
+    to->counts = from->counts ? malloc(((size_t)from->count + 1) * 2 * sizeof(long)) : NULL;
+    if (!to->ids || (from->counts && !to->counts)) {
+        resultcache_free(to);
+        return -1;
+    }
+    memcpy(to->ids, from->ids, (size_t)from->count * sizeof(int));
+    if (from->counts) memcpy(to->counts, from->counts, (size_t)from->count * 2 * sizeof(long));
+    return 0;
+}
+
+static unsigned int key_hash(const char *key) {
+    unsigned int h = 2166136261u;
+    for (; *key; key++) {
+        h ^= (unsigned char)*key;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int find(const char *key, unsigned int hash) {
+    for (int i = 0; i < capacity; i++) {
+        if (entries[i].serial && entries[i].hash == hash && strcmp(entries[i].key, key) == 0) return i;
+    }
+    return -1;
+}
+
+static void release(int slot) {
+    ResultEntry *e = &entries[slot];
+    keymap_delete(&slots, e->serial);
+    free(e->key);
+    resultcache_free(&e->result);
+    e->key = NULL;
+    e->serial = 0;
+    free_slots[free_count++] = slot;
+    entry_count--;
+}
+
+static void drop(int slot) {
+    policy->remove(policy_state, entries[slot].serial);
+    release(slot);
+}
+
+// Inserts id (not present yet) at its place in an ascending result
+static int result_insert(SearchResult *r, int id, const long *counts) {
+    int *ids = realloc(r->ids, ((size_t)r->count + 1) * sizeof(int));
+    if (!ids) return -1;
+    r->ids = ids;
+    if (r->counts) {
+        long *c = realloc(r->counts, ((size_t)r->count + 1) * 2 * sizeof(long));
+        if (!c) return -1;
+        r->counts = c;
+    }
+
+    int pos = r->count;
+    while (pos > 0 && r->ids[pos - 1] > id) pos--;
+    memmove(&r->ids[pos + 1], &r->ids[pos], (size_t)(r->count - pos) * sizeof(int));
+    r->ids[pos] = id;
+    if (r->counts) {
+        memmove(&r->counts[2 * pos + 2], &r->counts[2 * pos], (size_t)(r->count - pos) * 2 * sizeof(long));
+        r->counts[2 * pos] = counts[0];
+        r->counts[2 * pos + 1] = counts[1];
+    }
+    r->count++;
+    return 0;
+}
+
+static int result_find(const SearchResult *r, int id) {
+    int lo = 0, hi = r->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (r->ids[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < r->count && r->ids[lo] == id ? lo : -1;
+}
+
+static void result_delete(SearchResult *r, int pos) {
+    memmove(&r->ids[pos], &r->ids[pos + 1], (size_t)(r->count - pos - 1) * sizeof(int));
+    if (r->counts) memmove(&r->counts[2 * pos], &r->counts[2 * pos + 2], (size_t)(r->count - pos - 1) * 2 * sizeof(long));
+    r->count--;
+}
+
+// The result of a query at the given generation (a copy the caller frees with
+// resultcache_free); 0 if it has to be computed. An older entry is replayed over the
+// changes since it was stored, calling test for each added document; without a test
+// (a ranked result, where any change moves the scores) only an exact entry is served.
+int resultcache_get(const char *key, unsigned long at, ResultTest test, void *ctx, SearchResult *out) {
+    memset(out, 0, sizeof(*out));
+    if (!policy_state) return 0;
+
+    unsigned int hash = key_hash(key);
+    pthread_mutex_lock(&results_lock);
+    int slot = find(key, hash);
+    unsigned long from = slot == -1 ? 0 : entries[slot].generation;
+    if (slot != -1 && from != at && (!test || from + RESULT_LOG_SIZE < generation)) {
+        drop(slot);   // can never be brought up to date
+        slot = -1;
+    }
+    if (slot == -1 || from > at || result_copy(&entries[slot].result, out) == -1) {
+        misses++;
+        pthread_mutex_unlock(&results_lock);
+        return 0;
+    }
+    policy->lookup(policy_state, entries[slot].serial);
+    if (from == at) {
+        hits++;
+        pthread_mutex_unlock(&results_lock);
+        return 1;
+    }
+
+    // Replayed without the lock: a test may read a file
+    int pending = (int)(at - from);
+    CorpusChange *replay = malloc((size_t)pending * sizeof(CorpusChange));
+    for (int i = 0; replay && i < pending; i++) replay[i] = changes[(from + i) % RESULT_LOG_SIZE];
+    pthread_mutex_unlock(&results_lock);
+
+    int failed = !replay;
+    for (int i = 0; i < pending && !failed; i++) {
+        int pos = result_find(out, replay[i].id);
+        if (!replay[i].added) {
+            if (pos != -1) result_delete(out, pos);
+            continue;
+        }
+        long counts[2] = { 0, 0 };
+        int match = pos == -1 ? test(ctx, replay[i].id, counts) : 0;
+        if (match == -1 || (match == 1 && result_insert(out, replay[i].id, counts) == -1)) failed = 1;
+    }
+    free(replay);
+
+    pthread_mutex_lock(&results_lock);
+    if (failed) {
+        misses++;
+        pthread_mutex_unlock(&results_lock);
+        resultcache_free(out);
+        return 0;
+    }
+    patched++;
+    // Keep the brought-forward result, unless someone stored a newer one meanwhile
+    slot = find(key, hash);
+    SearchResult copy;
+    if (slot != -1 && entries[slot].generation < at && result_copy(out, &copy) == 0) {
+        resultcache_free(&entries[slot].result);
+        entries[slot].result = copy;
+        entries[slot].generation = at;
+    }
+    pthread_mutex_unlock(&results_lock);
+    return 1;
+}
+
+// Keeps a result computed at the given generation (copied)
+void resultcache_put(const char *key, unsigned long at, const SearchResult *result) {
+    if (!policy_state || result->count > RESULT_MAX_IDS) return;
+    SearchResult copy;
+    char *key_copy = strdup(key);
+    if (!key_copy || result_copy(result, &copy) == -1) {
+        free(key_copy);
+        return;
+    }
+
+    unsigned int hash = key_hash(key);
+    pthread_mutex_lock(&results_lock);
+    int slot = find(key, hash);
+    if (slot != -1 && entries[slot].generation > at) {
+        pthread_mutex_unlock(&results_lock);
+        free(key_copy);
+        resultcache_free(&copy);
+        return;
+    }
+    if (slot != -1) {
+        resultcache_free(&entries[slot].result);
+        free(key_copy);
+        policy->lookup(policy_state, entries[slot].serial);
+    } else {
+        int serial = next_serial++;
+        int evicted = policy->insert(policy_state, serial);
+        if (evicted != -1) release(keymap_get(&slots, evicted));
+        slot = free_slots[--free_count];
+        entries[slot].key = key_copy;
+        entries[slot].hash = hash;
+        entries[slot].serial = serial;
+        keymap_put(&slots, serial, slot);
+        entry_count++;
+    }
+    entries[slot].result = copy;
+    entries[slot].generation = at;
+    pthread_mutex_unlock(&results_lock);
+}
+
+// Logs a document added to or removed from the corpus. Called with the index held
+// exclusively, so a reader of the index sees a generation that matches it.
+void resultcache_record(int id, int added) {
+    pthread_mutex_lock(&results_lock);
+    changes[generation % RESULT_LOG_SIZE] = (CorpusChange){ id, added };
+    generation++;
+    pthread_mutex_unlock(&results_lock);
+}
+
+unsigned long resultcache_generation() {
+    pthread_mutex_lock(&results_lock);
+    unsigned long g = generation;
+    pthread_mutex_unlock(&results_lock);
+    return g;
+}
+
+void resultcache_stats(long *hit_count, long *patched_count, long *miss_count, int *entry_total, int *size) {
+    pthread_mutex_lock(&results_lock);
+    *hit_count = hits;
+    *patched_count = patched;
+    *miss_count = misses;
+    *entry_total = entry_count;
+    *size = capacity;
+    pthread_mutex_unlock(&results_lock);
+}
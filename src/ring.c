@@ -0,0 +1,124 @@
+#include "common.h"
+#include "ring.h"
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+// Shared name of the ring that belongs to a client FIFO: "/<fifo basename>.ring"
+void ring_name(const char *client_fifo, char *name, size_t size) {
+    const char *base = strrchr(client_fifo, '/');
+    snprintf(name, size, "/%s.ring", base ? base + 1 : client_fifo);
+}
+
+// ---------- CONSUMER (client) ----------
+
+ShmRing *ring_create(const char *name, uint32_t size) {
+    if (size == 0 || (size & (size - 1)) != 0) return NULL;
+
+    shm_unlink(name);   // left behind by a crashed client with the same pid
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) return NULL;
+
+    size_t mapped = sizeof(ShmRing) + size;
+    ShmRing *ring = MAP_FAILED;
+    if (ftruncate(fd, mapped) == 0) {
+        ring = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (ring == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    ring->size = size;
+    ring->owner = getpid();
+    ring->head = ring->tail = 0;
+    __atomic_store_n(&ring->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    return ring;
+}
+
+void ring_destroy(ShmRing *ring, const char *name) {
+    if (ring) munmap(ring, sizeof(ShmRing) + ring->size);
+    shm_unlink(name);
+}
+
+// Contiguous readable bytes at the tail, up to len (a wrapped chunk takes two calls)
+size_t ring_span(ShmRing *ring, size_t len, const char **data) {
+    uint64_t tail = ring->tail;
+    uint64_t avail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+    size_t offset = tail & (ring->size - 1);
+    size_t n = ring->size - offset;
+    if (n > len) n = len;
+    if (n > avail) n = avail;
+    *data = ring->data + offset;
+    return n;
+}
+
+void ring_consume(ShmRing *ring, size_t len) {
+    __atomic_store_n(&ring->tail, ring->tail + len, __ATOMIC_RELEASE);
+}
+
+// ---------- PRODUCER (server) ----------
+
+RingWriter *ring_writer_open(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) return NULL;
+
+    struct stat st;
+    ShmRing *ring = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > sizeof(ShmRing)) {
+        ring = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (ring == MAP_FAILED) return NULL;
+
+    // The size is trusted only if it matches what was mapped
+    if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ||
+        sizeof(ShmRing) + ring->size != (size_t)st.st_size ||
+        (ring->size & (ring->size - 1)) != 0) {
+        munmap(ring, st.st_size);
+        return NULL;
+    }
+
+    RingWriter *writer = malloc(sizeof(RingWriter));
+    if (!writer) {
+        munmap(ring, st.st_size);
+        return NULL;
+    }
+    writer->shm = ring;
+    writer->mapped = st.st_size;
+    pthread_mutex_init(&writer->lock, NULL);
+    return writer;
+}
+
+// Copies len bytes in once there is room; -1 if the consumer is gone.
+// The caller serializes producers (RingWriter.lock).
+int ring_put(ShmRing *ring, const void *data, size_t len) {
+    uint32_t size = ring->size;
+    if (len > size) return -1;
+
+    uint64_t head = ring->head;
+    for (int spins = 0; size - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) < len; spins++) {
+        if (spins < 64) {
+            sched_yield();
+            continue;
+        }
+        if (kill(ring->owner, 0) == -1 && errno == ESRCH) return -1;
+        struct timespec pause = { 0, 50000 };
+        nanosleep(&pause, NULL);
+    }
+
+    size_t offset = head & (size - 1);
+    size_t first = size - offset < len ? size - offset : len;
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, (const char *)data + first, len - first);
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void ring_writer_close(RingWriter *writer) {
+    if (!writer) return;
+    munmap(writer->shm, writer->mapped);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer);
+}
@@ -0,0 +1,69 @@
+#include "stats.h"
+#include <pthread.h>
+
+static ThreadStats *slots[MAX_STATS_THREADS];
+static int slot_count = 0;
+static __thread ThreadStats *local = NULL;
+
+static const char *command_names[STATS_COMMANDS] = {
+    "add", "query", "remove", "line_count", "search", "shutdown", "bulk_add", "session_end", "stats"
+};
+
+double stats_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Gives the calling thread its own slot; -1 if there is none left (it then records nothing)
+int stats_register_thread() {
+    ThreadStats *stats = calloc(1, sizeof(ThreadStats));
+    if (!stats) return -1;
+    for (int i = 0; i < STATS_COMMANDS; i++) histogram_init(&stats->latency[i]);
+
+    int slot = __atomic_fetch_add(&slot_count, 1, __ATOMIC_RELAXED);
+    if (slot >= MAX_STATS_THREADS) {
+        free(stats);
+        return -1;
+    }
+    __atomic_store_n(&slots[slot], stats, __ATOMIC_RELEASE);
+    local = stats;
+    return 0;
+}
+
+void stats_record(int command, uint64_t latency_us) {
+    if (local && command >= 0 && command < STATS_COMMANDS) {
+        histogram_record_owned(&local->latency[command], latency_us);
+    }
+}
+
+void stats_count_search(int indexed, long docs) {
+    if (!local) return;
+    if (indexed) {
+        __atomic_store_n(&local->indexed_searches, local->indexed_searches + 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(&local->scans, local->scans + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&local->docs_scanned, local->docs_scanned + docs, __ATOMIC_RELAXED);
+    }
+}
+
+// Sums every slot; the threads keep recording meanwhile
+void stats_collect(ThreadStats *total) {
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < STATS_COMMANDS; i++) histogram_init(&total->latency[i]);
+
+    int count = __atomic_load_n(&slot_count, __ATOMIC_RELAXED);
+    if (count > MAX_STATS_THREADS) count = MAX_STATS_THREADS;
+    for (int s = 0; s < count; s++) {
+        ThreadStats *stats = __atomic_load_n(&slots[s], __ATOMIC_ACQUIRE);
+        if (!stats) continue;   // registered, not published yet
+        for (int i = 0; i < STATS_COMMANDS; i++) histogram_merge_live(&total->latency[i], &stats->latency[i]);
+        total->scans += __atomic_load_n(&stats->scans, __ATOMIC_RELAXED);
+        total->docs_scanned += __atomic_load_n(&stats->docs_scanned, __ATOMIC_RELAXED);
+        total->indexed_searches += __atomic_load_n(&stats->indexed_searches, __ATOMIC_RELAXED);
+    }
+}
+
+const char *stats_command_name(int command) {
+    return command >= 0 && command < STATS_COMMANDS ? command_names[command] : "unknown";
+}
@@ -0,0 +1,258 @@
+#include "common.h"
+#include "wal.h"
+#include <stdint.h>
+#include <pthread.h>
+
+// Append-only log of index mutations. Each record is
+//   uint32 body length | uint32 CRC-32 of body | body
+// where the body is 'A' id title\0authors\0year\0path\0 or 'R' id.
+// Records carry the document id, so replaying a log over a base that already
+// contains part of it converges to the same state.
+// Positions in the log (LSNs) count every byte appended since startup, across
+// rotations; a writer waits in wal_sync until its LSN is durable.
+
+#define WAL_BUFFER 65536
+
+static int wal_fd = -1;
+static char wal_filename[256];
+static WalDurability wal_durability = WAL_BATCH;
+static char wal_buffer[WAL_BUFFER];
+static size_t wal_buffered = 0;
+static long wal_bytes = 0;     // bytes in the current file, committed or not
+static long wal_appended = 0;  // LSN of the last appended record
+static long wal_durable = 0;   // LSN covered by the last successful commit
+static int wal_syncing = 0;    // a group commit leader is in fdatasync
+static pthread_mutex_t wal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wal_synced = PTHREAD_COND_INITIALIZER;
+
+// Opens the file named by wal_filename for appending
+static int wal_reopen() {
+    wal_fd = open(wal_filename, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (wal_fd == -1) return -1;
+
+    struct stat st;
+    wal_bytes = fstat(wal_fd, &st) == 0 ? st.st_size : 0;
+    wal_buffered = 0;
+    return 0;
+}
+
+int wal_open(const char *filename, WalDurability durability) {
+    if (strlen(filename) >= sizeof(wal_filename)) return -1;
+    strcpy(wal_filename, filename);
+    wal_durability = durability;
+    return wal_reopen();
+}
+
+static int wal_flush_buffer() {
+    size_t done = 0;
+    while (done < wal_buffered) {
+        ssize_t n = write(wal_fd, wal_buffer + done, wal_buffered - done);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += n;
+    }
+    wal_buffered = 0;
+    return 0;
+}
+
+// Returns the record's LSN, or -1
+static long wal_append(const char *body, uint32_t len) {
+    uint32_t crc = crc32_update(0, body, len);
+    long lsn = -1;
+
+    pthread_mutex_lock(&wal_lock);
+    if (wal_fd != -1 && 8 + len <= WAL_BUFFER &&
+        (wal_buffered + 8 + len <= WAL_BUFFER || wal_flush_buffer() == 0)) {
+        memcpy(wal_buffer + wal_buffered, &len, 4);
+        memcpy(wal_buffer + wal_buffered + 4, &crc, 4);
+        memcpy(wal_buffer + wal_buffered + 8, body, len);
+        wal_buffered += 8 + len;
+        wal_bytes += 8 + len;
+        wal_appended += 8 + len;
+        lsn = wal_appended;
+    }
+    pthread_mutex_unlock(&wal_lock);
+    return lsn;
+}
+
+long wal_log_add(int id, const char *title, const char *authors, const char *year, const char *path) {
+    char body[1024];
+    uint32_t len = 0;
+    const char *fields[4] = { title, authors, year, path };
+
+    body[len++] = 'A';
+    memcpy(body + len, &id, sizeof(id));
+    len += sizeof(id);
+    for (int i = 0; i < 4; i++) {
+        size_t n = strlen(fields[i]) + 1;
+        if (len + n > sizeof(body)) return -1;
+        memcpy(body + len, fields[i], n);
+        len += n;
+    }
+    return wal_append(body, len);
+}
+
+long wal_log_remove(int id) {
+    char body[1 + sizeof(int)];
+    body[0] = 'R';
+    memcpy(body + 1, &id, sizeof(id));
+    return wal_append(body, sizeof(body));
+}
+
+// Caller holds wal_lock and no group commit is in flight
+static int wal_commit_locked() {
+    if (wal_fd == -1) return -1;
+    if (wal_flush_buffer() == -1) return -1;
+    if (wal_durability != WAL_NONE && fdatasync(wal_fd) == -1) return -1;
+    wal_durable = wal_appended;
+    return 0;
+}
+
+// Waits until the record at lsn is as durable as configured. With WAL_BATCH the first
+// waiter becomes the leader: it writes the buffer and runs one fdatasync outside the lock,
+// covering every record appended so far, while other writers keep appending.
+int wal_sync(long lsn) {
+    int rc = 0;
+    pthread_mutex_lock(&wal_lock);
+
+    if (wal_durability != WAL_BATCH) {
+        while (wal_syncing) pthread_cond_wait(&wal_synced, &wal_lock);
+        if (wal_durable < lsn) rc = wal_commit_locked();
+        pthread_mutex_unlock(&wal_lock);
+        return rc;
+    }
+
+    while (rc == 0 && wal_durable < lsn) {
+        if (wal_syncing) {
+            pthread_cond_wait(&wal_synced, &wal_lock);
+            continue;
+        }
+
+        long target = wal_appended;
+        int fd = wal_fd;
+        if (fd == -1 || wal_flush_buffer() == -1) {
+            rc = -1;
+            break;
+        }
+        wal_syncing = 1;
+        pthread_mutex_unlock(&wal_lock);
+        rc = fdatasync(fd);
+        pthread_mutex_lock(&wal_lock);
+        wal_syncing = 0;
+        if (rc == 0 && target > wal_durable) wal_durable = target;
+        pthread_cond_broadcast(&wal_synced);
+    }
+
+    pthread_mutex_unlock(&wal_lock);
+    return rc == 0 ? 0 : -1;
+}
+
+// Writes and syncs everything logged so far
+int wal_commit() {
+    pthread_mutex_lock(&wal_lock);
+    while (wal_syncing) pthread_cond_wait(&wal_synced, &wal_lock);
+    int rc = wal_commit_locked();
+    pthread_mutex_unlock(&wal_lock);
+    return rc;
+}
+
+long wal_size() {
+    pthread_mutex_lock(&wal_lock);
+    long bytes = wal_bytes;
+    pthread_mutex_unlock(&wal_lock);
+    return bytes;
+}
+
+// Commits and moves the current log aside (covered by a checkpoint in progress)
+int wal_rotate(const char *old_filename) {
+    pthread_mutex_lock(&wal_lock);
+    while (wal_syncing) pthread_cond_wait(&wal_synced, &wal_lock);
+
+    int rc = wal_commit_locked();
+    pthread_cond_broadcast(&wal_synced);
+    if (rc == 0) {
+        close(wal_fd);
+        wal_fd = -1;
+        rc = rename(wal_filename, old_filename) == -1 ? -1 : 0;
+        // Reopened even if the rename failed, so logging can continue
+        if (wal_reopen() == -1) rc = -1;
+    }
+    pthread_mutex_unlock(&wal_lock);
+    return rc;
+}
+
+// Empties the log once its records are in the base index
+int wal_reset() {
+    pthread_mutex_lock(&wal_lock);
+    while (wal_syncing) pthread_cond_wait(&wal_synced, &wal_lock);
+
+    int rc = -1;
+    if (wal_fd != -1) {
+        wal_buffered = 0;
+        wal_bytes = 0;
+        wal_durable = wal_appended;
+        rc = ftruncate(wal_fd, 0);
+        if (rc == 0 && wal_durability != WAL_NONE) rc = fsync(wal_fd);
+    }
+    pthread_mutex_unlock(&wal_lock);
+    return rc;
+}
+
+// Applies every intact record; a torn or corrupted tail (crash mid-write) is cut off.
+// Returns the number of records applied.
+int wal_replay(const char *filename, const WalHandlers *handlers) {
+    int fd = open(filename, O_RDWR);
+    if (fd == -1) return 0;
+
+    FILE *fp = fdopen(fd, "rb");
+    if (!fp) {
+        close(fd);
+        return -1;
+    }
+
+    int applied = 0;
+    long good = 0;
+    char body[1024];
+    uint32_t head[2];
+
+    while (fread(head, sizeof(uint32_t), 2, fp) == 2) {
+        uint32_t len = head[0];
+        if (len < 1 + sizeof(int) || len > sizeof(body) || fread(body, 1, len, fp) != len) break;
+        if (crc32_update(0, body, len) != head[1]) break;
+        if (body[0] == 'A' && body[len - 1] != '\0') break;
+
+        int id;
+        memcpy(&id, body + 1, sizeof(id));
+        if (body[0] == 'A') {
+            const char *fields[4];
+            const char *p = body + 1 + sizeof(id);
+            for (int i = 0; i < 4; i++) {
+                fields[i] = p < body + len ? p : "";
+                p += p < body + len ? strlen(p) + 1 : 0;
+            }
+            handlers->add(id, fields[0], fields[1], fields[2], fields[3]);
+        } else if (body[0] == 'R') {
+            handlers->remove(id);
+        } else {
+            break;
+        }
+        applied++;
+        good += 8 + len;
+    }
+
+    fflush(fp);
+    if (ftruncate(fd, good) == -1) applied = -1;
+    fclose(fp);
+    return applied;
+}
+
+void wal_close() {
+    if (wal_fd == -1) return;
+    wal_commit();
+    pthread_mutex_lock(&wal_lock);
+    close(wal_fd);
+    wal_fd = -1;
+    pthread_mutex_unlock(&wal_lock);
+}